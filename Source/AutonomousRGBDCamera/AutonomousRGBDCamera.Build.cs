@@ -41,6 +41,7 @@ public class AutonomousRGBDCamera : ModuleRules
 				"Slate",
 				"SlateCore",
 				"RenderCore",
+				"RHI",
 				"Networking",
 				"Sockets",
 				"Json", 
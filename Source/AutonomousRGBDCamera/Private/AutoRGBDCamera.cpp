@@ -11,6 +11,8 @@
 
 
 #include "AutoRGBDCamera.h"
+#include "Misc/App.h"
+#include "Engine/Engine.h"
 
 // Contructor for AutoRGBDCamera
 AAutoRGBDCamera::AAutoRGBDCamera()
@@ -33,13 +35,65 @@ AAutoRGBDCamera::AAutoRGBDCamera()
 
     // Show spatial relationships of scene objects in Output Log
 	ShowSpatialRelationships = true;
+
+    // Random streams
+    Seed = 0;
+    FirstFrame = 0;
+    FramesToSkip = 0;
+
+    // Poses generated ahead of time
+    PoseBlockSize = 1024;
+
+    // Lockstep generation
+    bLockstep = false;
+    FixedTimeStep = 1.0f / 30.0f;
+    SettleTicks = 1;
+    LockstepState = ELockstepState::Settle;
+    SettleTicksLeft = 0;
+    LockstepFramesPublished = 0;
+
+    // Frame budget
+    FrameBudget = 0;
+    ProgressInterval = 5.0f;
+    bStartInBounds = false;
+    TimeStart = 0.0;
+    TimeLastReport = 0.0;
+    FramesLastReport = 0;
+    bBudgetReached = false;
 }
 
 // Called when the game starts or when spawned
 void AAutoRGBDCamera::BeginPlay()
 {
+    if (bLockstep)
+    {
+        // Frames are captured by LockstepTick(). Every generated frame has to reach the clients,
+        // so the camera waits for a free packet instead of overwriting queued ones, the server
+        // keeps packets in the ring while a client is behind and the last ones are sent before stopping.
+        bManualCapture = true;
+        bDropOldestPackets = false;
+        bWaitForSlowClients = true;
+        StopDrainTimeout = FMath::Max(StopDrainTimeout, 10.0f);
+    }
+
 	Super::BeginPlay();
 
+    // Every shard draws from its own sequences, ShardId was validated by RGBDCamera
+    RandomTrajectory.SetSeed((uint32)Seed, PCGStream::StreamOf(ShardId, ERandomSubsystem::Trajectory));
+
+    if (bLockstep)
+    {
+        // Advance the simulation by the same step every frame and don't wait for the wall clock
+        FApp::SetUseFixedTimeStep(true);
+        FApp::SetFixedDeltaTime(FixedTimeStep);
+        GEngine->bSmoothFrameRate = false;
+        GEngine->bUseFixedFrameRate = false;
+
+        // Capture the initial scene once it settled
+        LockstepState = ELockstepState::Settle;
+        SettleTicksLeft = SettleTicks;
+    }
+
     // Spawn CameraTrajectory
     FVector Location(0.0f, 0.0f, 0.0f);
     FRotator Rotation(0.0f, 0.0f, 0.0f);
@@ -65,15 +119,26 @@ void AAutoRGBDCamera::BeginPlay()
     // Set ShowSpatialRelationships
 	SceneConfiguration->SetBShowSpatialRelationships(ShowSpatialRelationships);
 
+    // Scene changes are drawn from the random streams of the same seed and shard
+    SceneConfiguration->SetRandomSeed((uint32)Seed, ShardId);
+
     // Initialize the variables
     InitializeVariables();
 
+    // The pose of a spawned camera is arbitrary, so it starts in the middle of the bounds
+    if (bStartInBounds)
+    {
+        SetActorLocationAndRotation(FVector((XMin + XMax) / 2.0f, (YMin + YMax) / 2.0f, (ZMin + ZMax) / 2.0f),
+            FRotator((PitchMin + PitchMax) / 2.0f, (YawMin + YawMax) / 2.0f, (RollMin + RollMax) / 2.0f));
+    }
+
     // Get X, Y, Z, Roll, Pitch and Yaw values
     GetLocationAndRotationValues();
     
     // Enable Tick() if the camera is located within bounds
     if (CheckCameraInBounds() && EnableTick) 
     {
+        InitializePoseSampler();
         EnableTickUsingTickInterval();
     } 
     else if (!CheckCameraInBounds()) 
@@ -85,17 +150,36 @@ void AAutoRGBDCamera::BeginPlay()
     else {
         this->SetActorTickEnabled(false);
     }
+
+    TimeStart = FPlatformTime::Seconds();
+    TimeLastReport = TimeStart;
+    FramesLastReport = 0;
+    bBudgetReached = false;
+    FramesToSkip = FirstFrame;
 }
 
 // Called when the game starts or when spawned
 void AAutoRGBDCamera::EndPlay(const EEndPlayReason::Type EndPlayReason)
 {
     Super::EndPlay(EndPlayReason);
+
+    // How evenly the served poses covered the bounds
+    PoseSampler.LogCoverage();
+
+    if (bLockstep)
+    {
+        FApp::SetUseFixedTimeStep(false);
+    }
 }
 
 // Called every frame
 void AAutoRGBDCamera::Tick(float DeltaTime)
 {
+    // Stop generating once the frame budget is used up
+    if (CheckFrameBudget()) {
+        return;
+    }
+
 	// Update TicksWithPhysics and disable physics if necessary
 	if (TicksWithPhysics > 0) {
         --TicksWithPhysics;
@@ -107,27 +191,158 @@ void AAutoRGBDCamera::Tick(float DeltaTime)
         --TicksWithPhysics;
     }
 
+    // Jump to FirstFrame once the scene objects settled, like the run that generated the frames before it
+    if (FramesToSkip > 0) {
+        SkipFrames(FramesToSkip);
+        FramesToSkip = 0;
+    }
+
+    if (bLockstep)
+    {
+        LockstepTick(DeltaTime);
+        return;
+    }
+
     // Update SceneGraph using the current annotation data
     UpdateSceneGraph();
 
     // Generate data using the Tick() function from RGBDCamera
     Super::Tick(DeltaTime);
-    
-    // Generate new values for X, Y, Z, Roll, Pitch and Yaw
-    XValue = GenerateValueInBounds("X");
-    YValue = GenerateValueInBounds("Y");
-    ZValue = GenerateValueInBounds("Z");
-    RollValue = GenerateValueInBounds("Roll");
-    PitchValue = GenerateValueInBounds("Pitch");
-    YawValue = GenerateValueInBounds("Yaw");
 
-    // Set the new AutoRGBDCamera location and rotation
-    this->SetActorLocationAndRotation(FVector(XValue, YValue, ZValue),FRotator(PitchValue, YawValue, RollValue));
+    // Prepare the scene for the next frame
+    RandomizeScene(DeltaTime);
+}
+
+// Move the camera to a new pose and randomize the scene objects
+void AAutoRGBDCamera::RandomizeScene(float DeltaTime)
+{
+    // Take the next X, Y, Z, Roll, Pitch and Yaw values, they were generated ahead of time
+    PoseSampler.Next();
+    ApplyPose();
 
     // Modify the scene configuration using the Tick() function from SceneConfiguration
     SceneConfiguration->Tick(DeltaTime);
 }
 
+// Move the camera to the current pose of PoseSampler
+void AAutoRGBDCamera::ApplyPose()
+{
+    XValue = PoseSampler.Get(TrajectorySampler::AxisX);
+    YValue = PoseSampler.Get(TrajectorySampler::AxisY);
+    ZValue = PoseSampler.Get(TrajectorySampler::AxisZ);
+    RollValue = PoseSampler.Get(TrajectorySampler::AxisRoll);
+    PitchValue = PoseSampler.Get(TrajectorySampler::AxisPitch);
+    YawValue = PoseSampler.Get(TrajectorySampler::AxisYaw);
+
+    XDirection = PoseSampler.GetDirection(TrajectorySampler::AxisX);
+    YDirection = PoseSampler.GetDirection(TrajectorySampler::AxisY);
+    ZDirection = PoseSampler.GetDirection(TrajectorySampler::AxisZ);
+    RollDirection = PoseSampler.GetDirection(TrajectorySampler::AxisRoll);
+    PitchDirection = PoseSampler.GetDirection(TrajectorySampler::AxisPitch);
+    YawDirection = PoseSampler.GetDirection(TrajectorySampler::AxisYaw);
+
+    // Set the new AutoRGBDCamera location and rotation
+    this->SetActorLocationAndRotation(FVector(XValue, YValue, ZValue),FRotator(PitchValue, YawValue, RollValue));
+}
+
+// Move the camera and the scene forward by Count frames without rendering them
+void AAutoRGBDCamera::SkipFrames(uint64 Count)
+{
+    const double Start = FPlatformTime::Seconds();
+
+    // Every frame takes a fixed number of values from each random stream, so the streams end up where the run was
+    // at frame Count. Poses and swaps build on the frames before, so their draws are replayed without rendering.
+    PoseSampler.Skip(Count);
+    ApplyPose();
+    SceneConfiguration->SkipTicks(Count);
+
+    // The new scene has to settle before it is captured
+    SettleTicksLeft = SettleTicks;
+    UE_LOG(LogTemp, Display, TEXT("Skipped %llu frames in %.2f s."), Count, FPlatformTime::Seconds() - Start);
+}
+
+// One step of the lockstep generation, called by Tick() instead of the wall clock based capturing
+void AAutoRGBDCamera::LockstepTick(float DeltaTime)
+{
+    // Completes asynchronous readbacks, but doesn't capture on its own
+    Super::Tick(DeltaTime);
+
+    if (LockstepState == ELockstepState::WaitForHandoff)
+    {
+        // Continue with the next scene as soon as the last capture was handed to the server
+        if (GetFramesPublished() < LockstepFramesPublished)
+        {
+            return;
+        }
+        RandomizeScene(DeltaTime);
+        LockstepState = ELockstepState::Settle;
+        SettleTicksLeft = SettleTicks;
+    }
+    else if (SettleTicksLeft > 0)
+    {
+        --SettleTicksLeft;
+    }
+
+    // Give physics and the render state time to catch up with the new scene
+    if (SettleTicksLeft > 0)
+    {
+        return;
+    }
+
+    // Try again on the next frame if no client is connected or no packet is free
+    UpdateSceneGraph();
+    const uint64 FramesPublished = GetFramesPublished();
+    if (CaptureFrame())
+    {
+        LockstepFramesPublished = FramesPublished + 1;
+        LockstepState = ELockstepState::WaitForHandoff;
+    }
+}
+
+// Report the progress towards FrameBudget and quit once it is reached
+bool AAutoRGBDCamera::CheckFrameBudget()
+{
+    if (FrameBudget <= 0)
+    {
+        return false;
+    }
+    if (bBudgetReached)
+    {
+        return true;
+    }
+
+    const uint64 Frames = GetFramesPublished();
+    const double Now = FPlatformTime::Seconds();
+    if (Frames >= (uint64)FrameBudget)
+    {
+        const double Elapsed = FMath::Max(Now - TimeStart, 0.001);
+        UE_LOG(LogTemp, Display, TEXT("Generated %llu frames in %.1f s (%.1f frames/s)."), Frames, Elapsed, Frames / Elapsed);
+        bBudgetReached = true;
+
+        // Quitting the editor would end the session, so only the play session is paused there
+        if (GIsEditor)
+        {
+            Pause(true);
+        }
+        else
+        {
+            FPlatformMisc::RequestExit(false);
+        }
+        return true;
+    }
+
+    if (Now - TimeLastReport >= ProgressInterval)
+    {
+        const double Rate = (Frames - FramesLastReport) / (Now - TimeLastReport);
+        const double Average = Frames / FMath::Max(Now - TimeStart, 0.001);
+        UE_LOG(LogTemp, Display, TEXT("Frames: %llu/%d (%.1f%%), %.1f frames/s, remaining: %.0f s"), Frames, FrameBudget, Frames * 100.0 / FrameBudget,
+            Rate, Average > 0.0 ? (FrameBudget - Frames) / Average : 0.0);
+        TimeLastReport = Now;
+        FramesLastReport = Frames;
+    }
+    return false;
+}
+
 // Initialize the variables
 void AAutoRGBDCamera::InitializeVariables()
 {
@@ -156,13 +371,50 @@ void AAutoRGBDCamera::InitializeVariables()
     YawMax = CameraTrajectory->YawMax;
     YawStep = CameraTrajectory->YawStep;
 
-    // Initialize directions for X, Y, Z, Roll, Pitch and Yaw
-    XDirection = FMath::RandRange(-1,1);
-    YDirection = FMath::RandRange(-1,1);
-    ZDirection = FMath::RandRange(-1,1);
-    RollDirection = FMath::RandRange(-1,1);
-    PitchDirection = FMath::RandRange(-1,1);
-    YawDirection = FMath::RandRange(-1,1);
+    // Initialize directions for X, Y, Z, Roll, Pitch and Yaw, drawn as one batch
+    int32 Directions[6];
+    RandomTrajectory.FillRange(Directions, 6, -1, 1);
+    XDirection = Directions[0];
+    YDirection = Directions[1];
+    ZDirection = Directions[2];
+    RollDirection = Directions[3];
+    PitchDirection = Directions[4];
+    YawDirection = Directions[5];
+}
+
+// Start the trajectory of the pose at the current location and rotation
+void AAutoRGBDCamera::InitializePoseSampler()
+{
+    TrajectorySampler::Bounds Limits[TrajectorySampler::NumAxes];
+    Limits[TrajectorySampler::AxisX] = {XMin, XMax, XStep};
+    Limits[TrajectorySampler::AxisY] = {YMin, YMax, YStep};
+    Limits[TrajectorySampler::AxisZ] = {ZMin, ZMax, ZStep};
+    Limits[TrajectorySampler::AxisRoll] = {RollMin, RollMax, RollStep};
+    Limits[TrajectorySampler::AxisPitch] = {PitchMin, PitchMax, PitchStep};
+    Limits[TrajectorySampler::AxisYaw] = {YawMin, YawMax, YawStep};
+
+    const float Start[TrajectorySampler::NumAxes] = {XValue, YValue, ZValue, RollValue, PitchValue, YawValue};
+    PoseSampler.Init(Limits, Start, RandomTrajectory, PoseBlockSize);
+
+    // Low-discrepancy modes: all shards use the same randomly shifted sequence and take every ShardCount-th element of it,
+    // so together they cover the bounds as evenly as a single camera would
+    const bool bHalton = CameraTrajectory->Mode == TEXT("Halton");
+    if (bHalton || CameraTrajectory->Mode == TEXT("Sobol"))
+    {
+        PCGStream RandomOffsets((uint32)Seed, PCGStream::StreamOf(0, ERandomSubsystem::SequenceOffsets));
+        float Offsets[TrajectorySampler::NumAxes];
+        for (uint32 Index = 0; Index < TrajectorySampler::NumAxes; ++Index)
+        {
+            Offsets[Index] = RandomOffsets.FRand();
+        }
+        PoseSampler.SetLowDiscrepancy(bHalton ? TrajectorySampler::Mode::Halton : TrajectorySampler::Mode::Sobol, ShardId, ShardCount,
+            Offsets, CameraTrajectory->MinPoseDistance);
+        UE_LOG(LogTemp, Log, TEXT("Camera poses follow the %s sequence, minimum distance: %f"), *CameraTrajectory->Mode, CameraTrajectory->MinPoseDistance);
+    }
+    else if (CameraTrajectory->Mode != TEXT("RandomWalk"))
+    {
+        UE_LOG(LogTemp, Warning, TEXT("Unknown trajectory mode %s in CameraTrajectory.json, using RandomWalk."), *CameraTrajectory->Mode);
+    }
 }
 
 // Check if the camera is located within bounds
@@ -189,7 +441,7 @@ bool AAutoRGBDCamera::CheckCameraInBounds()
 void AAutoRGBDCamera::EnableTickUsingTickInterval()
 {
     PrimaryActorTick.Target = this;
-    PrimaryActorTick.TickInterval = TickInterval;
+    PrimaryActorTick.TickInterval = bLockstep ? 0.0f : TickInterval;
     PrimaryActorTick.SetTickFunctionEnable(true);
     PrimaryActorTick.RegisterTickFunction(GetLevel());
 }
@@ -210,111 +462,55 @@ void AAutoRGBDCamera::GetLocationAndRotationValues()
     YawValue = ActorRotation.Yaw;
 }
 
-// Generates a value within bounds for the variable used as the parameter
-float AAutoRGBDCamera::GenerateValueInBounds(FString VariableName)
-{
-    if (VariableName == "X"){
-        XDirection = FMath::RandRange(-1,1);
-        while(!CheckInBounds(XMin, XMax, XStep, XValue, XDirection)){
-           XDirection = FMath::RandRange(-1,1); 
-        }
-        return (XValue+(XStep*XDirection));
-    } 
-    
-    else if (VariableName == "Y"){
-        YDirection = FMath::RandRange(-1,1);
-        while(!CheckInBounds(YMin, YMax, YStep, YValue, YDirection)){
-           YDirection = FMath::RandRange(-1,1);
-        }
-        return (YValue+(YStep*YDirection));
-    }
-
-    else if (VariableName == "Z"){
-        ZDirection = FMath::RandRange(-1,1);
-        while(!CheckInBounds(ZMin, ZMax, ZStep, ZValue, ZDirection)){
-           ZDirection = FMath::RandRange(-1,1);
-        }
-        return (ZValue+(ZStep*ZDirection));
-    }
-
-    else if (VariableName == "Roll"){
-        RollDirection = FMath::RandRange(-1,1);
-        while(!CheckInBounds(RollMin, RollMax, RollStep, RollValue, RollDirection)){
-           RollDirection = FMath::RandRange(-1,1);
-        }
-        return (RollValue+(RollStep*RollDirection));
-    }
-
-    else if (VariableName == "Pitch"){
-        PitchDirection = FMath::RandRange(-1,1);
-        while(!CheckInBounds(PitchMin, PitchMax, PitchStep, PitchValue, PitchDirection)){
-           PitchDirection = FMath::RandRange(-1,1);
-        }
-        return (PitchValue+(PitchStep*PitchDirection));
-    }
-
-    else if (VariableName == "Yaw"){
-        YawDirection = FMath::RandRange(-1,1);
-        while(!CheckInBounds(YawMin, YawMax, YawStep, YawValue, YawDirection)){
-           YawDirection = FMath::RandRange(-1,1);
-        }
-        return (YawValue+(YawStep*YawDirection));
-    }
-
-    else {
-        return 0.0f;
-        UE_LOG(LogTemp, Warning, TEXT("Can't generate a new value for: %s"), *VariableName);
-        UE_LOG(LogTemp, Warning, TEXT("0.0f is used instead."));
-    }
-}
-
-// Check if value is >= min and <= max (bounds) after the step in a certain direction
-bool AAutoRGBDCamera::CheckInBounds(float Min, float Max, float Step, float Value, int32 Direction)
-{
-    float NewValue = Value+(Step*Direction);
-    if (NewValue >= Min && NewValue <= Max){
-        return true;
-    } else {
-        return false;
-    }
-}
-
 // Update SceneGraph using the current annotation data
 void AAutoRGBDCamera::UpdateSceneGraph()
 {
-    // Empty the arrays
-    SceneGraph.Objects.Empty();
-    SceneGraph.Relations.Empty();
+    // Keep the existing entries so that no memory is allocated once the arrays reached their size
+    const TArray<ASceneObject*>& SceneObjects = SceneConfiguration->ArrayOfSceneObjects;
+    SceneGraph.Objects.SetNum(SceneObjects.Num(), false);
 
     // Update SceneGraph.Objects
-    for (ASceneObject* SceneObject : SceneConfiguration->ArrayOfSceneObjects)
+    for (int32 i = 0; i < SceneObjects.Num(); ++i)
     {
-        PacketBuffer::ObjectDescription ObjectDescription;
-        PacketBuffer::ObjectProperty ObjectProperty;
+        ASceneObject* SceneObject = SceneObjects[i];
+        SceneGraph.Objects[i].Properties.SetNum(1, false);
+        PacketBuffer::ObjectProperty& ObjectProperty = SceneGraph.Objects[i].Properties[0];
         ObjectProperty.ID = SceneObject->SceneObjectID;
-        ObjectProperty.Mesh = SceneObject->MeshPath;
-        ObjectProperty.Material = SceneObject->MaterialPath;
+
+        // Paths only change when objects are replaced, so don't copy them every tick
+        if (!ObjectProperty.Mesh.Equals(SceneObject->MeshPath, ESearchCase::CaseSensitive))
+        {
+            ObjectProperty.Mesh = SceneObject->MeshPath;
+        }
+        if (!ObjectProperty.Material.Equals(SceneObject->MaterialPath, ESearchCase::CaseSensitive))
+        {
+            ObjectProperty.Material = SceneObject->MaterialPath;
+        }
+
         FVector Location = SceneObject->GetActorLocation();
-        ObjectProperty.Location.Add(Location.X);
-        ObjectProperty.Location.Add(Location.Y);
-        ObjectProperty.Location.Add(Location.Z);
+        ObjectProperty.Location.SetNum(3, false);
+        ObjectProperty.Location[0] = Location.X;
+        ObjectProperty.Location[1] = Location.Y;
+        ObjectProperty.Location[2] = Location.Z;
         FRotator Rotation = SceneObject->GetActorRotation();
-        ObjectProperty.Rotation.Add(Rotation.Roll);
-        ObjectProperty.Rotation.Add(Rotation.Pitch);
-        ObjectProperty.Rotation.Add(Rotation.Yaw);
-
-        ObjectDescription.Properties.Add(ObjectProperty);
-        SceneGraph.Objects.Add(ObjectDescription);
+        ObjectProperty.Rotation.SetNum(3, false);
+        ObjectProperty.Rotation[0] = Rotation.Roll;
+        ObjectProperty.Rotation[1] = Rotation.Pitch;
+        ObjectProperty.Rotation[2] = Rotation.Yaw;
     }
 
     // Update SceneGraph.Relations
-    for (TTuple<int32, FString, int32> SceneObjectRelationship : SceneConfiguration->ArrayOfSceneObjectRelationships)
-    {
-        PacketBuffer::ObjectRelation ObjectRelation;
-        ObjectRelation.ID1 = SceneObjectRelationship.Get<0>();
-        ObjectRelation.SpatialRelationship = SceneObjectRelationship.Get<1>();
-        ObjectRelation.ID2 = SceneObjectRelationship.Get<2>();
+    const TArray<TTuple<int32, FString, int32>>& Relationships = SceneConfiguration->ArrayOfSceneObjectRelationships;
+    SceneGraph.Relations.SetNum(Relationships.Num(), false);
 
-        SceneGraph.Relations.Add(ObjectRelation);
+    for (int32 i = 0; i < Relationships.Num(); ++i)
+    {
+        PacketBuffer::ObjectRelation& ObjectRelation = SceneGraph.Relations[i];
+        ObjectRelation.ID1 = Relationships[i].Get<0>();
+        if (!ObjectRelation.SpatialRelationship.Equals(Relationships[i].Get<1>(), ESearchCase::CaseSensitive))
+        {
+            ObjectRelation.SpatialRelationship = Relationships[i].Get<1>();
+        }
+        ObjectRelation.ID2 = Relationships[i].Get<2>();
     }
 }
\ No newline at end of file
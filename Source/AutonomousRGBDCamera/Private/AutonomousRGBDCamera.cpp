@@ -1,18 +1,21 @@
 // Copyright 1998-2019 Epic Games, Inc. All Rights Reserved.
 
 #include "AutonomousRGBDCamera.h"
+#include "BatchGeneration.h"
 
 #define LOCTEXT_NAMESPACE "FAutonomousRGBDCameraModule"
 
 void FAutonomousRGBDCameraModule::StartupModule()
 {
 	// This code will execute after your module is loaded into memory; the exact timing is specified in the .uplugin file per-module
+	BatchGeneration::Register();
 }
 
 void FAutonomousRGBDCameraModule::ShutdownModule()
 {
 	// This function may be called during shutdown to clean up your module.  For modules that support dynamic reloading,
 	// we call this function before unloading the module.
+	BatchGeneration::Unregister();
 }
 
 #undef LOCTEXT_NAMESPACE
@@ -0,0 +1,87 @@
+// Copyright 2017, Institute for Artificial Intelligence - University of Bremen
+
+#include "BatchGeneration.h"
+#include "AutoRGBDCamera.h"
+#include "AutonomousRGBDCamera.h"
+#include "EngineUtils.h"
+#include "Misc/CommandLine.h"
+#include "Misc/Parse.h"
+
+FDelegateHandle BatchGeneration::WorldHandle;
+
+void BatchGeneration::Register()
+{
+	int32 Frames = 0;
+	if(!FParse::Value(FCommandLine::Get(), TEXT("AutoRGBDFrames="), Frames) || Frames <= 0)
+	{
+		return;
+	}
+
+	OUT_INFO(TEXT("Batch generation of %d frames requested."), Frames);
+	WorldHandle = FWorldDelegates::OnWorldInitializedActors.AddStatic(&BatchGeneration::OnWorldInitializedActors);
+}
+
+void BatchGeneration::Unregister()
+{
+	if(WorldHandle.IsValid())
+	{
+		FWorldDelegates::OnWorldInitializedActors.Remove(WorldHandle);
+		WorldHandle.Reset();
+	}
+}
+
+void BatchGeneration::OnWorldInitializedActors(const UWorld::FActorsInitializedParams &Params)
+{
+	UWorld *World = Params.World;
+	if(!World || !World->IsGameWorld())
+	{
+		return;
+	}
+
+	const TCHAR *CommandLine = FCommandLine::Get();
+	int32 Frames = 0;
+	FParse::Value(CommandLine, TEXT("AutoRGBDFrames="), Frames);
+
+	// A camera placed in the map keeps its settings, only the command line options override them
+	TActorIterator<AAutoRGBDCamera> It(World);
+	if(It)
+	{
+		OUT_INFO(TEXT("Using %s for batch generation."), *It->GetName());
+		Configure(**It, CommandLine, Frames);
+		return;
+	}
+
+	// Spawned deferred, so that the options are set before BeginPlay
+	AAutoRGBDCamera *Camera = World->SpawnActorDeferred<AAutoRGBDCamera>(AAutoRGBDCamera::StaticClass(), FTransform::Identity);
+	if(!Camera)
+	{
+		OUT_ERROR(TEXT("Could not spawn AutoRGBDCamera for batch generation."));
+		return;
+	}
+	Camera->bStartInBounds = true;
+	Configure(*Camera, CommandLine, Frames);
+	Camera->FinishSpawning(FTransform::Identity);
+	OUT_INFO(TEXT("Spawned %s for batch generation."), *Camera->GetName());
+}
+
+void BatchGeneration::Configure(AAutoRGBDCamera &Camera, const TCHAR *CommandLine, const int32 Frames)
+{
+	// Lockstep mode makes sure that exactly the requested frames reach the sink
+	Camera.FrameBudget = Frames;
+	Camera.bLockstep = true;
+	Camera.EnableTick = true;
+
+	FParse::Value(CommandLine, TEXT("AutoRGBDOutput="), Camera.OutputFile);
+	FParse::Value(CommandLine, TEXT("AutoRGBDPort="), Camera.ServerPort);
+	FParse::Value(CommandLine, TEXT("AutoRGBDWidth="), Camera.Width);
+	FParse::Value(CommandLine, TEXT("AutoRGBDHeight="), Camera.Height);
+	FParse::Value(CommandLine, TEXT("AutoRGBDStep="), Camera.FixedTimeStep);
+	FParse::Value(CommandLine, TEXT("AutoRGBDSettle="), Camera.SettleTicks);
+	FParse::Value(CommandLine, TEXT("AutoRGBDSeed="), Camera.Seed);
+	FParse::Value(CommandLine, TEXT("AutoRGBDShard="), Camera.ShardId);
+	FParse::Value(CommandLine, TEXT("AutoRGBDShards="), Camera.ShardCount);
+	FParse::Value(CommandLine, TEXT("AutoRGBDFirstFrame="), Camera.FirstFrame);
+
+	OUT_INFO(TEXT("Generating %d frames of %u x %u pixels as shard %d of %d into %s."), Frames, Camera.Width, Camera.Height, Camera.ShardId, Camera.ShardCount,
+		Camera.OutputFile.IsEmpty() ? *FString::Printf(TEXT("TCP port %d"), Camera.ServerPort) : *Camera.OutputFile);
+}
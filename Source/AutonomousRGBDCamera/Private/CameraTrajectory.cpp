@@ -18,6 +18,10 @@ ACameraTrajectory::ACameraTrajectory()
  	// Set this actor to call Tick() every frame
 	PrimaryActorTick.bCanEverTick = false;
 
+    // Defaults if the JSON file is missing
+    Mode = TEXT("RandomWalk");
+    MinPoseDistance = 0.0f;
+
     // Load the JSON file from the project's config directory
     LoadJsonFile();
     
@@ -93,5 +97,12 @@ void ACameraTrajectory::InitializeVariables()
             YawMin = JsonObject->GetNumberField("YawMin");
 			YawMax = JsonObject->GetNumberField("YawMax");
 			YawStep = JsonObject->GetNumberField("YawStep");
+
+            // Optional fields, older files only describe the random walk
+            Mode = TEXT("RandomWalk");
+            JsonObject->TryGetStringField("Mode", Mode);
+            double Distance = 0.0;
+            JsonObject->TryGetNumberField("MinPoseDistance", Distance);
+            MinPoseDistance = Distance;
 		}
 }
\ No newline at end of file
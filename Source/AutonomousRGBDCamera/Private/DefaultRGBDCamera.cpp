@@ -7,13 +7,19 @@
 #include "EngineUtils.h"
 #include "StopTime.h"
 #include "Server.h"
+#include "SharedMemoryServer.h"
+#include "FileSink.h"
+#include "ImageConversion.h"
+#include "WorkerPool.h"
+#include "ImageReadback.h"
 #include <fstream>
 #include <sstream>
 #include <algorithm>
-#include <thread>
-#include <mutex>
 #include <cmath>
-#include <condition_variable>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
 #include "SegmentationComponent.h"
 
 
@@ -21,13 +27,59 @@
 class AUTONOMOUSRGBDCAMERA_API ADefaultRGBDCamera::PrivateData
 {
 public:
+	typedef std::chrono::steady_clock Clock;
+
+	// A frame on its way through the pipeline: serialize annotations -> readback -> convert channels -> publish
+	struct Frame
+	{
+		// Images read from the render targets, converted into the packet by the workers.
+		// The depth image is kept as raw bytes, its pixel format depends on DepthTargetFormat.
+		TArray<FColor> ImageColor, ImageObject;
+		TArray<uint8> ImageDepth;
+		PacketBuffer::Packet *Packet;
+		// Conversion of one channel, split into row tiles
+		WorkerPool::Job JobColor, JobDepth, JobObject;
+		// Number of channels still being converted
+		std::atomic<int32> PendingChannels;
+		// Set by the game thread when the frame enters the pipeline, cleared after publishing
+		std::atomic<bool> InFlight;
+		// All channels are converted, guarded by LockPublish
+		bool Converted;
+		// Frames are numbered in capture order and published in the same order
+		uint64 Number;
+		// Start of the frame, end of the readback of the last image and end of the conversion
+		Clock::time_point TimeStart, TimeReadback, TimeConverted;
+		uint64 DurationSerialize;
+	};
+
 	TSharedPtr<PacketBuffer> Buffer;
 	TCPServer Server;
-	std::mutex WaitColor, WaitDepth, WaitObject, WaitDone;
-	std::condition_variable CVColor, CVDepth, CVObject, CVDone;
-	std::thread ThreadColor, ThreadDepth, ThreadObject;
-	bool DoColor, DoDepth, DoObject;
-	bool DoneColor, DoneObject;
+	SharedMemoryServer SharedMemory;
+	FileSink File;
+	// Persistent staging textures for reading back the render targets
+	ImageReadback ReadbackColor, ReadbackDepth, ReadbackObject;
+	// Pixel format of the depth render target
+	EPixelFormat DepthTargetFormat;
+	// Threads converting the images tile by tile, shared by all frames and channels
+	WorkerPool Pool;
+	uint32 NumTiles;
+	// Enabled channels
+	uint32 Channels;
+
+	// Frame N uses Frames[N % Frames.size()], so a new frame can only start once the oldest one is published
+	std::vector<std::unique_ptr<Frame>> Frames;
+	uint64 NextFrame;
+	uint64 NextPublish;
+	std::mutex LockPublish;
+
+	// Statistics, stage times are summed up in microseconds
+	std::atomic<uint64> FramesPublished, FramesSkipped;
+	std::atomic<uint64> TimeReadback, TimeSerialize, TimeConvert, TimePublish;
+
+	static uint64 Microseconds(const Clock::time_point &Start, const Clock::time_point &End)
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(End - Start).count();
+	}
 };
 
 // Sets default values
@@ -77,11 +129,36 @@ ADefaultRGBDCamera::ADefaultRGBDCamera() /*: ACameraActor(), Width(960), Height(
 	// Capture flags default values
 	bCaptureColorImage = true;
 	bCaptureDepthImage = true;
+	DepthFormat = EDepthFormat::Float16;
 	bCaptureObjectMaskImage = true;
 	
 	// TCP IP communication server port
 	ServerPort = 10000;
 	bBindToAnyIP = true;
+	bUseSharedMemory = false;
+	SharedMemoryName = TEXT("/AutonomousRGBDCamera");
+	OutputFile = TEXT("");
+	ShardId = 0;
+	ShardCount = 1;
+
+	// Packet ring between capturing and sending
+	PacketSlots = 3;
+	bDropOldestPackets = true;
+	ClientQueueLimit = 2;
+	bDisconnectSlowClients = false;
+	SlowClientLag = 30;
+	bWaitForSlowClients = false;
+	StopDrainTimeout = 0.0f;
+	bZeroCopySend = false;
+
+	// Image conversion
+	bCaptureOnDemand = false;
+	bAsyncReadback = false;
+	ReadbackLatency = 2;
+	bManualCapture = false;
+	WorkerThreads = 0;
+	FramesInFlight = 2;
+	TileRows = 32;
 
 	bColorAllObjectsOnEveryTick = false;
 	bColoringObjectsIsVerbose = false;
@@ -122,18 +199,75 @@ void ADefaultRGBDCamera::BeginPlay()
 	Super::BeginPlay();
 	OUT_INFO(TEXT("Begin play!"));
 
-	// Initializing buffers for reading images from the GPU
-	ImageColor.AddUninitialized(Width * Height);
-	ImageDepth.AddUninitialized(Width * Height);
-	ImageObject.AddUninitialized(Width * Height);
+	ShardCount = FMath::Max(ShardCount, 1);
+	if(ShardId < 0 || ShardId >= ShardCount)
+	{
+		OUT_WARN(TEXT("ShardId %d is not below ShardCount %d, using shard 0."), ShardId, ShardCount);
+		ShardId = 0;
+	}
 
-	// Creating double buffer and setting the pointer of the server object
+	// Only enabled channels are part of the packets
+	uint32 Channels = 0;
+	Channels |= bCaptureColorImage ? PacketBuffer::ChannelColor : 0;
+	Channels |= bCaptureDepthImage ? PacketBuffer::ChannelDepth : 0;
+	Channels |= bCaptureObjectMaskImage ? PacketBuffer::ChannelObject : 0;
+
+	// A client with a full queue must still leave a slot for every frame in flight and one for the next frame
+	FramesInFlight = FMath::Max(FramesInFlight, 1);
+	if(bAsyncReadback && FramesInFlight < ReadbackLatency + 1)
+	{
+		// Otherwise frames would be skipped while waiting for the GPU
+		OUT_INFO(TEXT("Using %d frames in flight for a readback latency of %d."), ReadbackLatency + 1, ReadbackLatency);
+		FramesInFlight = ReadbackLatency + 1;
+	}
+	if(PacketSlots < ClientQueueLimit + FramesInFlight + 1)
+	{
+		OUT_WARN(TEXT("PacketSlots (%d) is too small for ClientQueueLimit (%d) and FramesInFlight (%d), using %d."), PacketSlots, ClientQueueLimit,
+			FramesInFlight, ClientQueueLimit + FramesInFlight + 1);
+		PacketSlots = ClientQueueLimit + FramesInFlight + 1;
+	}
+
+	// Creating the packet ring and setting the pointer of the server object
 	Priv = new PrivateData();
-	Priv->Buffer = TSharedPtr<PacketBuffer>(new PacketBuffer(Width, Height, FieldOfView));
+	const PacketBuffer::DepthFormat DepthEncoding = DepthFormat == EDepthFormat::Meters ? PacketBuffer::DepthFormat::Meters
+		: DepthFormat == EDepthFormat::Millimeters ? PacketBuffer::DepthFormat::Millimeters : PacketBuffer::DepthFormat::Float16;
+	Priv->Buffer = TSharedPtr<PacketBuffer>(new PacketBuffer(Width, Height, FieldOfView, PacketSlots,
+		bDropOldestPackets ? PacketBuffer::OverflowPolicy::DropOldest : PacketBuffer::OverflowPolicy::DropNewest, Channels, DepthEncoding));
+	Priv->Channels = Channels;
+	Priv->NextFrame = 0;
+	Priv->NextPublish = 0;
+	Priv->FramesPublished = 0;
+	Priv->FramesSkipped = 0;
+	Priv->TimeReadback = 0;
+	Priv->TimeSerialize = 0;
+	Priv->TimeConvert = 0;
+	Priv->TimePublish = 0;
 	Priv->Server.Buffer = Priv->Buffer;
-
-	// Starting server
-	Priv->Server.Start(ServerPort, bBindToAnyIP);
+	Priv->SharedMemory.Buffer = Priv->Buffer;
+	Priv->File.Buffer = Priv->Buffer;
+	// Smaller packets are cheaper to copy than to pin
+	Priv->Server.ZeroCopyThreshold = bZeroCopySend ? 64 * 1024 : 0;
+	Priv->Server.QueueLimit = ClientQueueLimit;
+	Priv->Server.SlowPolicy = bWaitForSlowClients ? TCPServer::SlowClientPolicy::Wait
+		: bDisconnectSlowClients ? TCPServer::SlowClientPolicy::Disconnect : TCPServer::SlowClientPolicy::DropFrames;
+	Priv->Server.DisconnectLag = SlowClientLag;
+	Priv->Server.MaxPinnedSlots = PacketSlots - FramesInFlight - 1;
+	Priv->Server.UnixSocketPath = UnixSocketPath;
+	Priv->Server.DrainTimeoutMs = FMath::RoundToInt(StopDrainTimeout * 1000.0f);
+
+	// Starting server, all of them read from the same ring so only one of them is used
+	if(!OutputFile.IsEmpty())
+	{
+		Priv->File.Start(OutputFile);
+	}
+	else if(bUseSharedMemory)
+	{
+		Priv->SharedMemory.Start(SharedMemoryName);
+	}
+	else
+	{
+		Priv->Server.Start(ServerPort, bBindToAnyIP);
+	}
 
 	// Coloring all objects
 	// If colors will be reassigned on every tick, we have to
@@ -152,15 +286,53 @@ void ADefaultRGBDCamera::BeginPlay()
 
 	ColorAllObjects();
 
+	OUT_INFO(TEXT("Image conversion kernels: %s"), ImageConversion::GetKernelNames());
+
 	Running = true;
 	Paused = false;
 
-	Priv->DoColor = false;
-	Priv->DoObject = false;
-	Priv->DoDepth = false;
+	// Every job converts the pixels of TileRows rows per tile straight into the packet of its frame
+	const uint32 RowsPerTile = FMath::Min<uint32>(FMath::Max(TileRows, 1), Height);
+	Priv->NumTiles = (Height + RowsPerTile - 1) / RowsPerTile;
+	auto TileToPixels = [this, RowsPerTile](const uint32 Tile, uint32 &Begin, uint32 &Count)
+	{
+		Begin = Tile * RowsPerTile * Width;
+		Count = FMath::Min(RowsPerTile, Height - Tile * RowsPerTile) * Width;
+	};
+	for(int32 Index = 0; Index < FramesInFlight; ++Index)
+	{
+		PrivateData::Frame *Current = new PrivateData::Frame();
+		Priv->Frames.emplace_back(Current);
 
-	Priv->DoneColor = false;
-	Priv->DoneObject = false;
+		Current->Packet = nullptr;
+		Current->PendingChannels = 0;
+		Current->InFlight = false;
+		Current->Converted = false;
+		Current->Number = 0;
+
+		Current->JobColor.Work = [this, Current, TileToPixels](const uint32 Tile)
+		{
+			uint32 Begin, Count;
+			TileToPixels(Tile, Begin, Count);
+			ToColorRGBImage(Current->ImageColor, Current->Packet->Color, Begin, Count);
+		};
+		Current->JobDepth.Work = [this, Current, TileToPixels](const uint32 Tile)
+		{
+			uint32 Begin, Count;
+			TileToPixels(Tile, Begin, Count);
+			ToDepthImage(Current->ImageDepth, Current->Packet->Depth, Begin, Count);
+		};
+		Current->JobObject.Work = [this, Current, TileToPixels](const uint32 Tile)
+		{
+			uint32 Begin, Count;
+			TileToPixels(Tile, Begin, Count);
+			ToColorRGBImage(Current->ImageObject, Current->Packet->Object, Begin, Count);
+		};
+		Current->JobColor.Done = [this, Index] {FinishChannel(Index); };
+		Current->JobDepth.Done = [this, Index] {FinishChannel(Index); };
+		Current->JobObject.Done = [this, Index] {FinishChannel(Index); };
+	}
+	Priv->Pool.Start(WorkerThreads);
 
 	//Settings the right camera parameters from UE4 editor
 
@@ -173,32 +345,85 @@ void ADefaultRGBDCamera::BeginPlay()
 	DepthImgCaptureComp->FOVAngle = this->FieldOfView;
 	ObjectMaskImgCaptureComp->FOVAngle = this->FieldOfView;
 
-	ColorImgCaptureComp->TextureTarget->InitAutoFormat(Width, Height);
-	DepthImgCaptureComp->TextureTarget->InitAutoFormat(Width, Height);
-	ObjectMaskImgCaptureComp->TextureTarget->InitAutoFormat(Width, Height);
+	// The color image and the object mask are read back as BGRA bytes, linear so that the colors are stored unchanged
+	ColorImgCaptureComp->TextureTarget->InitCustomFormat(Width, Height, PF_B8G8R8A8, true);
+	ObjectMaskImgCaptureComp->TextureTarget->InitCustomFormat(Width, Height, PF_B8G8R8A8, true);
+
+	// The depth material only writes the red channel, so a single channel target is enough.
+	// Meters and millimeters are computed from 32 bit floats, the raw half floats are copied as they are.
+	Priv->DepthTargetFormat = DepthFormat == EDepthFormat::Float16 ? PF_R16F : PF_R32_FLOAT;
+	if(!GPixelFormats[Priv->DepthTargetFormat].Supported)
+	{
+		OUT_WARN(TEXT("Pixel format %s is not supported, using RGBA half floats for the depth image."), GPixelFormats[Priv->DepthTargetFormat].Name);
+		Priv->DepthTargetFormat = PF_FloatRGBA;
+	}
+	DepthImgCaptureComp->TextureTarget->InitCustomFormat(Width, Height, Priv->DepthTargetFormat, true);
+
+	// Every frame in flight has its own staging textures for asynchronous readback
+	const uint32 Latency = bAsyncReadback ? ReadbackLatency : 0;
+	Priv->ReadbackColor.Init(ColorImgCaptureComp->TextureTarget, FramesInFlight, Latency);
+	Priv->ReadbackDepth.Init(DepthImgCaptureComp->TextureTarget, FramesInFlight, Latency);
+	Priv->ReadbackObject.Init(ObjectMaskImgCaptureComp->TextureTarget, FramesInFlight, Latency);
+
+	// The conversion of an asynchronously read image is started by the render thread as soon as it arrived
+	Priv->ReadbackColor.OnReady = [this](const uint32 Slot)
+	{
+		Priv->Frames[Slot]->TimeReadback = PrivateData::Clock::now();
+		Priv->Pool.Submit(Priv->Frames[Slot]->JobColor, Priv->NumTiles);
+	};
+	Priv->ReadbackDepth.OnReady = [this](const uint32 Slot)
+	{
+		Priv->Frames[Slot]->TimeReadback = PrivateData::Clock::now();
+		Priv->Pool.Submit(Priv->Frames[Slot]->JobDepth, Priv->NumTiles);
+	};
+	Priv->ReadbackObject.OnReady = [this](const uint32 Slot)
+	{
+		Priv->Frames[Slot]->TimeReadback = PrivateData::Clock::now();
+		Priv->Pool.Submit(Priv->Frames[Slot]->JobObject, Priv->NumTiles);
+	};
 
-	// Starting threads to process image data
+	// Initializing buffers for reading images from the GPU, they are reused for every frame
+	for(std::unique_ptr<PrivateData::Frame> &Current : Priv->Frames)
+	{
+		Current->ImageColor.AddUninitialized(bCaptureColorImage ? Width * Height : 0);
+		Current->ImageDepth.AddUninitialized(bCaptureDepthImage ? Priv->ReadbackDepth.GetSize() : 0);
+		Current->ImageObject.AddUninitialized(bCaptureObjectMaskImage ? Width * Height : 0);
+	}
+
+	// Staging memory is allocated once and stays constant
+	uint64 StagingSize = 0;
+	StagingSize += bCaptureColorImage ? Priv->ReadbackColor.GetSize() : 0;
+	StagingSize += bCaptureDepthImage ? Priv->ReadbackDepth.GetSize() : 0;
+	StagingSize += bCaptureObjectMaskImage ? Priv->ReadbackObject.GetSize() : 0;
+	OUT_INFO(TEXT("Staging memory: %llu bytes for %d frames in flight."), StagingSize * FramesInFlight, FramesInFlight);
+
+	// On demand, the captures are only rendered by CaptureScene in Tick
+	ColorImgCaptureComp->bCaptureEveryFrame = !bCaptureOnDemand;
+	DepthImgCaptureComp->bCaptureEveryFrame = !bCaptureOnDemand;
+	ObjectMaskImgCaptureComp->bCaptureEveryFrame = !bCaptureOnDemand;
+	ColorImgCaptureComp->bCaptureOnMovement = !bCaptureOnDemand;
+	DepthImgCaptureComp->bCaptureOnMovement = !bCaptureOnDemand;
+	ObjectMaskImgCaptureComp->bCaptureOnMovement = !bCaptureOnDemand;
+
+	// Activating the capture components of the enabled channels
 	if (bCaptureColorImage)
 	{
 		ColorImgCaptureComp->SetHiddenInGame(false);
 		ColorImgCaptureComp->Activate();
 		bCompActive = true;
 		ColorImgCaptureComp->TextureTarget->TargetGamma = GEngine->GetDisplayGamma();
-		Priv->ThreadColor = std::thread(&ADefaultRGBDCamera::ProcessColor, this);
 	}
 	if (bCaptureDepthImage)
 	{
 		DepthImgCaptureComp->SetHiddenInGame(false);
 		DepthImgCaptureComp->Activate();
 		bCompActive = true;
-		Priv->ThreadDepth = std::thread(&ADefaultRGBDCamera::ProcessDepth, this);
 	}
 	if (bCaptureObjectMaskImage)
 	{
 		ObjectMaskImgCaptureComp->SetHiddenInGame(false);
 		ObjectMaskImgCaptureComp->Activate();
 		bCompActive = true;
-		Priv->ThreadObject = std::thread(&ADefaultRGBDCamera::ProcessObject, this);
 	}
 }
 
@@ -210,19 +435,39 @@ void ADefaultRGBDCamera::EndPlay(const EEndPlayReason::Type EndPlayReason)
 
 	Running = false;
 
-	// Stopping processing threads
-	Priv->DoColor = true;
-	Priv->DoDepth = true;
-	Priv->DoObject = true;
-	Priv->CVColor.notify_one();
-	Priv->CVDepth.notify_one();
-	Priv->CVObject.notify_one();
-
-	Priv->ThreadColor.join();
-	Priv->ThreadDepth.join();
-	Priv->ThreadObject.join();
+	// Stopping the worker threads, frames in flight are read back, converted and published first
+	Priv->ReadbackColor.Flush();
+	Priv->ReadbackDepth.Flush();
+	Priv->ReadbackObject.Flush();
+	const float Utilization = Priv->Pool.GetUtilization();
+	const uint32 NumThreads = Priv->Pool.GetNumThreads();
+	Priv->Pool.Stop();
+	OUT_INFO(TEXT("Worker threads: %u, utilization: %.1f%%"), NumThreads, Utilization * 100.0f);
+
+	Priv->ReadbackColor.Release();
+	Priv->ReadbackDepth.Release();
+	Priv->ReadbackObject.Release();
+
+	const uint64 Published = FMath::Max<uint64>(Priv->FramesPublished, 1);
+	OUT_INFO(TEXT("Frames published: %llu, skipped with %d frames in flight: %llu"), (uint64)Priv->FramesPublished, FramesInFlight, (uint64)Priv->FramesSkipped);
+	OUT_INFO(TEXT("Average stage times: readback %.2f ms, serialize %.2f ms, convert %.2f ms, publish %.2f ms"), Priv->TimeReadback / (Published * 1000.0),
+		Priv->TimeSerialize / (Published * 1000.0), Priv->TimeConvert / (Published * 1000.0), Priv->TimePublish / (Published * 1000.0));
+
+	if(!OutputFile.IsEmpty())
+	{
+		Priv->File.Stop();
+	}
+	else if(bUseSharedMemory)
+	{
+		Priv->SharedMemory.Stop();
+	}
+	else
+	{
+		Priv->Server.Stop();
+	}
 
-	Priv->Server.Stop();
+	OUT_INFO(TEXT("Packets committed: %llu, overwritten: %llu, dropped: %llu"), (uint64)Priv->Buffer->PacketsCommitted,
+		(uint64)Priv->Buffer->PacketsOverwritten, (uint64)Priv->Buffer->PacketsDropped);
 }
 
 // Called every frame
@@ -230,12 +475,26 @@ void ADefaultRGBDCamera::Tick(float DeltaTime)
 {
 	Super::Tick(DeltaTime);
 
+	// Frames waiting for the GPU are completed even while paused
+	if(bAsyncReadback)
+	{
+		Priv->ReadbackColor.Poll();
+		Priv->ReadbackDepth.Poll();
+		Priv->ReadbackObject.Poll();
+	}
+
 	// Check if paused
 	if(Paused)
 	{
 		return;
 	}
 
+	// The capture is triggered by a subclass, e.g. in lockstep mode
+	if(bManualCapture)
+	{
+		return;
+	}
+
 	// Check for framerate
 	TimePassed += DeltaTime;
 	if(TimePassed < 1.0f / Framerate)
@@ -246,6 +505,11 @@ void ADefaultRGBDCamera::Tick(float DeltaTime)
 	//MEASURE_TIME("Tick");
 	//OUT_INFO(TEXT("FRAME_RATE: %f"),Framerate)
 
+	CaptureFrame();
+}
+
+bool ADefaultRGBDCamera::CaptureFrame()
+{
 	if(bColorAllObjectsOnEveryTick)
 	{
 		// Remove all old object color mapping information
@@ -257,52 +521,124 @@ void ADefaultRGBDCamera::Tick(float DeltaTime)
 	UpdateComponentTransforms();
 
 	// Check if client is connected
-	if(!Priv->Server.HasClient())
+	if(!OutputFile.IsEmpty() ? !Priv->File.HasClient() : bUseSharedMemory ? !Priv->SharedMemory.HasClient() : !Priv->Server.HasClient())
 	{
-		return;
+		return false;
 	}
 
+	// Clients limiting their rate would drop the frame anyway, so it is not even rendered
 	FDateTime Now = FDateTime::UtcNow();
-	Priv->Buffer->HeaderWrite->TimestampCapture = Now.ToUnixTimestamp() * 1000000000 + Now.GetMillisecond() * 1000000;
+	const uint64 TimestampCapture = Now.ToUnixTimestamp() * 1000000000 + Now.GetMillisecond() * 1000000;
+	if(!bUseSharedMemory && OutputFile.IsEmpty() && TimestampCapture < Priv->Server.GetNextCaptureDue())
+	{
+		return false;
+	}
+
+	// Skip the frame while all frames are in flight, the oldest one has to be published first
+	const uint32 Index = Priv->NextFrame % Priv->Frames.size();
+	PrivateData::Frame &Current = *Priv->Frames[Index];
+	if(Current.InFlight)
+	{
+		++Priv->FramesSkipped;
+		return false;
+	}
+
+	// Get a packet from the ring, it is nullptr if the frame has to be dropped
+	PacketBuffer::Packet *Packet = Priv->Buffer->AcquireWrite();
+	if(!Packet)
+	{
+		return false;
+	}
+	Current.TimeStart = PrivateData::Clock::now();
+
+	Packet->Header->TimestampCapture = TimestampCapture;
+	Packet->Header->ShardId = ShardId;
+	Packet->Header->ShardCount = ShardCount;
 
 	FVector Translation = GetActorLocation();
 	FQuat Rotation = GetActorQuat();
 	// Convert to meters and ROS coordinate system
-	Priv->Buffer->HeaderWrite->Translation.X = Translation.X / 100.0f;
-	Priv->Buffer->HeaderWrite->Translation.Y = -Translation.Y / 100.0f;
-	Priv->Buffer->HeaderWrite->Translation.Z = Translation.Z / 100.0f;
-	Priv->Buffer->HeaderWrite->Rotation.X = -Rotation.X;
-	Priv->Buffer->HeaderWrite->Rotation.Y = Rotation.Y;
-	Priv->Buffer->HeaderWrite->Rotation.Z = -Rotation.Z;
-	Priv->Buffer->HeaderWrite->Rotation.W = Rotation.W;
-
-	// Start writing to buffer
-	Priv->Buffer->StartWriting(ObjectToColor, ObjectColors, SceneGraph);
-
-	// Read color image and notify processing thread
-	Priv->WaitColor.lock();
-	ReadColorImage(ColorImgCaptureComp->TextureTarget, ImageColor);
-	Priv->WaitColor.unlock();
-	Priv->DoColor = true;
-	Priv->CVColor.notify_one();
-
-	// Read object image and notify processing thread
-	Priv->WaitObject.lock();
-	ReadImage(ObjectMaskImgCaptureComp->TextureTarget, ImageObject);
-	Priv->WaitObject.unlock();
-	Priv->DoObject = true;
-	Priv->CVObject.notify_one();
-
-	/* Read depth image and notify processing thread. Depth processing is called last,
-	* because the color image processing thread take more time so they can already begin.
-	* The depth processing thread will wait for the others to be finished and then releases
-	* the buffer.
-	*/
-	Priv->WaitDepth.lock();
-	ReadImage(DepthImgCaptureComp->TextureTarget, ImageDepth);
-	Priv->WaitDepth.unlock();
-	Priv->DoDepth = true;
-	Priv->CVDepth.notify_one();
+	Packet->Header->Translation.X = Translation.X / 100.0f;
+	Packet->Header->Translation.Y = -Translation.Y / 100.0f;
+	Packet->Header->Translation.Z = Translation.Z / 100.0f;
+	Packet->Header->Rotation.X = -Rotation.X;
+	Packet->Header->Rotation.Y = Rotation.Y;
+	Packet->Header->Rotation.Z = -Rotation.Z;
+	Packet->Header->Rotation.W = Rotation.W;
+
+	// Only channels that at least one client subscribed to are read and converted
+	const uint32 Active = Priv->Channels & (bUseSharedMemory || !OutputFile.IsEmpty() ? TCPServer::SubscribeAll : Priv->Server.GetSubscribedChannels());
+
+	// The annotations are serialized on the game thread, which owns the object map and the scene graph.
+	// This has to happen before the conversion, because it may grow the packet.
+	Priv->Buffer->SetChannels(*Packet, Active);
+	Priv->Buffer->StartWriting(*Packet, ObjectToColor, ObjectColors, SceneGraph);
+	Current.TimeReadback = PrivateData::Clock::now();
+	Current.DurationSerialize = PrivateData::Microseconds(Current.TimeStart, Current.TimeReadback);
+
+	Current.Packet = Packet;
+	Current.Number = Priv->NextFrame++;
+	Current.Converted = false;
+	// One extra count keeps the frame from being published before all channels are submitted
+	Current.PendingChannels = FMath::CountBits(Active) + 1;
+	Current.InFlight = true;
+
+	// Render the subscribed channels for this frame only, the readback below is queued behind the rendering
+	if(bCaptureOnDemand)
+	{
+		if(Active & PacketBuffer::ChannelColor)
+		{
+			ColorImgCaptureComp->CaptureScene();
+		}
+		if(Active & PacketBuffer::ChannelObject)
+		{
+			ObjectMaskImgCaptureComp->CaptureScene();
+		}
+		if(Active & PacketBuffer::ChannelDepth)
+		{
+			DepthImgCaptureComp->CaptureScene();
+		}
+	}
+
+	if(bAsyncReadback)
+	{
+		// Only queue the copies, the render thread starts the conversion once the images arrived
+		if(Active & PacketBuffer::ChannelColor)
+		{
+			Priv->ReadbackColor.ReadAsync(Index, Current.ImageColor);
+		}
+		if(Active & PacketBuffer::ChannelObject)
+		{
+			Priv->ReadbackObject.ReadAsync(Index, Current.ImageObject);
+		}
+		if(Active & PacketBuffer::ChannelDepth)
+		{
+			Priv->ReadbackDepth.ReadAsync(Index, Current.ImageDepth);
+		}
+	}
+	else
+	{
+		// Read the images into the staging buffers of the frame and queue their conversion right away,
+		// the worker finishing the last tile of the frame publishes it
+		if(Active & PacketBuffer::ChannelColor)
+		{
+			ReadColorImage(Priv->ReadbackColor, Current.ImageColor);
+			Priv->Pool.Submit(Current.JobColor, Priv->NumTiles);
+		}
+		if(Active & PacketBuffer::ChannelObject)
+		{
+			ReadColorImage(Priv->ReadbackObject, Current.ImageObject);
+			Priv->Pool.Submit(Current.JobObject, Priv->NumTiles);
+		}
+		if(Active & PacketBuffer::ChannelDepth)
+		{
+			ReadImage(Priv->ReadbackDepth, Current.ImageDepth);
+			Priv->Pool.Submit(Current.JobDepth, Priv->NumTiles);
+		}
+		Current.TimeReadback = PrivateData::Clock::now();
+	}
+	FinishChannel(Index);
+	return true;
 }
 
 void ADefaultRGBDCamera::SetFramerate(const float _Framerate)
@@ -355,6 +691,11 @@ bool ADefaultRGBDCamera::IsPaused() const
 	return Paused;
 }
 
+uint64 ADefaultRGBDCamera::GetFramesPublished() const
+{
+	return Priv->FramesPublished;
+}
+
 void ADefaultRGBDCamera::ShowFlagsBasicSetting(FEngineShowFlags &ShowFlags) const
 {
 	ShowFlags = FEngineShowFlags(EShowFlagInitMode::ESFIM_All0);
@@ -410,65 +751,57 @@ void ADefaultRGBDCamera::ShowFlagsVertexColor(FEngineShowFlags &ShowFlags) const
 	GVertexColorViewMode = EVertexColorViewMode::Color;
 }
 
-void ADefaultRGBDCamera::ReadImage(UTextureRenderTarget2D *RenderTarget, TArray<FFloat16Color> &ImageData) const
+void ADefaultRGBDCamera::ReadImage(ImageReadback &Readback, TArray<uint8> &ImageData) const
 {
-	FTextureRenderTargetResource *RenderTargetResource = RenderTarget->GameThread_GetRenderTargetResource();
-	RenderTargetResource->ReadFloat16Pixels(ImageData);
+	// Reads the raw pixels straight into the preallocated array, ReadFloat16Pixels would reallocate it on every call
+	Readback.Read(ImageData);
 }
 
-void ADefaultRGBDCamera::ReadColorImage(UTextureRenderTarget2D *RenderTarget, TArray<FColor> &ImageData) const
+void ADefaultRGBDCamera::ReadColorImage(ImageReadback &Readback, TArray<FColor> &ImageData) const
 {
-
-	int32 RT_Width = RenderTarget->SizeX, RT_Height = RenderTarget->SizeY;
-	FTextureRenderTargetResource* RenderTargetResource;
-	ImageData.AddZeroed(RT_Width * RT_Height);
-	RenderTargetResource = RenderTarget->GameThread_GetRenderTargetResource();
-	FReadSurfaceDataFlags ReadSurfaceDataFlags;
-	ReadSurfaceDataFlags.SetLinearToGamma(false); // This is super important to disable this!
-	// Instead of using this flag, we will set the gamma to the correct value directly
-	RenderTargetResource->ReadPixels(ImageData, ReadSurfaceDataFlags);
+	// The render target is linear BGRA, so the bytes are copied without any gamma conversion.
+	// Gamma is applied while rendering through the TargetGamma of the render target.
+	Readback.Read(ImageData);
 }
 
-void ADefaultRGBDCamera::ToColorImage(const TArray<FFloat16Color> &ImageData, uint8 *Bytes) const
-{
-	const FFloat16Color *itI = ImageData.GetData();
-	uint8_t *itO = Bytes;
 
-	// Converts Float colors to bytes
-	for(size_t i = 0; i < ImageData.Num(); ++i, ++itI, ++itO)
-	{
-		*itO = (uint8_t)std::round((float)itI->B * 255.f);
-		*++itO = (uint8_t)std::round((float)itI->G * 255.f);
-		*++itO = (uint8_t)std::round((float)itI->R * 255.f);
-	}
+void ADefaultRGBDCamera::ToColorRGBImage(const TArray<FColor> &ImageData, uint8 *Bytes, const uint32 Begin, const uint32 Count) const
+{
+	// Drops the alpha channel, vectorized if the CPU supports it
+	ImageConversion::ColorToBGR(ImageData.GetData() + Begin, Bytes + Begin * 3, Count);
 	return;
 }
 
-
-void ADefaultRGBDCamera::ToColorRGBImage(const TArray<FColor> &ImageData, uint8 *Bytes) const
+void ADefaultRGBDCamera::ToDepthImage(const TArray<uint8> &ImageData, uint8 *Bytes, const uint32 Begin, const uint32 Count) const
 {
-	const FColor *itI = ImageData.GetData();
-	uint8_t *itO = Bytes;
-
-	// Converts Float colors to bytes
-	for(size_t i = 0; i < ImageData.Num(); ++i, ++itI, ++itO)
+	if(Priv->DepthTargetFormat == PF_FloatRGBA)
 	{
-		*itO = (uint8_t)itI->B;
-		*++itO = (uint8_t)itI->G;
-		*++itO = (uint8_t)itI->R;
+		// Extracts the depth from the red channel and encodes it in the same pass
+		const FFloat16Color *Pixels = reinterpret_cast<const FFloat16Color *>(ImageData.GetData()) + Begin;
+		switch(DepthFormat)
+		{
+		case EDepthFormat::Meters:
+			ImageConversion::DepthToFloat32(Pixels, reinterpret_cast<float *>(Bytes) + Begin, Count);
+			break;
+		case EDepthFormat::Millimeters:
+			ImageConversion::DepthToMillimeters(Pixels, reinterpret_cast<uint16 *>(Bytes) + Begin, Count);
+			break;
+		default:
+			ImageConversion::DepthToFloat16(Pixels, reinterpret_cast<uint16 *>(Bytes) + Begin, Count);
+			break;
+		}
+		return;
 	}
-	return;
-}
-
-void ADefaultRGBDCamera::ToDepthImage(const TArray<FFloat16Color> &ImageData, uint8 *Bytes) const
-{
-	const FFloat16Color *itI = ImageData.GetData();
-	uint16_t *itO = reinterpret_cast<uint16_t *>(Bytes);
 
-	// Just copies the encoded Float16 values
-	for(size_t i = 0; i < ImageData.Num(); ++i, ++itI, ++itO)
+	// Single channel targets already have the layout of the packet, except for millimeters
+	const uint32 BytesPerPixel = Priv->ReadbackDepth.GetBytesPerPixel();
+	if(DepthFormat == EDepthFormat::Millimeters)
 	{
-		*itO = itI->R.Encoded;
+		ImageConversion::MetersToMillimeters(reinterpret_cast<const float *>(ImageData.GetData()) + Begin, reinterpret_cast<uint16 *>(Bytes) + Begin, Count);
+	}
+	else
+	{
+		FMemory::Memcpy(Bytes + Begin * BytesPerPixel, ImageData.GetData() + Begin * BytesPerPixel, Count * BytesPerPixel);
 	}
 	return;
 }
@@ -658,53 +991,38 @@ void ADefaultRGBDCamera::RemoveNonExistingActorsFromColorMap()
 	}
 }
 
-void ADefaultRGBDCamera::ProcessColor()
+void ADefaultRGBDCamera::FinishChannel(const uint32 Index)
 {
-	while(true)
+	PrivateData::Frame &Finished = *Priv->Frames[Index];
+	if(--Finished.PendingChannels != 0)
 	{
-		std::unique_lock<std::mutex> WaitLock(Priv->WaitColor);
-		Priv->CVColor.wait(WaitLock, [this] {return Priv->DoColor; });
-		Priv->DoColor = false;
-		if(!this->Running) break;
-		ToColorRGBImage(ImageColor, Priv->Buffer->Color);
-
-		Priv->DoneColor = true;
-		Priv->CVDone.notify_one();
+		return;
 	}
-}
+	Finished.TimeConverted = PrivateData::Clock::now();
 
-void ADefaultRGBDCamera::ProcessDepth()
-{
+	// Frames are handed over to the server in capture order, so a frame finishing early waits for the ones before it
+	std::lock_guard<std::mutex> Lock(Priv->LockPublish);
+	Finished.Converted = true;
 	while(true)
 	{
-		std::unique_lock<std::mutex> WaitLock(Priv->WaitDepth);
-		Priv->CVDepth.wait(WaitLock, [this] {return Priv->DoDepth; });
-		Priv->DoDepth = false;
-		if(!this->Running) break;
-		ToDepthImage(ImageDepth, Priv->Buffer->Depth);
-
-		// Wait for both other processing threads to be done.
-		std::unique_lock<std::mutex> WaitDoneLock(Priv->WaitDone);
-		Priv->CVDone.wait(WaitDoneLock, [this] {return Priv->DoneColor && Priv->DoneObject; });
-
-		Priv->DoneColor = false;
-		Priv->DoneObject = false;
+		PrivateData::Frame &Next = *Priv->Frames[Priv->NextPublish % Priv->Frames.size()];
+		if(!Next.InFlight || !Next.Converted || Next.Number != Priv->NextPublish)
+		{
+			break;
+		}
 
-		// Complete Buffer
-		Priv->Buffer->DoneWriting();
+		Priv->Buffer->CommitWrite(Next.Packet);
+		const PrivateData::Clock::time_point Now = PrivateData::Clock::now();
+		Priv->TimeReadback += PrivateData::Microseconds(Next.TimeStart, Next.TimeReadback) - Next.DurationSerialize;
+		Priv->TimeSerialize += Next.DurationSerialize;
+		Priv->TimeConvert += PrivateData::Microseconds(Next.TimeReadback, Next.TimeConverted);
+		Priv->TimePublish += PrivateData::Microseconds(Next.TimeConverted, Now);
+		++Priv->FramesPublished;
+
+		Next.Packet = nullptr;
+		Next.Converted = false;
+		++Priv->NextPublish;
+		// The game thread may reuse the frame from now on
+		Next.InFlight = false;
 	}
 }
-
-void ADefaultRGBDCamera::ProcessObject()
-{
-	while(true)
-	{
-		std::unique_lock<std::mutex> WaitLock(Priv->WaitObject);
-		Priv->CVObject.wait(WaitLock, [this] {return Priv->DoObject; });
-		Priv->DoObject = false;
-		if(!this->Running) break;
-		ToColorImage(ImageObject, Priv->Buffer->Object);	
-		Priv->DoneObject = true;
-		Priv->CVDone.notify_one();
-	}
-}
\ No newline at end of file
@@ -0,0 +1,103 @@
+// Copyright 2017, Institute for Artificial Intelligence - University of Bremen
+
+#include "FileSink.h"
+#include "StopTime.h"
+#include "HAL/PlatformFilemanager.h"
+#include "GenericPlatform/GenericPlatformFile.h"
+
+FileSink::FileSink() : File(nullptr), Running(false), PacketsWritten(0), PacketsFailed(0), BytesWritten(0)
+{
+}
+
+FileSink::~FileSink()
+{
+  Stop();
+}
+
+void FileSink::Start(const FString &Path)
+{
+  OUT_INFO(TEXT("Starting file sink."));
+
+  // Check if buffer is set
+  if(!Buffer.IsValid())
+  {
+    OUT_ERROR(TEXT("No package buffer set."));
+    return;
+  }
+
+  IPlatformFile &PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+  PlatformFile.CreateDirectoryTree(*FPaths::GetPath(Path));
+  File = PlatformFile.OpenWrite(*Path);
+  if(!File)
+  {
+    OUT_ERROR(TEXT("Could not open %s for writing."), *Path);
+    return;
+  }
+  OUT_INFO(TEXT("Writing packets to %s"), *Path);
+
+  Running = true;
+  Thread = std::thread(&FileSink::ServerLoop, this);
+}
+
+void FileSink::Stop()
+{
+  if(Running)
+  {
+    // Write the queued packets, then release buffer and wait for thread to stop
+    Buffer->WaitUntilRead();
+    Running = false;
+    Buffer->Release();
+    Thread.join();
+  }
+
+  if(File)
+  {
+    File->Flush();
+    delete File;
+    File = nullptr;
+    OUT_INFO(TEXT("File sink stopped. Packets written: %llu (%llu bytes), failed: %llu"), PacketsWritten, BytesWritten, PacketsFailed);
+  }
+}
+
+void FileSink::ServerLoop()
+{
+  while(Running)
+  {
+    PacketBuffer::Packet *Packet = Buffer->AcquireRead();
+    if(!Packet)
+    {
+      break;
+    }
+
+    Write(*Packet);
+
+    // Give the packet back to the ring
+    Buffer->ReleaseRead(Packet);
+  }
+}
+
+void FileSink::Write(const PacketBuffer::Packet &Packet)
+{
+  MEASURE_TIME("Writing to file");
+
+  // The packet is shared with the ring, so the timestamp is set in a copy of the header
+  PacketBuffer::PacketHeader Header = *Packet.Header;
+  FDateTime Now = FDateTime::UtcNow();
+  Header.TimestampSent = Now.ToUnixTimestamp() * 1000000000 + Now.GetMillisecond() * 1000000;
+
+  const uint32 Size = Packet.Header->Size;
+  if(!File->Write(reinterpret_cast<const uint8 *>(&Header), sizeof(Header))
+    || !File->Write(Packet.Data.data() + sizeof(Header), Size - sizeof(Header)))
+  {
+    OUT_WARN(TEXT("Could not write packet of %u bytes."), Size);
+    ++PacketsFailed;
+    return;
+  }
+  ++PacketsWritten;
+  BytesWritten += Size;
+}
+
+bool FileSink::HasClient() const
+{
+  return File != nullptr;
+}
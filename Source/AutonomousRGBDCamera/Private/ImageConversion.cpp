@@ -0,0 +1,439 @@
+// Copyright 2017, Institute for Artificial Intelligence - University of Bremen
+
+#include "ImageConversion.h"
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define IMAGE_CONVERSION_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+// MSVC allows all intrinsics without enabling them for the whole module
+#define KERNEL_TARGET(Features)
+#else
+#include <cpuid.h>
+// Kernels are compiled for their instruction set only, the rest of the module stays compatible with every CPU
+#define KERNEL_TARGET(Features) __attribute__((target(Features)))
+#endif
+#else
+#define IMAGE_CONVERSION_X86 0
+#endif
+
+namespace
+{
+  struct Kernels
+  {
+    ImageConversion::ColorToBGRKernel ColorToBGR;
+    ImageConversion::DepthToUInt16Kernel DepthToFloat16;
+    ImageConversion::DepthToFloat32Kernel DepthToFloat32;
+    ImageConversion::DepthToUInt16Kernel DepthToMillimeters;
+    ImageConversion::MetersToMillimetersKernel MetersToMillimeters;
+    FString Names;
+  };
+
+  // Converts like FFloat16, which maps infinity and NaN to +-65504, but computes denormals exactly as well,
+  // so that the result matches the hardware conversion bit for bit
+  inline float HalfToFloat(const uint16 Half)
+  {
+    const uint32 Exponent = (Half >> 10) & 0x1F;
+    const uint32 Mantissa = Half & 0x3FF;
+    float Value;
+    if(Exponent == 0x1F)
+    {
+      Value = 65504.0f;
+    }
+    else if(Exponent == 0)
+    {
+      // Denormals are multiples of 2^-24, which is exact in single precision
+      Value = Mantissa * (1.0f / 16777216.0f);
+    }
+    else
+    {
+      const uint32 Bits = ((Exponent + 112) << 23) | (Mantissa << 13);
+      FMemory::Memcpy(&Value, &Bits, sizeof(Value));
+    }
+    return (Half & 0x8000) ? -Value : Value;
+  }
+
+#if IMAGE_CONVERSION_X86
+  struct CpuFeatures
+  {
+    bool SSSE3, AVX2, F16C;
+  };
+
+  void CpuId(const uint32 Leaf, const uint32 SubLeaf, uint32 Registers[4])
+  {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int Info[4];
+    __cpuidex(Info, Leaf, SubLeaf);
+    for(int32 Index = 0; Index < 4; ++Index)
+    {
+      Registers[Index] = Info[Index];
+    }
+#else
+    __cpuid_count(Leaf, SubLeaf, Registers[0], Registers[1], Registers[2], Registers[3]);
+#endif
+  }
+
+  // Returns the register states the OS saves on context switches
+  uint64 GetEnabledStates()
+  {
+#if defined(_MSC_VER) && !defined(__clang__)
+    return _xgetbv(0);
+#else
+    uint32 Low, High;
+    __asm__ volatile("xgetbv" : "=a"(Low), "=d"(High) : "c"(0));
+    return ((uint64)High << 32) | Low;
+#endif
+  }
+
+  CpuFeatures DetectCpu()
+  {
+    CpuFeatures Features = {};
+    uint32 Registers[4];
+    CpuId(0, 0, Registers);
+    const uint32 MaxLeaf = Registers[0];
+    if(MaxLeaf < 1)
+    {
+      return Features;
+    }
+
+    CpuId(1, 0, Registers);
+    Features.SSSE3 = (Registers[2] & (1 << 9)) != 0;
+
+    // AVX needs the support of the OS for the YMM registers
+    const bool OSXSave = (Registers[2] & (1 << 27)) != 0;
+    const uint64 States = OSXSave ? GetEnabledStates() : 0;
+    const bool AVX = (Registers[2] & (1 << 28)) != 0 && (States & 0x6) == 0x6;
+    Features.F16C = AVX && (Registers[2] & (1 << 29)) != 0;
+    if(AVX && MaxLeaf >= 7)
+    {
+      CpuId(7, 0, Registers);
+      Features.AVX2 = (Registers[1] & (1 << 5)) != 0;
+    }
+    return Features;
+  }
+
+  // Packs 16 BGRA pixels at a time, the alpha bytes are squeezed out with pshufb
+  KERNEL_TARGET("ssse3")
+  void ColorToBGRSSSE3(const FColor *Source, uint8 *Target, const uint32 Count)
+  {
+    const __m128i Mask = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    const uint8 *In = reinterpret_cast<const uint8 *>(Source);
+    uint32 Index = 0;
+    for(; Index + 16 <= Count; Index += 16, In += 64, Target += 48)
+    {
+      const __m128i A = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(In)), Mask);
+      const __m128i B = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(In + 16)), Mask);
+      const __m128i C = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(In + 32)), Mask);
+      const __m128i D = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(In + 48)), Mask);
+
+      // Each vector holds 12 bytes, shift them together into three full vectors
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(Target), _mm_or_si128(A, _mm_slli_si128(B, 12)));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(Target + 16), _mm_or_si128(_mm_srli_si128(B, 4), _mm_slli_si128(C, 8)));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(Target + 32), _mm_or_si128(_mm_srli_si128(C, 8), _mm_slli_si128(D, 4)));
+    }
+    ImageConversion::ColorToBGRScalar(Source + Index, Target, Count - Index);
+  }
+
+  // Packs 8 BGRA pixels at a time, pshufb works per lane so the lanes are joined with a permute
+  KERNEL_TARGET("avx2")
+  void ColorToBGRAVX2(const FColor *Source, uint8 *Target, const uint32 Count)
+  {
+    const __m256i Mask = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+      0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    const __m256i Join = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+    const uint8 *In = reinterpret_cast<const uint8 *>(Source);
+    uint32 Index = 0;
+    for(; Index + 8 <= Count; Index += 8, In += 32, Target += 24)
+    {
+      const __m256i Pixels = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(In));
+      const __m256i Packed = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(Pixels, Mask), Join);
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(Target), _mm256_castsi256_si128(Packed));
+      _mm_storel_epi64(reinterpret_cast<__m128i *>(Target + 16), _mm256_extracti128_si256(Packed, 1));
+    }
+    ImageConversion::ColorToBGRScalar(Source + Index, Target, Count - Index);
+  }
+
+  /**
+   * Half float conversion. The scalar code converts with HalfToFloat, which maps infinity and NaN to +-65504,
+   * and rounds half away from zero. The vectorized kernels reproduce each of these steps, so that the output
+   * is identical for every input.
+   */
+  KERNEL_TARGET("avx2,f16c")
+  inline __m256 HalfToFloatAVX2(const __m128i Halves)
+  {
+    const __m256 SignMask = _mm256_set1_ps(-0.0f);
+    const __m256 Floats = _mm256_cvtph_ps(Halves);
+    const __m256 Abs = _mm256_min_ps(_mm256_andnot_ps(SignMask, Floats), _mm256_set1_ps(65504.0f));
+    return _mm256_or_ps(Abs, _mm256_and_ps(Floats, SignMask));
+  }
+
+  // std::round: truncate and step away from zero if the remainder is at least one half
+  KERNEL_TARGET("avx2")
+  inline __m256 RoundAVX2(const __m256 Value)
+  {
+    const __m256 SignMask = _mm256_set1_ps(-0.0f);
+    const __m256 Truncated = _mm256_round_ps(Value, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+    const __m256 Remainder = _mm256_andnot_ps(SignMask, _mm256_sub_ps(Value, Truncated));
+    const __m256 Step = _mm256_or_ps(_mm256_and_ps(Value, SignMask), _mm256_set1_ps(1.0f));
+    return _mm256_add_ps(Truncated, _mm256_and_ps(_mm256_cmp_ps(Remainder, _mm256_set1_ps(0.5f), _CMP_GE_OQ), Step));
+  }
+
+  // Gathers the red halves of 8 pixels. Each pshufb moves the two of one load into the first dword, the unpacks join them.
+  KERNEL_TARGET("ssse3")
+  inline __m128i ExtractDepthSSSE3(const __m128i *In)
+  {
+    const __m128i Mask = _mm_setr_epi8(0, 1, 8, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m128i A = _mm_shuffle_epi8(_mm_loadu_si128(In), Mask);
+    const __m128i B = _mm_shuffle_epi8(_mm_loadu_si128(In + 1), Mask);
+    const __m128i C = _mm_shuffle_epi8(_mm_loadu_si128(In + 2), Mask);
+    const __m128i D = _mm_shuffle_epi8(_mm_loadu_si128(In + 3), Mask);
+    return _mm_unpacklo_epi64(_mm_unpacklo_epi32(A, B), _mm_unpacklo_epi32(C, D));
+  }
+
+  KERNEL_TARGET("ssse3")
+  void DepthToFloat16SSSE3(const FFloat16Color *Source, uint16 *Target, const uint32 Count)
+  {
+    const __m128i *In = reinterpret_cast<const __m128i *>(Source);
+    uint32 Index = 0;
+    for(; Index + 8 <= Count; Index += 8, In += 4, Target += 8)
+    {
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(Target), ExtractDepthSSSE3(In));
+    }
+    ImageConversion::DepthToFloat16Scalar(Source + Index, Target, Count - Index);
+  }
+
+  // Gathers the red halves of 16 pixels like the SSSE3 variant, but each lane of a load holds 2 pixels,
+  // so the lanes are joined with a permute in the end
+  KERNEL_TARGET("avx2")
+  inline __m256i ExtractDepthAVX2(const __m256i *In)
+  {
+    const __m256i Mask = _mm256_setr_epi8(0, 1, 8, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+      0, 1, 8, 9, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m256i A = _mm256_shuffle_epi8(_mm256_loadu_si256(In), Mask);
+    const __m256i B = _mm256_shuffle_epi8(_mm256_loadu_si256(In + 1), Mask);
+    const __m256i C = _mm256_shuffle_epi8(_mm256_loadu_si256(In + 2), Mask);
+    const __m256i D = _mm256_shuffle_epi8(_mm256_loadu_si256(In + 3), Mask);
+    const __m256i Joined = _mm256_unpacklo_epi64(_mm256_unpacklo_epi32(A, B), _mm256_unpacklo_epi32(C, D));
+    return _mm256_permutevar8x32_epi32(Joined, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+  }
+
+  KERNEL_TARGET("avx2")
+  void DepthToFloat16AVX2(const FFloat16Color *Source, uint16 *Target, const uint32 Count)
+  {
+    const __m256i *In = reinterpret_cast<const __m256i *>(Source);
+    uint32 Index = 0;
+    for(; Index + 16 <= Count; Index += 16, In += 4, Target += 16)
+    {
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(Target), ExtractDepthAVX2(In));
+    }
+    ImageConversion::DepthToFloat16Scalar(Source + Index, Target, Count - Index);
+  }
+
+  KERNEL_TARGET("avx2,f16c")
+  void DepthToFloat32AVX2(const FFloat16Color *Source, float *Target, const uint32 Count)
+  {
+    const __m256i *In = reinterpret_cast<const __m256i *>(Source);
+    uint32 Index = 0;
+    for(; Index + 16 <= Count; Index += 16, In += 4, Target += 16)
+    {
+      const __m256i Halves = ExtractDepthAVX2(In);
+      _mm256_storeu_ps(Target, HalfToFloatAVX2(_mm256_castsi256_si128(Halves)));
+      _mm256_storeu_ps(Target + 8, HalfToFloatAVX2(_mm256_extracti128_si256(Halves, 1)));
+    }
+    ImageConversion::DepthToFloat32Scalar(Source + Index, Target, Count - Index);
+  }
+
+  KERNEL_TARGET("avx2")
+  inline __m256i ScaleToMillimetersAVX2(const __m256 Meters)
+  {
+    const __m256 Value = RoundAVX2(_mm256_mul_ps(Meters, _mm256_set1_ps(1000.0f)));
+    return _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(Value, _mm256_setzero_ps()), _mm256_set1_ps(65535.0f)));
+  }
+
+  KERNEL_TARGET("avx2,f16c")
+  inline __m256i ToMillimetersAVX2(const __m128i Halves)
+  {
+    return ScaleToMillimetersAVX2(HalfToFloatAVX2(Halves));
+  }
+
+  KERNEL_TARGET("avx2,f16c")
+  void DepthToMillimetersAVX2(const FFloat16Color *Source, uint16 *Target, const uint32 Count)
+  {
+    const __m256i *In = reinterpret_cast<const __m256i *>(Source);
+    uint32 Index = 0;
+    for(; Index + 16 <= Count; Index += 16, In += 4, Target += 16)
+    {
+      const __m256i Halves = ExtractDepthAVX2(In);
+      const __m256i Low = ToMillimetersAVX2(_mm256_castsi256_si128(Halves));
+      const __m256i High = ToMillimetersAVX2(_mm256_extracti128_si256(Halves, 1));
+      // The values are already clamped, the pack only narrows them but interleaves the lanes
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(Target), _mm256_permute4x64_epi64(_mm256_packus_epi32(Low, High), 0xD8));
+    }
+    ImageConversion::DepthToMillimetersScalar(Source + Index, Target, Count - Index);
+  }
+
+  KERNEL_TARGET("avx2")
+  void MetersToMillimetersAVX2(const float *Source, uint16 *Target, const uint32 Count)
+  {
+    uint32 Index = 0;
+    for(; Index + 16 <= Count; Index += 16, Source += 16, Target += 16)
+    {
+      const __m256i Low = ScaleToMillimetersAVX2(_mm256_loadu_ps(Source));
+      const __m256i High = ScaleToMillimetersAVX2(_mm256_loadu_ps(Source + 8));
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(Target), _mm256_permute4x64_epi64(_mm256_packus_epi32(Low, High), 0xD8));
+    }
+    ImageConversion::MetersToMillimetersScalar(Source, Target, Count - Index);
+  }
+#endif
+
+  Kernels SelectKernels()
+  {
+    Kernels Selected = {&ImageConversion::ColorToBGRScalar, &ImageConversion::DepthToFloat16Scalar,
+      &ImageConversion::DepthToFloat32Scalar, &ImageConversion::DepthToMillimetersScalar, &ImageConversion::MetersToMillimetersScalar};
+    const TCHAR *Color = TEXT("scalar");
+    const TCHAR *Depth = TEXT("scalar");
+#if IMAGE_CONVERSION_X86
+    const CpuFeatures Features = DetectCpu();
+    if(Features.AVX2)
+    {
+      Selected.ColorToBGR = &ColorToBGRAVX2;
+      Color = TEXT("AVX2");
+    }
+    else if(Features.SSSE3)
+    {
+      Selected.ColorToBGR = &ColorToBGRSSSE3;
+      Color = TEXT("SSSE3");
+    }
+
+    if(Features.AVX2 && Features.F16C)
+    {
+      Selected.DepthToFloat16 = &DepthToFloat16AVX2;
+      Selected.DepthToFloat32 = &DepthToFloat32AVX2;
+      Selected.DepthToMillimeters = &DepthToMillimetersAVX2;
+      Depth = TEXT("AVX2+F16C");
+    }
+    else if(Features.AVX2)
+    {
+      Selected.DepthToFloat16 = &DepthToFloat16AVX2;
+      Depth = TEXT("AVX2");
+    }
+    if(Features.AVX2)
+    {
+      Selected.MetersToMillimeters = &MetersToMillimetersAVX2;
+    }
+    else if(Features.SSSE3)
+    {
+      Selected.DepthToFloat16 = &DepthToFloat16SSSE3;
+      Depth = TEXT("SSSE3");
+    }
+#endif
+    Selected.Names = FString::Printf(TEXT("color: %s, depth: %s"), Color, Depth);
+    return Selected;
+  }
+
+  const Kernels &GetKernels()
+  {
+    static const Kernels Selected = SelectKernels();
+    return Selected;
+  }
+}
+
+void ImageConversion::ColorToBGR(const FColor *Source, uint8 *Target, const uint32 Count)
+{
+  GetKernels().ColorToBGR(Source, Target, Count);
+}
+
+void ImageConversion::ColorToBGRScalar(const FColor *Source, uint8 *Target, const uint32 Count)
+{
+  for(uint32 Index = 0; Index < Count; ++Index, ++Source)
+  {
+    *Target++ = Source->B;
+    *Target++ = Source->G;
+    *Target++ = Source->R;
+  }
+}
+
+void ImageConversion::DepthToFloat16(const FFloat16Color *Source, uint16 *Target, const uint32 Count)
+{
+  GetKernels().DepthToFloat16(Source, Target, Count);
+}
+
+void ImageConversion::DepthToFloat16Scalar(const FFloat16Color *Source, uint16 *Target, const uint32 Count)
+{
+  // Just copies the encoded Float16 values
+  for(uint32 Index = 0; Index < Count; ++Index, ++Source)
+  {
+    *Target++ = Source->R.Encoded;
+  }
+}
+
+void ImageConversion::DepthToFloat32(const FFloat16Color *Source, float *Target, const uint32 Count)
+{
+  GetKernels().DepthToFloat32(Source, Target, Count);
+}
+
+void ImageConversion::DepthToFloat32Scalar(const FFloat16Color *Source, float *Target, const uint32 Count)
+{
+  for(uint32 Index = 0; Index < Count; ++Index, ++Source)
+  {
+    *Target++ = HalfToFloat(Source->R.Encoded);
+  }
+}
+
+void ImageConversion::DepthToMillimeters(const FFloat16Color *Source, uint16 *Target, const uint32 Count)
+{
+  GetKernels().DepthToMillimeters(Source, Target, Count);
+}
+
+void ImageConversion::DepthToMillimetersScalar(const FFloat16Color *Source, uint16 *Target, const uint32 Count)
+{
+  for(uint32 Index = 0; Index < Count; ++Index, ++Source)
+  {
+    const float Value = std::round(HalfToFloat(Source->R.Encoded) * 1000.f);
+    *Target++ = Value <= 0.f ? 0 : Value >= 65535.f ? 65535 : (uint16)Value;
+  }
+}
+
+void ImageConversion::MetersToMillimeters(const float *Source, uint16 *Target, const uint32 Count)
+{
+  GetKernels().MetersToMillimeters(Source, Target, Count);
+}
+
+void ImageConversion::MetersToMillimetersScalar(const float *Source, uint16 *Target, const uint32 Count)
+{
+  for(uint32 Index = 0; Index < Count; ++Index, ++Source)
+  {
+    // NaN fails every comparison, it becomes 0 like in the vectorized kernels
+    const float Value = std::round(*Source * 1000.f);
+    *Target++ = !(Value > 0.f) ? 0 : Value >= 65535.f ? 65535 : (uint16)Value;
+  }
+}
+
+const TCHAR *ImageConversion::GetKernelNames()
+{
+  return *GetKernels().Names;
+}
+
+TArray<ImageConversion::KernelSet> ImageConversion::GetSupportedKernels()
+{
+  TArray<KernelSet> Sets;
+  Sets.Add({TEXT("scalar"), &ColorToBGRScalar, &DepthToFloat16Scalar, &DepthToFloat32Scalar, &DepthToMillimetersScalar, &MetersToMillimetersScalar});
+#if IMAGE_CONVERSION_X86
+  const CpuFeatures Features = DetectCpu();
+  if(Features.SSSE3)
+  {
+    Sets.Add({TEXT("SSSE3"), &ColorToBGRSSSE3, &DepthToFloat16SSSE3, nullptr, nullptr, nullptr});
+  }
+  if(Features.AVX2)
+  {
+    Sets.Add({TEXT("AVX2"), &ColorToBGRAVX2, &DepthToFloat16AVX2, nullptr, nullptr, &MetersToMillimetersAVX2});
+  }
+  if(Features.AVX2 && Features.F16C)
+  {
+    Sets.Add({TEXT("AVX2+F16C"), nullptr, nullptr, &DepthToFloat32AVX2, &DepthToMillimetersAVX2, nullptr});
+  }
+#endif
+  return Sets;
+}
@@ -0,0 +1,241 @@
+// Copyright 2017, Institute for Artificial Intelligence - University of Bremen
+
+#include "ImageReadback.h"
+#include "StopTime.h"
+#include "RHICommandList.h"
+#include "RenderingThread.h"
+#include "TextureResource.h"
+
+ImageReadback::ImageReadback() : RenderTarget(nullptr), FirstRequest(0), NumRequests(0), Format(PF_Unknown), Width(0), Height(0), BytesPerPixel(0),
+  Latency(0), NumReads(0)
+{
+}
+
+ImageReadback::~ImageReadback()
+{
+  Release();
+}
+
+void ImageReadback::Init(UTextureRenderTarget2D *_RenderTarget, const uint32 NumSlots, const uint32 _Latency)
+{
+  Release();
+
+  RenderTarget = _RenderTarget;
+  Format = RenderTarget->GetFormat();
+  Width = RenderTarget->SizeX;
+  Height = RenderTarget->SizeY;
+  BytesPerPixel = GPixelFormats[Format].BlockBytes;
+  Latency = _Latency;
+
+  // The textures are created on the render thread when they are used first
+  Staging.resize(FMath::Max<uint32>(NumSlots, 1));
+  Fences.resize(Staging.size());
+  Requests.resize(Staging.size());
+  FirstRequest = 0;
+  NumRequests = 0;
+}
+
+void ImageReadback::Release()
+{
+  if(Staging.empty())
+  {
+    return;
+  }
+
+  // The textures are only used on the render thread, so they are released there as well
+  ENQUEUE_RENDER_COMMAND(ImageReadbackRelease)(
+    [this](FRHICommandListImmediate &RHICmdList)
+    {
+      CompleteRequests(RHICmdList, true);
+      Staging.clear();
+      Fences.clear();
+    });
+  FlushRenderingCommands();
+}
+
+uint32 ImageReadback::GetBytesPerPixel() const
+{
+  return BytesPerPixel;
+}
+
+uint32 ImageReadback::GetSize() const
+{
+  return Width * Height * BytesPerPixel;
+}
+
+bool ImageReadback::CheckSize(const uint32 Size) const
+{
+  if(!RenderTarget || Size != GetSize())
+  {
+    OUT_ERROR(TEXT("Buffer of %u bytes does not match the render target (%u x %u, %u bytes per pixel)."), Size, Width, Height, BytesPerPixel);
+    return false;
+  }
+  return true;
+}
+
+bool ImageReadback::Read(void *Target, const uint32 Size)
+{
+  if(!CheckSize(Size))
+  {
+    return false;
+  }
+
+  FTextureRenderTargetResource *Resource = RenderTarget->GameThread_GetRenderTargetResource();
+  uint8 *Bytes = static_cast<uint8 *>(Target);
+  ENQUEUE_RENDER_COMMAND(ImageReadbackCopy)(
+    [this, Resource, Bytes](FRHICommandListImmediate &RHICmdList)
+    {
+      CopyToStaging(RHICmdList, Resource, 0);
+      CopyToTarget(RHICmdList, 0, Bytes);
+    });
+  FlushRenderingCommands();
+  return true;
+}
+
+bool ImageReadback::ReadAsync(const uint32 Slot, void *Target, const uint32 Size)
+{
+  if(!CheckSize(Size) || Slot >= Staging.size())
+  {
+    return false;
+  }
+
+  FTextureRenderTargetResource *Resource = RenderTarget->GameThread_GetRenderTargetResource();
+  uint8 *Bytes = static_cast<uint8 *>(Target);
+  ENQUEUE_RENDER_COMMAND(ImageReadbackQueue)(
+    [this, Resource, Slot, Bytes](FRHICommandListImmediate &RHICmdList)
+    {
+      // A slot can only be queued once, so the ring never overflows unless a slot is reused too early
+      if(NumRequests == Requests.size())
+      {
+        CompleteRequests(RHICmdList, true);
+      }
+      CopyToStaging(RHICmdList, Resource, Slot);
+      Requests[(FirstRequest + NumRequests) % Requests.size()] = {Bytes, Slot, 0};
+      ++NumRequests;
+    });
+  return true;
+}
+
+void ImageReadback::Poll()
+{
+  ENQUEUE_RENDER_COMMAND(ImageReadbackPoll)(
+    [this](FRHICommandListImmediate &RHICmdList)
+    {
+      CompleteRequests(RHICmdList, false);
+    });
+}
+
+void ImageReadback::Flush()
+{
+  ENQUEUE_RENDER_COMMAND(ImageReadbackFlush)(
+    [this](FRHICommandListImmediate &RHICmdList)
+    {
+      CompleteRequests(RHICmdList, true);
+    });
+  FlushRenderingCommands();
+}
+
+void ImageReadback::CompleteRequests(FRHICommandListImmediate &RHICmdList, const bool Force)
+{
+  // Requests are completed in order, so a slow copy also holds back the ones queued after it
+  while(NumRequests > 0)
+  {
+    Request &Next = Requests[FirstRequest];
+    ++Next.Age;
+    const bool Ready = GUsingNullRHI || !Fences[Next.Slot].IsValid() || Fences[Next.Slot]->Poll();
+    if(!Ready && !Force && Next.Age <= Latency)
+    {
+      break;
+    }
+
+    CopyToTarget(RHICmdList, Next.Slot, Next.Target);
+    FirstRequest = (FirstRequest + 1) % Requests.size();
+    --NumRequests;
+    if(OnReady)
+    {
+      OnReady(Next.Slot);
+    }
+  }
+}
+
+void ImageReadback::CopyToStaging(FRHICommandListImmediate &RHICmdList, FTextureRenderTargetResource *Resource, const uint32 Slot)
+{
+  if(GUsingNullRHI)
+  {
+    return;
+  }
+
+  if(!Staging[Slot].IsValid())
+  {
+    FRHIResourceCreateInfo CreateInfo;
+    Staging[Slot] = RHICreateTexture2D(Width, Height, Format, 1, 1, TexCreate_CPUReadback, CreateInfo);
+    Fences[Slot] = RHICreateGPUFence(TEXT("ImageReadback"));
+  }
+  Fences[Slot]->Clear();
+  RHICmdList.CopyToResolveTarget(Resource->GetRenderTargetTexture(), Staging[Slot], FResolveParams());
+  RHICmdList.WriteGPUFence(Fences[Slot]);
+}
+
+void ImageReadback::CopyToTarget(FRHICommandListImmediate &RHICmdList, const uint32 Slot, uint8 *Target)
+{
+  ++NumReads;
+  if(GUsingNullRHI || !Staging[Slot].IsValid())
+  {
+    FillTestPattern(Target);
+    return;
+  }
+
+  // Rows of the staging texture can be padded, Pitch is the row length in pixels
+  void *Data = nullptr;
+  int32 Pitch = 0, Rows = 0;
+  RHICmdList.MapStagingSurface(Staging[Slot], Data, Pitch, Rows);
+  if(!Data)
+  {
+    return;
+  }
+
+  const uint32 RowSize = Width * BytesPerPixel;
+  if((uint32)Pitch == Width)
+  {
+    FMemory::Memcpy(Target, Data, RowSize * Height);
+  }
+  else
+  {
+    const uint8 *Source = static_cast<const uint8 *>(Data);
+    for(uint32 Row = 0; Row < Height; ++Row)
+    {
+      FMemory::Memcpy(Target + Row * RowSize, Source + Row * Pitch * BytesPerPixel, RowSize);
+    }
+  }
+  RHICmdList.UnmapStagingSurface(Staging[Slot]);
+}
+
+void ImageReadback::FillTestPattern(uint8 *Target)
+{
+  // Horizontal and vertical gradients and a value counting the images, so that clients can check order and latency
+  for(uint32 Row = 0; Row < Height; ++Row)
+  {
+    for(uint32 Column = 0; Column < Width; ++Column)
+    {
+      const uint32 Index = Row * Width + Column;
+      switch(Format)
+      {
+      case PF_B8G8R8A8:
+        reinterpret_cast<FColor *>(Target)[Index] = FColor(Column & 0xFF, Row & 0xFF, NumReads & 0xFF, 255);
+        break;
+      case PF_FloatRGBA:
+        reinterpret_cast<FFloat16Color *>(Target)[Index] = FFloat16Color(FLinearColor(Column / (float)Width, Row / (float)Height, (NumReads & 0xFF) / 255.0f, 1.0f));
+        break;
+      case PF_R16F:
+        reinterpret_cast<FFloat16 *>(Target)[Index] = FFloat16(1.0f + Column / (float)Width + NumReads % 10);
+        break;
+      case PF_R32_FLOAT:
+        reinterpret_cast<float *>(Target)[Index] = 1.0f + Column / (float)Width + NumReads % 10;
+        break;
+      default:
+        FMemory::Memzero(Target + Index * BytesPerPixel, BytesPerPixel);
+        break;
+      }
+    }
+  }
+}
@@ -1,230 +1,411 @@
 // Copyright 2017, Institute for Artificial Intelligence - University of Bremen
 
 #include "PacketBuffer.h"
+#include "StopTime.h"
+#include <algorithm>
+#include <chrono>
 
 
-PacketBuffer::PacketBuffer(const uint32 Width, const uint32 Height, const float FieldOfView) :
-  IsDataReadable(false), SizeHeader(sizeof(PacketHeader)), SizeRGB(Width *Height * 3 * sizeof(uint8)), SizeFloat(Width *Height *sizeof(FFloat16)), SizeSceneGraph(sizeof(SceneGraph)),
-  OffsetColor(SizeHeader), OffsetDepth(OffsetColor + SizeRGB), OffsetObject(OffsetDepth + SizeFloat), OffsetMap(OffsetObject + SizeRGB), OffsetSceneGraph(OffsetMap + sizeof(MapEntry)),
-  Size(SizeHeader + SizeRGB + SizeFloat + SizeRGB)
+PacketBuffer::PacketBuffer(const uint32 Width, const uint32 Height, const float FieldOfView, const uint32 NumSlots, const OverflowPolicy _Policy, const uint32 _Channels,
+  const DepthFormat _DepthEncoding) :
+  IsReleased(false), NextSequence(0), Channels(_Channels & ChannelAll), DepthEncoding(_DepthEncoding), SizeHeader(sizeof(PacketHeader)), SizeRGB(Width *Height * 3 * sizeof(uint8)),
+  SizeDepth(Width *Height *(_DepthEncoding == DepthFormat::Meters ? sizeof(float) : sizeof(uint16))),
+  OffsetColor(SizeHeader), OffsetDepth(OffsetColor + (Channels & ChannelColor ? SizeRGB : 0)), OffsetObject(OffsetDepth + (Channels & ChannelDepth ? SizeDepth : 0)),
+  OffsetMap(OffsetObject + (Channels & ChannelObject ? SizeRGB : 0)), Size(OffsetMap), Policy(_Policy), PacketsCommitted(0), PacketsOverwritten(0), PacketsDropped(0)
 {
-  ReadBuffer.resize(Size + 1024 * 1024);
-  WriteBuffer.resize(Size + 1024 * 1024);
+  // At least one packet for writing and one for reading
+  Slots.resize(std::max<uint32>(NumSlots, 2));
+  States.resize(Slots.size(), SlotState::Free);
+  Readers.resize(Slots.size(), 0);
 
   // Create relative FOV for each axis
   const float FOVX = Height > Width ? FieldOfView * Width / Height : FieldOfView;
   const float FOVY = Width > Height ? FieldOfView * Height / Width : FieldOfView;
 
-  // Setting header information that do not change
-  HeaderRead = reinterpret_cast<PacketHeader *>(&ReadBuffer[0]);
-  HeaderRead->Size = Size;
-  HeaderRead->SizeHeader = SizeHeader;
-  HeaderRead->Width = Width;
-  HeaderRead->Height = Height;
-  HeaderRead->FieldOfViewX = FOVX;
-  HeaderRead->FieldOfViewY = FOVY;
-  HeaderWrite = reinterpret_cast<PacketHeader *>(&WriteBuffer[0]);
-  HeaderWrite->Size = Size;
-  HeaderWrite->SizeHeader = SizeHeader;
-  HeaderWrite->Width = Width;
-  HeaderWrite->Height = Height;
-  HeaderWrite->FieldOfViewX = FOVX;
-  HeaderWrite->FieldOfViewY = FOVY;
-
-  // Setting the pointers to the data
-  Color = &WriteBuffer[OffsetColor];
-  Depth = &WriteBuffer[OffsetDepth];
-  Object = &WriteBuffer[OffsetObject];
-  Map = &WriteBuffer[OffsetMap];
-  PointerSceneGraph = &WriteBuffer[OffsetSceneGraph];
-  Read = &ReadBuffer[0];
-
-  IsDataReadable = false;
-}
-
-void PacketBuffer::StartWriting(const TMap<FString, uint32> &ObjectToColor, const TArray<FColor> &ObjectColors, const struct SceneGraph &pSceneGraph)
+  for(Packet &Slot : Slots)
+  {
+    Slot.Data.resize(Size + 1024 * 1024);
+    Slot.Sequence = 0;
+    UpdatePointers(Slot);
+
+    // Setting header information that do not change
+    Slot.Header->Size = Size;
+    Slot.Header->SizeHeader = SizeHeader;
+    Slot.Header->Version = FormatVersion;
+    SetChannels(Slot, Channels);
+    Slot.Header->Width = Width;
+    Slot.Header->Height = Height;
+    Slot.Header->FieldOfViewX = FOVX;
+    Slot.Header->FieldOfViewY = FOVY;
+  }
+}
+
+uint32 PacketBuffer::IndexOf(const Packet *Target) const
+{
+  return static_cast<uint32>(Target - &Slots[0]);
+}
+
+void PacketBuffer::UpdatePointers(Packet &Target)
+{
+  Target.Header = reinterpret_cast<PacketHeader *>(&Target.Data[0]);
+  Target.Color = Channels & ChannelColor ? &Target.Data[OffsetColor] : nullptr;
+  Target.Depth = Channels & ChannelDepth ? &Target.Data[OffsetDepth] : nullptr;
+  Target.Object = Channels & ChannelObject ? &Target.Data[OffsetObject] : nullptr;
+  Target.Map = &Target.Data[OffsetMap];
+}
+
+void PacketBuffer::SetSection(Packet &Target, const SectionType Type, const uint32 Offset, const uint32 Length)
+{
+  PacketHeader &Header = *Target.Header;
+
+  // Update the entry if the section is already in the table, otherwise append it
+  uint32 Index = 0;
+  while(Index < Header.NumSections && Header.Sections[Index].Type != Type)
+  {
+    ++Index;
+  }
+  if(Index == Header.NumSections)
+  {
+    ++Header.NumSections;
+  }
+
+  Header.Sections[Index].Type = Type;
+  Header.Sections[Index].Offset = Offset;
+  Header.Sections[Index].Length = Length;
+}
+
+void PacketBuffer::SetChannels(Packet &Target, const uint32 ActiveChannels)
+{
+  // Rebuild the table from scratch, the annotation sections are added by StartWriting
+  const uint32 Active = ActiveChannels & Channels;
+  Target.Header->NumSections = 0;
+  if(Active & ChannelColor)
+  {
+    SetSection(Target, SectionColor, OffsetColor, SizeRGB);
+  }
+  if(Active & ChannelDepth)
+  {
+    const SectionType Type = DepthEncoding == DepthFormat::Meters ? SectionDepthMeters : DepthEncoding == DepthFormat::Millimeters ? SectionDepthMillimeters : SectionDepth;
+    SetSection(Target, Type, OffsetDepth, SizeDepth);
+  }
+  if(Active & ChannelObject)
+  {
+    SetSection(Target, SectionObject, OffsetObject, SizeRGB);
+  }
+}
+
+uint32 PacketBuffer::ChannelOf(const uint32 Type)
+{
+  switch(Type)
+  {
+  case SectionColor:
+    return ChannelColor;
+  case SectionDepth:
+  case SectionDepthMeters:
+  case SectionDepthMillimeters:
+    return ChannelDepth;
+  case SectionObject:
+    return ChannelObject;
+  default:
+    return 0;
+  }
+}
+
+const PacketBuffer::Section *PacketBuffer::FindSection(const PacketHeader &Header, const SectionType Type)
+{
+  for(uint32 Index = 0; Index < Header.NumSections; ++Index)
+  {
+    if(Header.Sections[Index].Type == Type)
+    {
+      return &Header.Sections[Index];
+    }
+  }
+  return nullptr;
+}
+
+PacketBuffer::Packet *PacketBuffer::AcquireWrite()
+{
+  std::lock_guard<std::mutex> Lock(LockSlots);
+
+  // Use a free packet if there is one
+  for(uint32 Index = 0; Index < Slots.size(); ++Index)
+  {
+    if(States[Index] == SlotState::Free)
+    {
+      States[Index] = SlotState::Writing;
+      return &Slots[Index];
+    }
+  }
+
+  // Otherwise take over the oldest packet that was not sent yet
+  if(Policy == OverflowPolicy::DropOldest && !ReadyQueue.empty())
+  {
+    const uint32 Index = ReadyQueue.front();
+    ReadyQueue.pop_front();
+    States[Index] = SlotState::Writing;
+    ++PacketsOverwritten;
+    return &Slots[Index];
+  }
+
+  ++PacketsDropped;
+  return nullptr;
+}
+
+PacketBuffer::Packet *PacketBuffer::WaitForWrite(const uint32 TimeoutMs)
+{
+  std::unique_lock<std::mutex> Lock(LockSlots);
+  CVReleased.wait_for(Lock, std::chrono::milliseconds(TimeoutMs), [this]
+  {
+    return IsReleased || std::find(States.begin(), States.end(), SlotState::Free) != States.end();
+  });
+
+  const auto Free = std::find(States.begin(), States.end(), SlotState::Free);
+  if(IsReleased || Free == States.end())
+  {
+    return nullptr;
+  }
+  *Free = SlotState::Writing;
+  return &Slots[Free - States.begin()];
+}
+
+void PacketBuffer::CommitWrite(Packet *Target)
+{
+  {
+    std::lock_guard<std::mutex> Lock(LockSlots);
+    const uint32 Index = IndexOf(Target);
+    Target->Sequence = NextSequence++;
+    States[Index] = SlotState::Ready;
+    ReadyQueue.push_back(Index);
+    ++PacketsCommitted;
+  }
+  CVReadable.notify_one();
+
+  if(CommitCallback)
+  {
+    CommitCallback();
+  }
+}
+
+void PacketBuffer::CancelWrite(Packet *Target)
 {
+  {
+    std::lock_guard<std::mutex> Lock(LockSlots);
+    States[IndexOf(Target)] = SlotState::Free;
+  }
+  CVReleased.notify_all();
+}
+
+uint8 *PacketBuffer::Reserve(Packet &Target, const uint32 Offset, const uint32 Bytes)
+{
+  // Grow the packet if necessary. The allocation is kept, so this only happens until the annotations reached their maximum size.
+  if(Offset + Bytes > Target.Data.size())
+  {
+    Target.Data.resize(std::max<size_t>(Target.Data.size() * 2, Offset + Bytes));
+    UpdatePointers(Target);
+  }
+  return &Target.Data[Offset];
+}
+
+uint8 *PacketBuffer::ReserveRaw(Packet &Target, const uint32 Size)
+{
+  return Reserve(Target, 0, Size);
+}
+
+void PacketBuffer::WriteString(Packet &Target, uint32 &Offset, const FString &String, const bool WithLength)
+{
+  const uint32 Length = String.Len();
+  uint8 *It = Reserve(Target, Offset, (WithLength ? sizeof(uint32) : 0) + Length);
+
+  if(WithLength)
+  {
+    memcpy(It, &Length, sizeof(uint32));
+    It += sizeof(uint32);
+  }
+
+  // Narrow the characters directly into the packet, non ANSI characters are replaced like TCHAR_TO_ANSI does
+  const TCHAR *Chars = *String;
+  for(uint32 i = 0; i < Length; ++i)
+  {
+    It[i] = Chars[i] < 0x80 ? (uint8)Chars[i] : (uint8)'?';
+  }
+  Offset += (WithLength ? sizeof(uint32) : 0) + Length;
+}
+
+void PacketBuffer::StartWriting(Packet &Target, const TMap<FString, uint32> &ObjectToColor, const TArray<FColor> &ObjectColors, const struct SceneGraph &pSceneGraph)
+{
+  // Runs on the game thread for every frame, so nothing in here may allocate once the packet has grown
   uint32_t Count = 0;
-  uint32_t MapSize = 0;
-  uint8_t *It = Map;
+  uint32 Offset = OffsetMap;
 
   // Writing the object color map entries to the end of the packet
-  for(auto &Elem : ObjectToColor)
+  for(const auto &Elem : ObjectToColor)
   {
     const uint32_t NameSize = Elem.Key.Len();
     const uint32_t ElemSize = sizeof(uint32_t) + 3 * sizeof(uint8_t) + NameSize;
     const FColor &ObjectColor = ObjectColors[Elem.Value];
 
-    // Resize the internal buffer if necessary
-    if(Size + MapSize + ElemSize > WriteBuffer.size())
-    {
-      WriteBuffer.resize(WriteBuffer.size() + 1024 * 1024);
-      // Update pointers
-      Color = &WriteBuffer[OffsetColor];
-      Depth = &WriteBuffer[OffsetDepth];
-      Object = &WriteBuffer[OffsetObject];
-      Map = &WriteBuffer[OffsetMap];
-      OffsetSceneGraph = OffsetMap + MapSize;
-      PointerSceneGraph = &WriteBuffer[OffsetSceneGraph];
-      HeaderWrite = reinterpret_cast<PacketHeader *>(&WriteBuffer[0]);
-    }
-
-    MapEntry *Entry = reinterpret_cast<MapEntry*>(It);
+    MapEntry *Entry = reinterpret_cast<MapEntry*>(Reserve(Target, Offset, ElemSize));
     Entry->Size = ElemSize;
 
     Entry->R = ObjectColor.R;
     Entry->G = ObjectColor.G;
     Entry->B = ObjectColor.B;
+    Offset += ElemSize - NameSize;
 
-    // Convert name to ANSI and copy it to the packet (no trailing '\0', length is indirectly given by the entry size)
-    const char *Name = TCHAR_TO_ANSI(*Elem.Key);
-    memcpy(&Entry->FirstChar, Name, NameSize);
-
-    It += ElemSize;
-    MapSize += ElemSize;
+    // Copy the name to the packet (no trailing '\0', length is indirectly given by the entry size)
+    WriteString(Target, Offset, Elem.Key, false);
     ++Count;
   }
 
-  HeaderWrite->MapEntries = Count;
-  OffsetSceneGraph = OffsetMap + MapSize;
-  PointerSceneGraph = &WriteBuffer[OffsetSceneGraph];
+  Target.Header->MapEntries = Count;
+  SetSection(Target, SectionMap, OffsetMap, Offset - OffsetMap);
 
   // Write the SceneGraph data to the end of the packet
-  HeaderWrite->numberOfObjects = pSceneGraph.Objects.Num();
-  HeaderWrite->numberOfRelations = pSceneGraph.Relations.Num();
+  Target.Header->numberOfObjects = pSceneGraph.Objects.Num();
+  Target.Header->numberOfRelations = pSceneGraph.Relations.Num();
 
-  SizeSceneGraph = 0;
-  int Counter = 0;
-  int Counter2 = 0;
+  const uint32 OffsetObjects = Offset;
+  CopyObjects(Target, Offset, pSceneGraph.Objects);
+  SetSection(Target, SectionObjects, OffsetObjects, Offset - OffsetObjects);
 
-  for (PacketBuffer::ObjectDescription Object : pSceneGraph.Objects)
-  {
-    for (PacketBuffer::ObjectProperty Property : Object.Properties)
-    {
-      SizeSceneGraph += sizeof(int32) + Property.Mesh.Len() + Property.Material.Len() + 3 * sizeof(Float32) + 3 * sizeof(Float32);
-      ++Counter;
-    }
-  }
+  const uint32 OffsetRelations = Offset;
+  CopyRelations(Target, Offset, pSceneGraph.Relations);
+  SetSection(Target, SectionRelations, OffsetRelations, Offset - OffsetRelations);
 
-  for (PacketBuffer::ObjectRelation Relation : pSceneGraph.Relations) 
-  {
-    SizeSceneGraph += sizeof(int32) + Relation.SpatialRelationship.Len() + sizeof(int32);
-    ++Counter2;
-  }
-
-  HeaderWrite->Size += (MapSize + SizeSceneGraph);
-
-  // Copy SceneGraph to the packet
-  CopySceneGraph(PointerSceneGraph, pSceneGraph);
+  // The packet ends after the relations, this is recomputed for every frame
+  Target.Header->Size = Offset;
 }
 
 // Serialize a float array
-void PacketBuffer::SerializeFloatArray(uint8 *pBuffer, TArray<FFloat32> FloatArray)
+void PacketBuffer::SerializeFloatArray(Packet &Target, uint32 &Offset, const TArray<FFloat32> &FloatArray)
 {
-  for (int i = 0; i < FloatArray.Num(); ++i)
-  {
-    memcpy(pBuffer + i * sizeof(FFloat32), (char *)&FloatArray[i], sizeof(FFloat32));
-  }
+  const uint32 Bytes = FloatArray.Num() * sizeof(FFloat32);
+  memcpy(Reserve(Target, Offset, Bytes), FloatArray.GetData(), Bytes);
+  Offset += Bytes;
 }
 
 // Copy properties to buffer
-void PacketBuffer::CopyProperties(uint8*& pBuffer, PacketBuffer::ObjectProperty Properties)
-{
-  memcpy(pBuffer, &Properties.ID, sizeof(int32));
-  pBuffer += sizeof(int32);
-  
-  const char *Mesh = TCHAR_TO_ANSI(*Properties.Mesh);
-  int32 s = Properties.Mesh.Len();
-  memcpy(pBuffer, &s, sizeof(int32));
-  pBuffer += sizeof(uint32_t);
-  memcpy(pBuffer, Mesh, Properties.Mesh.Len());
-  pBuffer += Properties.Mesh.Len();
-
-  const char *Material = TCHAR_TO_ANSI(*Properties.Material);
-  *reinterpret_cast<uint32_t *>(pBuffer) = Properties.Material.Len();
-  pBuffer += sizeof(uint32_t);
-  memcpy(pBuffer, Material, Properties.Material.Len());
-  pBuffer += Properties.Material.Len();
-
-  SerializeFloatArray(pBuffer, Properties.Location);
-  pBuffer += Properties.Location.Num() * sizeof(FFloat32);
-  
-  SerializeFloatArray(pBuffer, Properties.Rotation);
-  pBuffer += Properties.Rotation.Num() * sizeof(FFloat32);
+void PacketBuffer::CopyProperties(Packet &Target, uint32 &Offset, const PacketBuffer::ObjectProperty &Properties)
+{
+  memcpy(Reserve(Target, Offset, sizeof(int32)), &Properties.ID, sizeof(int32));
+  Offset += sizeof(int32);
+
+  WriteString(Target, Offset, Properties.Mesh, true);
+  WriteString(Target, Offset, Properties.Material, true);
+
+  SerializeFloatArray(Target, Offset, Properties.Location);
+  SerializeFloatArray(Target, Offset, Properties.Rotation);
 }
 
 // Copy objects to buffer
-void PacketBuffer::CopyObjects(uint8*& pBuffer, TArray<PacketBuffer::ObjectDescription> Objects) 
+void PacketBuffer::CopyObjects(Packet &Target, uint32 &Offset, const TArray<PacketBuffer::ObjectDescription> &Objects)
 {
-  for (PacketBuffer::ObjectDescription Description : Objects) {
-    for (PacketBuffer::ObjectProperty Properties : Description.Properties) 
+  for (const PacketBuffer::ObjectDescription &Description : Objects)
+  {
+    for (const PacketBuffer::ObjectProperty &Properties : Description.Properties)
     {
-      CopyProperties(pBuffer, Properties);
+      CopyProperties(Target, Offset, Properties);
     }
   }
 }
 
 // Copy relations to buffer
-void PacketBuffer::CopyRelations(uint8*& pBuffer, TArray<PacketBuffer::ObjectRelation> Relations) 
+void PacketBuffer::CopyRelations(Packet &Target, uint32 &Offset, const TArray<PacketBuffer::ObjectRelation> &Relations)
 {
-  for (PacketBuffer::ObjectRelation Relation : Relations) 
+  for (const PacketBuffer::ObjectRelation &Relation : Relations)
   {
-    memcpy(pBuffer, (char *)&Relation.ID1, sizeof(int32));
-    pBuffer += sizeof(int32);
+    memcpy(Reserve(Target, Offset, sizeof(int32)), &Relation.ID1, sizeof(int32));
+    Offset += sizeof(int32);
+
+    WriteString(Target, Offset, Relation.SpatialRelationship, true);
+
+    memcpy(Reserve(Target, Offset, sizeof(int32)), &Relation.ID2, sizeof(int32));
+    Offset += sizeof(int32);
+  }
+}
 
-    const char *SpatialRelationship = TCHAR_TO_ANSI(*Relation.SpatialRelationship);
-    *reinterpret_cast<uint32_t *>(pBuffer) = Relation.SpatialRelationship.Len();
-    pBuffer += sizeof(uint32_t);
-    memcpy(pBuffer, SpatialRelationship, Relation.SpatialRelationship.Len());
-    pBuffer += Relation.SpatialRelationship.Len();
-    
-    memcpy(pBuffer, (char *)&Relation.ID2, sizeof(int32));
-    pBuffer += sizeof(int32);
+PacketBuffer::Packet *PacketBuffer::AcquireRead()
+{
+  // Waits until a packet is committed
+  std::unique_lock<std::mutex> Lock(LockSlots);
+  CVReadable.wait(Lock, [this] {return IsReleased || !ReadyQueue.empty(); });
+  if(IsReleased)
+  {
+    return nullptr;
   }
+
+  const uint32 Index = ReadyQueue.front();
+  ReadyQueue.pop_front();
+  States[Index] = SlotState::Reading;
+  Readers[Index] = 1;
+  return &Slots[Index];
 }
 
-// Copy SceneGraph to buffer
-void PacketBuffer::CopySceneGraph(uint8*& pBuffer, SceneGraph pSceneGraph) 
+PacketBuffer::Packet *PacketBuffer::TryAcquireRead()
 {
-  CopyObjects(pBuffer, pSceneGraph.Objects);
-  CopyRelations(pBuffer, pSceneGraph.Relations);
+  std::lock_guard<std::mutex> Lock(LockSlots);
+  if(IsReleased || ReadyQueue.empty())
+  {
+    return nullptr;
+  }
+
+  const uint32 Index = ReadyQueue.front();
+  ReadyQueue.pop_front();
+  States[Index] = SlotState::Reading;
+  Readers[Index] = 1;
+  return &Slots[Index];
 }
 
-void PacketBuffer::DoneWriting()
+void PacketBuffer::ReleaseRead(Packet *Target)
 {
-  // Swapping buffers
-  LockBuffer.lock();
-  IsDataReadable = true;
-  WriteBuffer.swap(ReadBuffer);
-  Color = &WriteBuffer[OffsetColor];
-  Depth = &WriteBuffer[OffsetDepth];
-  Object = &WriteBuffer[OffsetObject];
-  Map = &WriteBuffer[OffsetMap];
-  PointerSceneGraph = &WriteBuffer[OffsetSceneGraph];
-  Read = &ReadBuffer[0];
-  HeaderRead = reinterpret_cast<PacketHeader *>(&ReadBuffer[0]);
-  HeaderWrite = reinterpret_cast<PacketHeader *>(&WriteBuffer[0]);
-  LockBuffer.unlock();
-  CVWait.notify_one();
+  {
+    std::lock_guard<std::mutex> Lock(LockSlots);
+    const uint32 Index = IndexOf(Target);
+    if(--Readers[Index] != 0)
+    {
+      return;
+    }
+    States[Index] = SlotState::Free;
+  }
+  CVReleased.notify_all();
 }
 
-void PacketBuffer::StartReading()
+uint32 PacketBuffer::GetNumReading()
 {
-  // Waits until writing is done
-  std::unique_lock<std::mutex> WaitLock(LockRead);
-  CVWait.wait(WaitLock, [this] {return IsDataReadable; });
+  std::lock_guard<std::mutex> Lock(LockSlots);
+  return std::count(States.begin(), States.end(), SlotState::Reading);
+}
 
-  LockBuffer.lock();
+bool PacketBuffer::WaitUntilRead(const int32 TimeoutMs)
+{
+  std::unique_lock<std::mutex> Lock(LockSlots);
+  auto IsRead = [this]
+  {
+    return ReadyQueue.empty() && std::find(States.begin(), States.end(), SlotState::Reading) == States.end();
+  };
+  if(TimeoutMs < 0)
+  {
+    CVReleased.wait(Lock, [&] {return IsReleased || IsRead(); });
+  }
+  else
+  {
+    CVReleased.wait_for(Lock, std::chrono::milliseconds(TimeoutMs), [&] {return IsReleased || IsRead(); });
+  }
+  return IsRead();
 }
 
-void PacketBuffer::DoneReading()
+void PacketBuffer::ShareRead(Packet *Target, const uint32 AdditionalReaders)
 {
-  IsDataReadable = false;
-  LockBuffer.unlock();
+  std::lock_guard<std::mutex> Lock(LockSlots);
+  Readers[IndexOf(Target)] += AdditionalReaders;
 }
 
 void PacketBuffer::Release()
 {
-  IsDataReadable = true;
-  CVWait.notify_one();
+  {
+    std::lock_guard<std::mutex> Lock(LockSlots);
+    IsReleased = true;
+  }
+  CVReadable.notify_all();
+  CVReleased.notify_all();
 }
\ No newline at end of file
@@ -0,0 +1,245 @@
+// Copyright 2017, Institute for Artificial Intelligence - University of Bremen
+
+#include "PacketRelay.h"
+#include "StopTime.h"
+#include "Sockets.h"
+#include "SocketSubsystem.h"
+#include "IPAddress.h"
+#include <functional>
+
+PacketRelay::PacketRelay() : Running(false), NumSlots(8), MaxPacketSize(256 * 1024 * 1024)
+{
+}
+
+PacketRelay::~PacketRelay()
+{
+  Stop();
+}
+
+bool PacketRelay::Start(const TArray<FString> &Addresses, const int32 ServerPort, const bool BindToAnyIp)
+{
+  OUT_INFO(TEXT("Starting relay for %d shards."), Addresses.Num());
+
+  for(int32 Index = 0; Index < Addresses.Num(); ++Index)
+  {
+    FString Host, Port;
+    if(!Addresses[Index].Split(TEXT(":"), &Host, &Port, ESearchCase::IgnoreCase, ESearchDir::FromEnd) || !Port.IsNumeric())
+    {
+      OUT_ERROR(TEXT("Invalid generator address %s, expected host:port."), *Addresses[Index]);
+      Upstreams.clear();
+      return false;
+    }
+
+    std::unique_ptr<Upstream> Source(new Upstream());
+    Source->Host = Host;
+    Source->Port = FCString::Atoi(*Port);
+    Source->ShardId = Index;
+    Source->Socket = nullptr;
+    Source->Finished = false;
+    Source->PacketsReceived = 0;
+    Source->BytesReceived = 0;
+    Upstreams.push_back(std::move(Source));
+  }
+
+  // The packets only consist of the header until the first one is received, they grow to the size of the largest one
+  Buffer = TSharedPtr<PacketBuffer>(new PacketBuffer(0, 0, 0.0f, NumSlots, PacketBuffer::OverflowPolicy::DropNewest, 0));
+  Server.Buffer = Buffer;
+  Server.SlowPolicy = TCPServer::SlowClientPolicy::Wait;
+  Server.Start(ServerPort, BindToAnyIp);
+
+  Running = true;
+  for(std::unique_ptr<Upstream> &Source : Upstreams)
+  {
+    Source->Thread = std::thread(&PacketRelay::ReceiveLoop, this, std::ref(*Source));
+  }
+  return true;
+}
+
+void PacketRelay::Stop()
+{
+  if(!Running)
+  {
+    return;
+  }
+
+  // Wake up the receiving threads by shutting down their sockets
+  Running = false;
+  for(std::unique_ptr<Upstream> &Source : Upstreams)
+  {
+    FSocket *Socket = Source->Socket;
+    if(Socket)
+    {
+      Socket->Shutdown(ESocketShutdownMode::ReadWrite);
+    }
+    Source->Thread.join();
+
+    Socket = Source->Socket;
+    if(Socket)
+    {
+      Socket->Close();
+      ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM)->DestroySocket(Socket);
+      Source->Socket = nullptr;
+    }
+  }
+
+  // Consumers still get the packets that are queued
+  if(Server.HasClient())
+  {
+    Buffer->WaitUntilRead();
+  }
+  Server.Stop();
+  LogStatistics();
+  Upstreams.clear();
+}
+
+bool PacketRelay::IsRunning() const
+{
+  for(const std::unique_ptr<Upstream> &Source : Upstreams)
+  {
+    if(!Source->Finished)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+void PacketRelay::LogStatistics() const
+{
+  for(const std::unique_ptr<Upstream> &Source : Upstreams)
+  {
+    OUT_INFO(TEXT("Shard %u (%s:%d): packets received: %llu (%.1f MB)%s"), Source->ShardId, *Source->Host, Source->Port,
+      (uint64)Source->PacketsReceived, Source->BytesReceived / (1024.0 * 1024.0), Source->Finished ? TEXT(", finished") : TEXT(""));
+  }
+}
+
+void PacketRelay::ReceiveLoop(Upstream &Source)
+{
+  // Generators might start after the relay, so connecting is retried. They only produce frames while a client is
+  // connected, so the relay does not connect before a consumer does.
+  while(WaitForConsumer() && !Connect(Source))
+  {
+    FPlatformProcess::Sleep(1.0f);
+  }
+
+  while(Running && ReceivePacket(Source))
+  {
+  }
+
+  if(Running)
+  {
+    OUT_INFO(TEXT("Shard %u (%s:%d) closed the connection."), Source.ShardId, *Source.Host, Source.Port);
+  }
+  Source.Finished = true;
+}
+
+bool PacketRelay::WaitForConsumer()
+{
+  // Packets committed without a consumer would be dropped by the server
+  while(Running && !Server.HasClient())
+  {
+    FPlatformProcess::Sleep(0.1f);
+  }
+  return Running;
+}
+
+bool PacketRelay::Connect(Upstream &Source)
+{
+  ISocketSubsystem *Sockets = ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM);
+  TSharedRef<FInternetAddr> Address = Sockets->CreateInternetAddr();
+  if(Sockets->GetHostByName(TCHAR_TO_ANSI(*Source.Host), *Address) != SE_NO_ERROR)
+  {
+    OUT_WARN(TEXT("Could not resolve %s."), *Source.Host);
+    return false;
+  }
+  Address->SetPort(Source.Port);
+
+  FSocket *Socket = Sockets->CreateSocket(NAME_Stream, TEXT("Relay Upstream Socket"), false);
+  if(!Socket)
+  {
+    OUT_ERROR(TEXT("Could not create socket."));
+    return false;
+  }
+  if(!Socket->Connect(*Address))
+  {
+    Sockets->DestroySocket(Socket);
+    return false;
+  }
+
+  OUT_INFO(TEXT("Connected to shard %u (%s:%d)."), Source.ShardId, *Source.Host, Source.Port);
+  Source.Socket = Socket;
+  return true;
+}
+
+bool PacketRelay::Receive(Upstream &Source, uint8 *Target, const uint32 Size)
+{
+  uint32 Received = 0;
+  while(Received < Size)
+  {
+    int32 BytesRead = 0;
+    if(!Source.Socket.load()->Recv(Target + Received, Size - Received, BytesRead, ESocketReceiveFlags::WaitAll) || BytesRead <= 0)
+    {
+      return false;
+    }
+    Received += BytesRead;
+  }
+  Source.BytesReceived += Size;
+  return true;
+}
+
+bool PacketRelay::ReceivePacket(Upstream &Source)
+{
+  // The beginning of the header tells the size of the packet and its format. It is received before a slot is taken,
+  // so that generators that are still rendering don't hold slots the others could fill.
+  const uint32 SizePrefix = 3 * sizeof(uint32);
+  uint32 Prefix[3];
+  if(!Receive(Source, reinterpret_cast<uint8 *>(Prefix), SizePrefix))
+  {
+    return false;
+  }
+
+  const uint32 Size = Prefix[0], SizeHeader = Prefix[1], Version = Prefix[2];
+  if(Version != PacketBuffer::FormatVersion || SizeHeader != sizeof(PacketBuffer::PacketHeader) || Size < SizeHeader)
+  {
+    OUT_ERROR(TEXT("Shard %u sent a packet of version %u, the relay expects version %u."), Source.ShardId, Version, PacketBuffer::FormatVersion);
+    return false;
+  }
+
+  // The size comes from the network, a corrupt or hostile stream must not make the ring allocate arbitrary amounts of memory
+  if(Size > MaxPacketSize)
+  {
+    OUT_ERROR(TEXT("Shard %u sent a packet of %u bytes, the limit is %u bytes. Dropping the connection."), Source.ShardId, Size, MaxPacketSize);
+    Source.Socket.load()->Shutdown(ESocketShutdownMode::ReadWrite);
+    return false;
+  }
+
+  // The rest of the packet is only taken from the stream once it can be queued, until then the generator is held back by flow control
+  PacketBuffer::Packet *Packet = nullptr;
+  while(WaitForConsumer() && !(Packet = Buffer->WaitForWrite(100)))
+  {
+  }
+  if(!Packet)
+  {
+    return false;
+  }
+
+  uint8 *Data = Buffer->ReserveRaw(*Packet, Size);
+  FMemory::Memcpy(Data, Prefix, SizePrefix);
+  if(!Receive(Source, Data + SizePrefix, Size - SizePrefix))
+  {
+    Buffer->CancelWrite(Packet);
+    return false;
+  }
+  ++Source.PacketsReceived;
+
+  // Tag the packet with the shard it came from
+  PacketBuffer::PacketHeader *Header = reinterpret_cast<PacketBuffer::PacketHeader *>(Data);
+  if(Header->ShardId != Source.ShardId && Source.PacketsReceived == 1)
+  {
+    OUT_WARN(TEXT("Generator %s:%d is configured as shard %u, relaying it as shard %u."), *Source.Host, Source.Port, Header->ShardId, Source.ShardId);
+  }
+  Header->ShardId = Source.ShardId;
+  Header->ShardCount = Upstreams.size();
+  Buffer->CommitWrite(Packet);
+  return true;
+}
@@ -0,0 +1,58 @@
+// Copyright 2017, Institute for Artificial Intelligence - University of Bremen
+
+#include "PacketRelayCommandlet.h"
+#include "PacketRelay.h"
+#include "AutonomousRGBDCamera.h"
+#include "Misc/Parse.h"
+
+UPacketRelayCommandlet::UPacketRelayCommandlet()
+{
+	IsClient = false;
+	IsServer = false;
+	IsEditor = false;
+	LogToConsole = true;
+}
+
+int32 UPacketRelayCommandlet::Main(const FString &Params)
+{
+	FString Upstream;
+	if(!FParse::Value(*Params, TEXT("Upstream="), Upstream, false))
+	{
+		OUT_ERROR(TEXT("No generators given, use -Upstream=host:port,host:port,..."));
+		return 1;
+	}
+	TArray<FString> Addresses;
+	Upstream.ParseIntoArray(Addresses, TEXT(","));
+
+	int32 Port = 10000;
+	int32 Slots = 8;
+	int32 MaxPacketMB = 256;
+	float Interval = 5.0f;
+	FParse::Value(*Params, TEXT("Port="), Port);
+	FParse::Value(*Params, TEXT("Slots="), Slots);
+	FParse::Value(*Params, TEXT("MaxPacketMB="), MaxPacketMB);
+	FParse::Value(*Params, TEXT("Interval="), Interval);
+
+	PacketRelay Relay;
+	Relay.NumSlots = FMath::Max(Slots, 2);
+	Relay.MaxPacketSize = FMath::Clamp(MaxPacketMB, 1, 4095) * 1024u * 1024u;
+	if(!Relay.Start(Addresses, Port, true))
+	{
+		return 1;
+	}
+
+	// Relay until all generators are done
+	double LastReport = FPlatformTime::Seconds();
+	while(Relay.IsRunning() && !GIsRequestingExit)
+	{
+		FPlatformProcess::Sleep(0.1f);
+		if(FPlatformTime::Seconds() - LastReport >= Interval)
+		{
+			Relay.LogStatistics();
+			LastReport = FPlatformTime::Seconds();
+		}
+	}
+
+	Relay.Stop();
+	return 0;
+}
@@ -23,6 +23,9 @@ ASceneConfiguration::ASceneConfiguration()
 
     // Show spatial relationships of scene objects in Output Log
 	bShowSpatialRelationships = true;
+
+    // Separate streams until the camera seeds them
+    SetRandomSeed(0, 0);
 }
 
 // Called when the game starts or when spawned
@@ -161,21 +164,29 @@ void ASceneConfiguration::EnableSceneObject(ASceneObject* pSceneObject)
 // Randomly swap scene objects
 void ASceneConfiguration::RandomlySwapSceneObjects() 
 {
-    for (ASceneObject* SceneObject : ArrayOfSceneObjects) 
+    // Randomly decide what should be changed, drawn as one batch for all scene objects. Every scene object gets
+    // a decision, a partner and two rotation steps, whether it is swapped or not, so that each tick takes the same
+    // number of values from the streams.
+    const int32 NumObjects = ArrayOfSceneObjects.Num();
+    RandomDraws.SetNumUninitialized(NumObjects * 2);
+    RandomSwaps.FillRange(RandomDraws.GetData(), NumObjects, 0, 1);
+    RandomSwaps.FillRange(RandomDraws.GetData() + NumObjects, NumObjects, 0, NumObjects - 2);
+    RandomSteps.SetNumUninitialized(NumObjects * 2);
+    RandomRotation.FillRange(RandomSteps.GetData(), RandomSteps.Num(), -MaxZRotationSceneObject, MaxZRotationSceneObject);
+
+    for (int32 Index = 0; Index < NumObjects; ++Index) 
     {
-        // Randomly decide what should be changed
-        int32 SwapSceneObjectRandom = FMath::RandRange(0,1);
-        
-        if (ArrayOfSceneObjects.Num() > 1 && SwapSceneObjectRandom == 1) {
-            SwapSceneObjects(SceneObject);
+        if (NumObjects > 1 && RandomDraws[Index] == 1) {
+            SwapSceneObjects(Index, RandomDraws[NumObjects + Index], RandomSteps[Index * 2], RandomSteps[Index * 2 + 1]);
         }
     }
 }
 
 // Swap scene objects using the argument, a random swap partner and new rotations for both
-void ASceneConfiguration::SwapSceneObjects(ASceneObject *pSceneObject)
+void ASceneConfiguration::SwapSceneObjects(int32 pIndex, int32 pPartnerDraw, float pZAxisStep, float pPartnerZAxisStep)
 {
-    ASceneObject *SwapPartner = GetSwapPartner(pSceneObject);
+    ASceneObject *pSceneObject = ArrayOfSceneObjects[pIndex];
+    ASceneObject *SwapPartner = GetSwapPartner(pIndex, pPartnerDraw);
 
     // Only continue if both scene objects aren't contained by another scene object
     if (CheckIsContained(pSceneObject) || CheckIsContained(SwapPartner)) 
@@ -188,9 +199,9 @@ void ASceneConfiguration::SwapSceneObjects(ASceneObject *pSceneObject)
     FVector SwapPartnerLocation = SwapPartner->GetActorLocation();
     FRotator SwapPartnerRotation = SwapPartner->GetActorRotation();
 
-    // Get random rotation values within the specified step length
-    float CurrentZAxisStep = FMath::RandRange(-MaxZRotationSceneObject,MaxZRotationSceneObject);
-    float SwapZAxisStep = FMath::RandRange(-MaxZRotationSceneObject,MaxZRotationSceneObject);
+    // Random rotation values within the specified step length
+    float CurrentZAxisStep = pZAxisStep;
+    float SwapZAxisStep = pPartnerZAxisStep;
 
     // New locations and rotations using the steps
     FVector NewpSceneObjectLocation = FVector(SwapPartnerLocation.X, SwapPartnerLocation.Y, pSceneObjectLocation.Z);
@@ -226,16 +237,11 @@ void ASceneConfiguration::SwapSceneObjects(ASceneObject *pSceneObject)
 }
 
 // Get a random partner for SwapSceneObjects
-ASceneObject* ASceneConfiguration::GetSwapPartner(ASceneObject* pSceneObject) 
+ASceneObject* ASceneConfiguration::GetSwapPartner(int32 pIndex, int32 pPartnerDraw) 
 {
-    ASceneObject* SwapPartner = NULL;
-
-    while (SwapPartner == NULL || SwapPartner == pSceneObject)
-    {
-        int32 RandomArrayIndex = FMath::RandRange(0, ArrayOfSceneObjects.Num()-1);
-        SwapPartner = ArrayOfSceneObjects[RandomArrayIndex];
-    }
-    return SwapPartner;
+    // The draw is one of the other scene objects, so it is shifted past pIndex instead of drawing again
+    int32 RandomArrayIndex = pPartnerDraw >= pIndex ? pPartnerDraw + 1 : pPartnerDraw;
+    return ArrayOfSceneObjects[RandomArrayIndex];
 }
 
 // Set MaxZRotationSceneObject
@@ -244,16 +250,46 @@ void ASceneConfiguration::SetMaxZRotationSceneObject(float pMaxZRotationSceneObj
     MaxZRotationSceneObject = pMaxZRotationSceneObject;
 }
 
+// Seed the random streams of swaps, disables and rotation jitter for a shard
+void ASceneConfiguration::SetRandomSeed(uint64 pSeed, uint32 pShardId) 
+{
+    RandomSwaps.SetSeed(pSeed, PCGStream::StreamOf(pShardId, ERandomSubsystem::SceneSwaps));
+    RandomDisables.SetSeed(pSeed, PCGStream::StreamOf(pShardId, ERandomSubsystem::SceneDisables));
+    RandomRotation.SetSeed(pSeed, PCGStream::StreamOf(pShardId, ERandomSubsystem::RotationJitter));
+}
+
+// Move the random streams and the scene forward by pCount ticks, without the log output
+void ASceneConfiguration::SkipTicks(uint64 pCount)
+{
+    if (pCount == 0)
+    {
+        return;
+    }
+
+    // Swaps carry over from tick to tick, so they are replayed
+    for (uint64 Tick = 0; Tick < pCount; ++Tick)
+    {
+        EnableAllSceneObjects();
+        RandomlySwapSceneObjects();
+    }
+
+    // Disables only last until the next tick, so only those of the last one are drawn
+    RandomDisables.Advance((pCount - 1) * ArrayOfSceneObjects.Num());
+    RandomlyDisableSceneObjects();
+}
+
 // Randomly disable scene objects
 void ASceneConfiguration::RandomlyDisableSceneObjects() 
 {
-    for (ASceneObject* SceneObject : ArrayOfSceneObjects) 
-    {
-        int32 SceneObjectEnabledRandom = FMath::RandRange(0,1);
+    // Draw the decisions for all scene objects as one batch
+    RandomDraws.SetNumUninitialized(ArrayOfSceneObjects.Num());
+    RandomDisables.FillRange(RandomDraws.GetData(), RandomDraws.Num(), 0, 1);
 
-        if (SceneObjectEnabledRandom == 0) 
+    for (int32 Index = 0; Index < ArrayOfSceneObjects.Num(); ++Index) 
+    {
+        if (RandomDraws[Index] == 0) 
         {
-           DisableSceneObject(SceneObject);
+           DisableSceneObject(ArrayOfSceneObjects[Index]);
         }
     }
 }
@@ -4,8 +4,67 @@
 //#include "URoboVision.h"
 #include "StopTime.h"
 
-TCPServer::TCPServer() : Running(false)
+#include <algorithm>
+#include <string.h>
+
+#if PLATFORM_LINUX
+#include <unistd.h>
+#include <errno.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/errqueue.h>
+#include <linux/sockios.h>
+
+// Older system headers do not define the zero copy constants yet
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+
+// The same applies to memfd and file sealing
+#ifndef SYS_memfd_create
+#define SYS_memfd_create 319
+#endif
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS 1033
+#define F_SEAL_SEAL 0x0001
+#define F_SEAL_SHRINK 0x0002
+#define F_SEAL_GROW 0x0004
+#define F_SEAL_WRITE 0x0008
+#endif
+#endif
+
+TCPServer::TCPServer() : Running(false), NumClients(0), SubscribedChannels(SubscribeAll), ZeroCopyThreshold(0), QueueLimit(2),
+  SlowPolicy(SlowClientPolicy::DropFrames), DisconnectLag(30), MaxPinnedSlots(0), DrainTimeoutMs(0)
 {
+  EarliestDue = 0;
+#if PLATFORM_LINUX
+  ListenFd = -1;
+  UnixFd = -1;
+  EpollFd = -1;
+  WakeFd = -1;
+  Blocked = false;
+#else
+  ListenSocket = nullptr;
+#endif
 }
 
 TCPServer::~TCPServer()
@@ -44,6 +103,92 @@ void TCPServer::Start(const int32 ServerPort, bool BindToAnyIp)
 
   OUT_INFO(TEXT("Server address: %s"), *LocalIP->ToString(true));
 
+#if PLATFORM_LINUX
+  uint32 Address = 0;
+  LocalIP->GetIp(Address);
+
+  sockaddr_in SocketAddress = {};
+  SocketAddress.sin_family = AF_INET;
+  SocketAddress.sin_port = htons(ServerPort);
+  SocketAddress.sin_addr.s_addr = htonl(Address);
+
+  // The listening socket is non-blocking, so that all pending connections can be accepted at once
+  const int Enable = 1;
+  ListenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if(ListenFd < 0 || setsockopt(ListenFd, SOL_SOCKET, SO_REUSEADDR, &Enable, sizeof(Enable)) < 0
+    || bind(ListenFd, reinterpret_cast<sockaddr *>(&SocketAddress), sizeof(SocketAddress)) < 0 || listen(ListenFd, 8) < 0)
+  {
+    OUT_ERROR(TEXT("Could not create socket: %s"), UTF8_TO_TCHAR(strerror(errno)));
+    if(ListenFd >= 0)
+    {
+      close(ListenFd);
+      ListenFd = -1;
+    }
+  }
+  else
+  {
+    OUT_INFO(TEXT("Socket created"));
+  }
+
+  // Local clients can connect through a unix socket, access is restricted by the file permissions
+  if(!UnixSocketPath.IsEmpty())
+  {
+    sockaddr_un UnixAddress = {};
+    UnixAddress.sun_family = AF_UNIX;
+    strncpy(UnixAddress.sun_path, TCHAR_TO_UTF8(*UnixSocketPath), sizeof(UnixAddress.sun_path) - 1);
+    unlink(UnixAddress.sun_path);
+
+    UnixFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(UnixFd < 0 || bind(UnixFd, reinterpret_cast<sockaddr *>(&UnixAddress), sizeof(UnixAddress)) < 0
+      || chmod(UnixAddress.sun_path, 0660) < 0 || listen(UnixFd, 8) < 0)
+    {
+      OUT_ERROR(TEXT("Could not create unix socket %s: %s"), *UnixSocketPath, UTF8_TO_TCHAR(strerror(errno)));
+      if(UnixFd >= 0)
+      {
+        close(UnixFd);
+        UnixFd = -1;
+      }
+    }
+    else
+    {
+      OUT_INFO(TEXT("Unix socket created: %s"), *UnixSocketPath);
+    }
+  }
+
+  // The event loop waits for new connections, writable clients and committed packets at the same time
+  EpollFd = epoll_create1(EPOLL_CLOEXEC);
+  WakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if(EpollFd < 0 || WakeFd < 0)
+  {
+    OUT_ERROR(TEXT("Could not create event loop: %s"), UTF8_TO_TCHAR(strerror(errno)));
+    return;
+  }
+
+  epoll_event Event = {};
+  Event.events = EPOLLIN;
+  Event.data.ptr = &WakeFd;
+  epoll_ctl(EpollFd, EPOLL_CTL_ADD, WakeFd, &Event);
+  if(ListenFd >= 0)
+  {
+    Event.data.ptr = &ListenFd;
+    epoll_ctl(EpollFd, EPOLL_CTL_ADD, ListenFd, &Event);
+  }
+  if(UnixFd >= 0)
+  {
+    Event.data.ptr = &UnixFd;
+    epoll_ctl(EpollFd, EPOLL_CTL_ADD, UnixFd, &Event);
+  }
+
+  Buffer->CommitCallback = [this]()
+  {
+    Wake();
+  };
+#else
+  if(!UnixSocketPath.IsEmpty())
+  {
+    OUT_WARN(TEXT("Unix sockets are only supported on Linux, ignoring %s"), *UnixSocketPath);
+  }
+
   ListenSocket = ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM)->CreateSocket(NAME_Stream, TEXT("Server Listening Socket"), false);
   ListenSocket->SetReuseAddr(true);
   ListenSocket->Bind(*LocalIP);
@@ -57,6 +202,7 @@ void TCPServer::Start(const int32 ServerPort, bool BindToAnyIp)
   {
     OUT_INFO(TEXT("Socket created"));
   }
+#endif
 
   Running = true;
   Thread = std::thread(&TCPServer::ServerLoop, this);
@@ -66,20 +212,44 @@ void TCPServer::Stop()
 {
   if(Running)
   {
+    // Let connected clients catch up before their sockets are closed
+    if(DrainTimeoutMs != 0 && HasClient() && !Buffer->WaitUntilRead(DrainTimeoutMs))
+    {
+      OUT_WARN(TEXT("Clients did not receive all packets before stopping the server."));
+    }
+
     // Release buffer and wait for thread to stop
     Running = false;
     Buffer->Release();
+#if PLATFORM_LINUX
+    Wake();
+#endif
     Thread.join();
-    Buffer->DoneReading();
   }
 
-  // Disconnect and close client socket
-  if(ClientSocket)
+#if PLATFORM_LINUX
+  // Disconnect and close client sockets
+  CloseClients();
+  Clients.clear();
+  Buffer->CommitCallback = nullptr;
+
+  // Close listening sockets and event loop
+  if(UnixFd >= 0)
   {
-    ClientSocket->Close();
-    ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM)->DestroySocket(ClientSocket);
-    ClientSocket = nullptr;
+    unlink(TCHAR_TO_UTF8(*UnixSocketPath));
+  }
+  for(int *Fd : {&ListenFd, &UnixFd, &WakeFd, &EpollFd})
+  {
+    if(*Fd >= 0)
+    {
+      close(*Fd);
+      *Fd = -1;
+    }
   }
+#else
+  // Disconnect and close client sockets
+  CloseClients();
+  Clients.clear();
 
   // Disconnect and close listening socket
   if(ListenSocket)
@@ -88,110 +258,1067 @@ void TCPServer::Stop()
     ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM)->DestroySocket(ListenSocket);
     ListenSocket = nullptr;
   }
+#endif
 
   OUT_INFO(TEXT("Server stopped."));
 }
 
+// Copies every Step-th pixel of a Width x Height region starting at X, Y into Target, Width and Height are the size of the result
+static void CropImage(const uint8 *Source, const uint32 SourceWidth, const uint32 BytesPerPixel, const uint32 X, const uint32 Y,
+  const uint32 Width, const uint32 Height, const uint32 Step, uint8 *Target)
+{
+  for(uint32 Row = 0; Row < Height; ++Row)
+  {
+    const uint8 *Line = Source + ((uint64)(Y + Row * Step) * SourceWidth + X) * BytesPerPixel;
+    if(Step == 1)
+    {
+      memcpy(Target, Line, Width * BytesPerPixel);
+      Target += Width * BytesPerPixel;
+      continue;
+    }
+    for(uint32 Column = 0; Column < Width; ++Column, Line += Step * BytesPerPixel, Target += BytesPerPixel)
+    {
+      memcpy(Target, Line, BytesPerPixel);
+    }
+  }
+}
+
+bool TCPServer::IsDue(const Client &Target, const PacketBuffer::PacketHeader &Header) const
+{
+  return Target.Subscribed.MaxRate <= 0.0f || Header.TimestampCapture >= Target.NextCapture;
+}
+
+void TCPServer::UpdateCadence(Client &Target, const PacketBuffer::PacketHeader &Header)
+{
+  if(Target.Subscribed.MaxRate <= 0.0f)
+  {
+    return;
+  }
+
+  // Keep the cadence while packets arrive in time, otherwise start over from this one
+  const uint64 Capture = Header.TimestampCapture;
+  const uint64 Period = static_cast<uint64>(1000000000.0 / Target.Subscribed.MaxRate);
+  Target.NextCapture = Capture - Target.NextCapture < Period ? Target.NextCapture + Period : Capture + Period;
+}
+
+void TCPServer::PrepareHeader(Client &Target, const PacketBuffer::Packet &Packet)
+{
+  const PacketBuffer::PacketHeader &Source = *Packet.Header;
+  const Subscription &Request = Target.Subscribed;
+  PacketBuffer::PacketHeader &Header = Target.Header;
+
+  Header = Source;
+  FDateTime Now = FDateTime::UtcNow();
+  Header.TimestampSent = Now.ToUnixTimestamp() * 1000000000 + Now.GetMillisecond() * 1000000;
+
+  // Region of the images that is sent, clamped to the image
+  const uint32 X = std::min(Request.RoiX, Source.Width);
+  const uint32 Y = std::min(Request.RoiY, Source.Height);
+  const uint32 RoiWidth = Request.RoiWidth > 0 ? std::min(Request.RoiWidth, Source.Width - X) : Source.Width - X;
+  const uint32 RoiHeight = Request.RoiHeight > 0 ? std::min(Request.RoiHeight, Source.Height - Y) : Source.Height - Y;
+  const uint32 Step = std::max<uint32>(Request.Downscale, 1);
+  const uint32 Width = (RoiWidth + Step - 1) / Step;
+  const uint32 Height = (RoiHeight + Step - 1) / Step;
+  const bool Transform = RoiWidth != Source.Width || RoiHeight != Source.Height || Step > 1;
+
+  // Large enough for all images with up to 4 bytes per pixel. It only grows, so it is not cleared for every packet.
+  Target.Cropped = Transform;
+  const uint64 ScratchSize = Transform ? (uint64)Width * Height * 4 * 3 : 0;
+  if(Target.Scratch.size() < ScratchSize)
+  {
+    Target.Scratch.resize(ScratchSize);
+  }
+  uint8 *Scratch = Target.Scratch.data();
+
+  // Only subscribed sections are sent, one after another behind the header
+  uint32 Offset = Header.SizeHeader;
+  Header.NumSections = 0;
+  for(uint32 Index = 0; Index < Source.NumSections; ++Index)
+  {
+    const PacketBuffer::Section &Entry = Source.Sections[Index];
+    const uint32 Channel = PacketBuffer::ChannelOf(Entry.Type);
+    const bool Image = Channel != 0;
+    if(!(Request.Channels & (Image ? Channel : SubscribeAnnotations)))
+    {
+      continue;
+    }
+
+    const uint8 *Data = Packet.Data.data() + Entry.Offset;
+    uint32 Length = Entry.Length;
+    if(Image && Transform && Source.Width * Source.Height > 0)
+    {
+      const uint32 BytesPerPixel = Entry.Length / (Source.Width * Source.Height);
+      CropImage(Data, Source.Width, BytesPerPixel, X, Y, Width, Height, Step, Scratch);
+      Data = Scratch;
+      Length = Width * Height * BytesPerPixel;
+      Scratch += Length;
+    }
+
+    Header.Sections[Header.NumSections].Type = Entry.Type;
+    Header.Sections[Header.NumSections].Offset = Offset;
+    Header.Sections[Header.NumSections].Length = Length;
+    Target.Sources[Header.NumSections++] = Data;
+    Offset += Length;
+  }
+
+  Header.Size = Offset;
+  Header.Width = Width;
+  Header.Height = Height;
+  if(!(Request.Channels & SubscribeAnnotations))
+  {
+    Header.MapEntries = 0;
+    Header.numberOfObjects = 0;
+    Header.numberOfRelations = 0;
+  }
+}
+
+bool TCPServer::Subscribe(Client &Target, const Subscription &Request)
+{
+  if(Request.Magic != SubscriptionMagic)
+  {
+    OUT_WARN(TEXT("Invalid control message from client %s."), *Target.Name);
+    return false;
+  }
+
+  Target.Subscribed = Request;
+  Target.Subscribed.Channels &= SubscribeAll;
+  Target.NextCapture = 0;
+  OUT_INFO(TEXT("Client %s subscribed to channels %u, max rate: %.2f, downscale: %u, region: %u %u %u %u"), *Target.Name, Target.Subscribed.Channels,
+    Request.MaxRate, Request.Downscale, Request.RoiX, Request.RoiY, Request.RoiWidth, Request.RoiHeight);
+
+  UpdateSubscriptions();
+  return true;
+}
+
+void TCPServer::UpdateSubscriptions()
+{
+  uint32 Channels = 0;
+  for(const std::unique_ptr<Client> &Entry : Clients)
+  {
+    if(IsConnected(*Entry))
+    {
+      Channels |= Entry->Subscribed.Channels;
+    }
+  }
+  SubscribedChannels = Channels;
+  UpdateEarliestDue();
+}
+
+void TCPServer::UpdateEarliestDue()
+{
+  uint64 Due = MAX_uint64;
+  for(const std::unique_ptr<Client> &Entry : Clients)
+  {
+    if(IsConnected(*Entry))
+    {
+      Due = std::min(Due, Entry->Subscribed.MaxRate > 0.0f ? Entry->NextCapture : 0);
+    }
+  }
+  EarliestDue = Due == MAX_uint64 ? 0 : Due;
+}
+
+void TCPServer::CloseClients()
+{
+  for(std::unique_ptr<Client> &Entry : Clients)
+  {
+    CloseClient(*Entry);
+  }
+}
+
+bool TCPServer::HasClient() const
+{
+  return NumClients > 0;
+}
+
+uint32 TCPServer::GetSubscribedChannels() const
+{
+  return SubscribedChannels;
+}
+
+uint64 TCPServer::GetNextCaptureDue() const
+{
+  return EarliestDue;
+}
+
+#if PLATFORM_LINUX
+
+// Fills Vectors with the parts of a packet that were not sent yet. The header is taken from Header, the data of its sections from Sources.
+static int32 BuildVectors(const PacketBuffer::PacketHeader &Header, const uint8 *const *Sources, uint32 Skip, const bool HeaderOnly, iovec *Vectors)
+{
+  int32 NumVectors = 0;
+  auto Add = [&](const uint8 *Data, const uint32 Length)
+  {
+    if(Skip >= Length)
+    {
+      Skip -= Length;
+      return;
+    }
+    Vectors[NumVectors].iov_base = const_cast<uint8 *>(Data) + Skip;
+    Vectors[NumVectors++].iov_len = Length - Skip;
+    Skip = 0;
+  };
+
+  Add(reinterpret_cast<const uint8 *>(&Header), Header.SizeHeader);
+  if(!HeaderOnly)
+  {
+    for(uint32 Index = 0; Index < Header.NumSections; ++Index)
+    {
+      Add(Sources[Index], Header.Sections[Index].Length);
+    }
+  }
+  return NumVectors;
+}
+
+// Signals WakeFd, so that the event loop dispatches new packets or notices that it has to stop
+void TCPServer::Wake()
+{
+  // EAGAIN means that the counter is about to overflow, so the loop is woken up anyway
+  const uint64 One = 1;
+  if(write(WakeFd, &One, sizeof(One)) < 0 && errno != EAGAIN)
+  {
+    OUT_WARN(TEXT("Could not wake up the server: %s"), UTF8_TO_TCHAR(strerror(errno)));
+  }
+}
+
 void TCPServer::ServerLoop()
 {
+  epoll_event Events[16];
+
   while(Running)
   {
-    // Check for connection of wait for connection
-    if(!ClientSocket && !ListenConnections())
+    // The timeout is only a safety net, Stop wakes up the loop through WakeFd. While blocked, local clients
+    // are polled, as reading from their socket does not generate an event.
+    const int32 Count = epoll_wait(EpollFd, Events, 16, Blocked ? 1 : 100);
+    if(Count < 0)
+    {
+      if(errno == EINTR)
+      {
+        continue;
+      }
+      OUT_ERROR(TEXT("epoll_wait failed: %s"), UTF8_TO_TCHAR(strerror(errno)));
+      break;
+    }
+
+    for(int32 Index = 0; Index < Count; ++Index)
+    {
+      const epoll_event &Event = Events[Index];
+      if(Event.data.ptr == &ListenFd || Event.data.ptr == &UnixFd)
+      {
+        AcceptConnections(*static_cast<int *>(Event.data.ptr), Event.data.ptr == &UnixFd);
+        continue;
+      }
+      if(Event.data.ptr == &WakeFd)
+      {
+        uint64 Value;
+        while(read(WakeFd, &Value, sizeof(Value)) > 0);
+        DispatchPackets();
+        continue;
+      }
+
+      // Skip clients that were closed while handling earlier events
+      Client &Target = *static_cast<Client *>(Event.data.ptr);
+      if(Target.Fd < 0)
+      {
+        continue;
+      }
+
+      bool Good = true;
+      if(Event.events & EPOLLERR)
+      {
+        // Zero copy completions are signaled as errors as well, so check for a real one
+        int32 Error = 0;
+        socklen_t Length = sizeof(Error);
+        getsockopt(Target.Fd, SOL_SOCKET, SO_ERROR, &Error, &Length);
+        if(Error != 0)
+        {
+          OUT_WARN(TEXT("Socket error on client %s: %s"), *Target.Name, UTF8_TO_TCHAR(strerror(Error)));
+          Good = false;
+        }
+        else
+        {
+          ReapZeroCopy(Target);
+        }
+      }
+      if(Good && (Event.events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)))
+      {
+        ReceiveData(Target);
+        Good = Target.Fd >= 0;
+      }
+      if(Good && ((Event.events & EPOLLOUT) || !Target.Queue.empty()))
+      {
+        Good = SendPackets(Target);
+      }
+      if(!Good)
+      {
+        CloseClient(Target);
+      }
+    }
+
+    // Remove the clients that were closed in this iteration
+    Clients.erase(std::remove_if(Clients.begin(), Clients.end(), [](const std::unique_ptr<Client> &Entry) {return Entry->Fd < 0; }), Clients.end());
+
+    // Sending or closing clients may have made room for the packets left in the ring
+    if(Blocked)
     {
-      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      DispatchPackets();
+    }
+  }
+}
+
+void TCPServer::AcceptConnections(const int Fd, const bool Local)
+{
+  while(true)
+  {
+    //Remote address, unix sockets don't have a meaningful one
+    sockaddr_in RemoteAddress = {};
+    socklen_t AddressLength = sizeof(RemoteAddress);
+
+    // handle incoming connections, the listening socket is non-blocking so this returns once all are accepted
+    const int NewFd = accept4(Fd, Local ? nullptr : reinterpret_cast<sockaddr *>(&RemoteAddress), Local ? nullptr : &AddressLength, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if(NewFd < 0)
+    {
+      if(errno == EINTR)
+      {
+        continue;
+      }
+      return;
+    }
+
+    OUT_INFO(TEXT("New connection."));
+
+    // Every client gets its own queue, existing connections are kept
+    std::unique_ptr<Client> NewClient(new Client());
+    NewClient->Fd = NewFd;
+    NewClient->Local = Local;
+    NewClient->Sent = 0;
+    NewClient->MessageSize = 0;
+    NewClient->SentZeroCopy = false;
+    NewClient->WantsWrite = false;
+    NewClient->Cropped = false;
+    NewClient->ZeroCopySent = 0;
+    NewClient->ZeroCopyCompleted = 0;
+    NewClient->Lag = 0;
+    NewClient->Subscribed = {SubscriptionMagic, SubscribeAll, 0.0f, 1, 0, 0, 0, 0};
+    NewClient->NextCapture = 0;
+    NewClient->NumReceived = 0;
+    NewClient->PacketsSent = 0;
+    NewClient->PacketsDropped = 0;
+    NewClient->QueueDepthSum = 0;
+    NewClient->QueueDepthSamples = 0;
+    NewClient->QueueDepthMax = 0;
+
+    if(Local)
+    {
+      NewClient->Name = FString::Printf(TEXT("%s#%d"), *UnixSocketPath, NewFd);
+    }
+    else
+    {
+      char Name[INET_ADDRSTRLEN] = {};
+      inet_ntop(AF_INET, &RemoteAddress.sin_addr, Name, sizeof(Name));
+      NewClient->Name = FString::Printf(TEXT("%s:%d"), UTF8_TO_TCHAR(Name), ntohs(RemoteAddress.sin_port));
+    }
+    OUT_INFO(TEXT("Client connected: %s"), *NewClient->Name);
+
+    // Local clients only receive small messages with descriptors
+    int NewSize = Buffer->Size;
+    socklen_t OptionLength = sizeof(NewSize);
+    if(!Local)
+    {
+      setsockopt(NewFd, SOL_SOCKET, SO_SNDBUF, &NewSize, sizeof(NewSize));
+      getsockopt(NewFd, SOL_SOCKET, SO_SNDBUF, &NewSize, &OptionLength);
+      if(NewSize < (int32)Buffer->Size)
+      {
+        OUT_WARN(TEXT("Could not set socket buffer size. New size: %d"), NewSize);
+      }
+    }
+
+    const int Enable = 1;
+    if(!Local && ZeroCopyThreshold > 0 && setsockopt(NewFd, SOL_SOCKET, SO_ZEROCOPY, &Enable, sizeof(Enable)) < 0)
+    {
+      OUT_WARN(TEXT("Zero copy sends are not supported by the kernel: %s"), UTF8_TO_TCHAR(strerror(errno)));
+      ZeroCopyThreshold = 0;
+    }
+
+    epoll_event Event = {};
+    Event.events = EPOLLIN | EPOLLRDHUP;
+    Event.data.ptr = NewClient.get();
+    if(epoll_ctl(EpollFd, EPOLL_CTL_ADD, NewFd, &Event) < 0)
+    {
+      OUT_ERROR(TEXT("Could not watch client socket: %s"), UTF8_TO_TCHAR(strerror(errno)));
+      close(NewFd);
       continue;
     }
 
-    // Check if connection is still good
-    if(ClientSocket->GetConnectionState() != ESocketConnectionState::SCS_Connected)
+    Clients.push_back(std::move(NewClient));
+    ++NumClients;
+    UpdateSubscriptions();
+  }
+}
+
+void TCPServer::DispatchPackets()
+{
+  while(true)
+  {
+    // With the Wait policy the packets stay in the ring, so that the camera runs out of slots and slows down
+    Blocked = SlowPolicy == SlowClientPolicy::Wait && std::any_of(Clients.begin(), Clients.end(),
+      [this](const std::unique_ptr<Client> &Entry) {return Entry->Fd >= 0 && IsFull(*Entry); });
+    PacketBuffer::Packet *Packet = Blocked ? nullptr : Buffer->TryAcquireRead();
+    if(!Packet)
     {
-      OUT_WARN(TEXT("Client disconnected"));
-      ClientSocket->Close();
-      ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM)->DestroySocket(ClientSocket);
-      ClientSocket = nullptr;
+      return;
+    }
+
+    // Collect the clients that want this packet. Local clients get their frame right away, so they don't hold a reference.
+    Receivers.clear();
+    int FrameFd = -1;
+    for(std::unique_ptr<Client> &Entry : Clients)
+    {
+      if(Entry->Fd < 0 || !IsDue(*Entry, *Packet->Header))
+      {
+        continue;
+      }
+      if(!Entry->Local)
+      {
+        Receivers.push_back(Entry.get());
+        UpdateCadence(*Entry, *Packet->Header);
+        continue;
+      }
+
+      // Frames are not sent to local clients that did not pick up their previous ones yet. The next frame is due
+      // right away then, so that a full client doesn't lose a whole period.
+      if(IsFull(*Entry))
+      {
+        SkipFrame(*Entry);
+        continue;
+      }
+
+      // The frame is copied into a memfd once and the descriptor is passed to all local clients
+      if(FrameFd < 0 && (FrameFd = CreateFrame(*Packet)) < 0)
+      {
+        continue;
+      }
+      if(SendFrame(*Entry, FrameFd, Packet->Header->Size))
+      {
+        UpdateCadence(*Entry, *Packet->Header);
+      }
+    }
+    if(FrameFd >= 0)
+    {
+      close(FrameFd);
+    }
+    UpdateEarliestDue();
+
+    if(Receivers.empty())
+    {
+      Buffer->ReleaseRead(Packet);
+      continue;
+    }
+
+    // Each receiver holds its own reference, the slot is reused once the last one is done
+    Buffer->ShareRead(Packet, Receivers.size() - 1);
+    for(Client *Target : Receivers)
+    {
+      EnqueuePacket(*Target, Packet);
+    }
+    if(SlowPolicy != SlowClientPolicy::Wait)
+    {
+      EvictPackets();
+    }
+  }
+}
+
+void TCPServer::EvictPackets()
+{
+  // The queue limit applies per client, so several slow clients together could still pin every slot of the ring
+  while(MaxPinnedSlots > 0 && Buffer->GetNumReading() > MaxPinnedSlots)
+  {
+    // Oldest packet that is waiting in a queue, packets being sent or pinned by zero copy sends can't be dropped
+    PacketBuffer::Packet *Oldest = nullptr;
+    for(std::unique_ptr<Client> &Entry : Clients)
+    {
+      for(auto Queued = Entry->Queue.begin() + (Entry->Sent > 0 ? 1 : 0); Queued != Entry->Queue.end(); ++Queued)
+      {
+        if(!Oldest || (*Queued)->Sequence < Oldest->Sequence)
+        {
+          Oldest = *Queued;
+        }
+      }
+    }
+    if(!Oldest)
+    {
+      return;
+    }
+
+    // Every client waiting for it drops it, so that the slot is actually freed
+    for(std::unique_ptr<Client> &Entry : Clients)
+    {
+      const auto Waiting = Entry->Queue.begin() + (Entry->Sent > 0 ? 1 : 0);
+      const auto Queued = std::find(Waiting, Entry->Queue.end(), Oldest);
+      if(Queued == Entry->Queue.end())
+      {
+        continue;
+      }
+      Entry->Queue.erase(Queued);
+      Buffer->ReleaseRead(Oldest);
+      SkipFrame(*Entry);
+    }
+  }
+}
+
+int TCPServer::CreateFrame(const PacketBuffer::Packet &Packet)
+{
+  MEASURE_TIME("Creating memfd frame");
+  const int FrameFd = syscall(SYS_memfd_create, "AutonomousRGBDCamera", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if(FrameFd < 0)
+  {
+    OUT_ERROR(TEXT("memfd_create failed: %s"), UTF8_TO_TCHAR(strerror(errno)));
+    return -1;
+  }
+
+  // The header is written from a copy with the time the frame was handed over
+  PacketBuffer::PacketHeader Header = *Packet.Header;
+  FDateTime Now = FDateTime::UtcNow();
+  Header.TimestampSent = Now.ToUnixTimestamp() * 1000000000 + Now.GetMillisecond() * 1000000;
+
+  iovec Vectors[2];
+  Vectors[0].iov_base = &Header;
+  Vectors[0].iov_len = Header.SizeHeader;
+  Vectors[1].iov_base = const_cast<uint8 *>(Packet.Data.data()) + Header.SizeHeader;
+  Vectors[1].iov_len = Header.Size - Header.SizeHeader;
+
+  bool Good = ftruncate(FrameFd, Header.Size) == 0;
+  uint32 Written = 0;
+  while(Good && Written < Header.Size)
+  {
+    // Continue short writes at the position where they stopped
+    iovec Remaining[2];
+    const int32 NumVectors = Written < Header.SizeHeader ? 2 : 1;
+    const uint32 Skip = Written < Header.SizeHeader ? Written : Written - Header.SizeHeader;
+    Remaining[0].iov_base = static_cast<uint8 *>(Vectors[2 - NumVectors].iov_base) + Skip;
+    Remaining[0].iov_len = Vectors[2 - NumVectors].iov_len - Skip;
+    Remaining[1] = Vectors[1];
+
+    const ssize_t Result = pwritev(FrameFd, Remaining, NumVectors, Written);
+    Good = Result > 0 || (Result < 0 && errno == EINTR);
+    Written += std::max<ssize_t>(Result, 0);
+  }
+
+  // Sealed frames can be mapped by clients without having to worry about them changing
+  if(!Good || fcntl(FrameFd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0)
+  {
+    OUT_ERROR(TEXT("Could not write memfd frame: %s"), UTF8_TO_TCHAR(strerror(errno)));
+    close(FrameFd);
+    return -1;
+  }
+  return FrameFd;
+}
+
+bool TCPServer::SendFrame(Client &Target, const int FrameFd, const uint32 Size)
+{
+  // The message carries the packet size, the descriptor is attached as ancillary data
+  uint32 Data = Size;
+  iovec Vector;
+  Vector.iov_base = &Data;
+  Vector.iov_len = sizeof(Data);
+
+  union
+  {
+    cmsghdr Header;
+    uint8 Buffer[CMSG_SPACE(sizeof(int))];
+  } Control = {};
+
+  msghdr Message = {};
+  Message.msg_iov = &Vector;
+  Message.msg_iovlen = 1;
+  Message.msg_control = Control.Buffer;
+  Message.msg_controllen = sizeof(Control.Buffer);
+
+  cmsghdr *Cmsg = CMSG_FIRSTHDR(&Message);
+  Cmsg->cmsg_level = SOL_SOCKET;
+  Cmsg->cmsg_type = SCM_RIGHTS;
+  Cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(Cmsg), &FrameFd, sizeof(int));
+
+  // The growth of the send queue by the first frame tells how much space a frame message takes
+  int Before = 0;
+  if(Target.MessageSize == 0 && ioctl(Target.Fd, SIOCOUTQ, &Before) < 0)
+  {
+    Before = -1;
+  }
+
+  ssize_t Sent;
+  do
+  {
+    Sent = sendmsg(Target.Fd, &Message, MSG_NOSIGNAL | MSG_DONTWAIT);
+  }
+  while(Sent < 0 && errno == EINTR);
+
+  if(Sent == sizeof(Data))
+  {
+    int After = 0;
+    if(Target.MessageSize == 0 && Before >= 0 && ioctl(Target.Fd, SIOCOUTQ, &After) == 0 && After > Before)
+    {
+      Target.MessageSize = After - Before;
+    }
+    ++Target.PacketsSent;
+    Target.Lag = 0;
+    SampleQueueDepth(Target, GetQueueDepth(Target));
+    return true;
+  }
+
+  // A full socket means that the client did not pick up its previous frames yet
+  if(Sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+  {
+    SkipFrame(Target);
+    return false;
+  }
+
+  // The message is tiny, so a partial send is treated like an error as well
+  OUT_WARN(TEXT("Sending frame to %s failed: %s"), *Target.Name, Sent < 0 ? UTF8_TO_TCHAR(strerror(errno)) : TEXT("partial send"));
+  CloseClient(Target);
+  return false;
+}
+
+uint32 TCPServer::GetQueueDepth(const Client &Target) const
+{
+  // Packets still pinned by zero copy sends occupy ring slots as well
+  if(!Target.Local)
+  {
+    return Target.Queue.size() + Target.ZeroCopyPending.size();
+  }
+
+  // Frames of local clients wait in the socket until they are received
+  int Queued = 0;
+  if(Target.MessageSize == 0 || ioctl(Target.Fd, SIOCOUTQ, &Queued) < 0)
+  {
+    return 0;
+  }
+  return (Queued + Target.MessageSize - 1) / Target.MessageSize;
+}
+
+bool TCPServer::IsFull(const Client &Target) const
+{
+  return GetQueueDepth(Target) >= std::max<uint32>(QueueLimit, 1);
+}
+
+void TCPServer::SampleQueueDepth(Client &Target, const uint32 Depth)
+{
+  Target.QueueDepthSum += Depth;
+  ++Target.QueueDepthSamples;
+  Target.QueueDepthMax = std::max(Target.QueueDepthMax, Depth);
+}
+
+void TCPServer::EnqueuePacket(Client &Target, PacketBuffer::Packet *Packet)
+{
+  if(IsFull(Target))
+  {
+    if(!SkipFrame(Target))
+    {
+      Buffer->ReleaseRead(Packet);
+      return;
+    }
+
+    // Drop the oldest packet that is not being sent yet, or the new one if all of them are in flight
+    const auto Oldest = Target.Queue.begin() + (Target.Sent > 0 ? 1 : 0);
+    if(Oldest == Target.Queue.end())
+    {
+      Buffer->ReleaseRead(Packet);
+      return;
+    }
+    Buffer->ReleaseRead(*Oldest);
+    Target.Queue.erase(Oldest);
+  }
+  else
+  {
+    Target.Lag = 0;
+  }
+
+  Target.Queue.push_back(Packet);
+  SampleQueueDepth(Target, Target.Queue.size());
+
+  if(!SendPackets(Target))
+  {
+    CloseClient(Target);
+  }
+}
+
+// Counts a frame the client did not get and applies the slow client policy, returns false if the client was closed
+bool TCPServer::SkipFrame(Client &Target)
+{
+  ++Target.PacketsDropped;
+  ++Target.Lag;
+  if(SlowPolicy == SlowClientPolicy::Disconnect && Target.Lag >= DisconnectLag)
+  {
+    OUT_WARN(TEXT("Client %s fell behind for %u frames, disconnecting."), *Target.Name, Target.Lag);
+    CloseClient(Target);
+    return false;
+  }
+  return true;
+}
+
+bool TCPServer::SendPackets(Client &Target)
+{
+  while(!Target.Queue.empty())
+  {
+    PacketBuffer::Packet *Packet = Target.Queue.front();
+    if(Target.Sent == 0)
+    {
+      // Each client sends its own copy of the header with the time it started sending
+      PrepareHeader(Target, *Packet);
+      Target.SentZeroCopy = false;
+    }
+
+    // Zero copy only pays off for large packets. The header and the scratch images live in the client and are
+    // overwritten by the next packet, so they are always copied.
+    const bool Large = ZeroCopyThreshold > 0 && Target.Header.Size >= ZeroCopyThreshold && !Target.Cropped;
+    const bool HeaderOnly = Large && Target.Sent < Target.Header.SizeHeader;
+    const bool ZeroCopy = Large && !HeaderOnly;
+
+    iovec Vectors[1 + PacketBuffer::SectionTypes];
+    msghdr Message = {};
+    Message.msg_iov = Vectors;
+    Message.msg_iovlen = BuildVectors(Target.Header, Target.Sources, Target.Sent, HeaderOnly, Vectors);
+
+    const ssize_t Sent = sendmsg(Target.Fd, &Message, MSG_NOSIGNAL | MSG_DONTWAIT | (ZeroCopy ? MSG_ZEROCOPY : 0));
+    if(Sent < 0)
+    {
+      if(errno == EINTR)
+      {
+        continue;
+      }
+      // Continue where it stopped once the socket is writable again or zero copy completions freed memory
+      if(errno == EAGAIN || errno == EWOULDBLOCK || (ZeroCopy && errno == ENOBUFS))
+      {
+        SetWantsWrite(Target, true);
+        return true;
+      }
+      OUT_WARN(TEXT("sendmsg failed: %s"), UTF8_TO_TCHAR(strerror(errno)));
+      return false;
+    }
+
+    if(ZeroCopy)
+    {
+      ++Target.ZeroCopySent;
+      Target.SentZeroCopy = true;
+    }
+
+    Target.Sent += Sent;
+    if(Target.Sent >= Target.Header.Size)
+    {
+      Target.Queue.pop_front();
+      Target.Sent = 0;
+      ++Target.PacketsSent;
+
+      // With zero copy the kernel still reads from the packet, it is given back once the completion arrived
+      if(Target.SentZeroCopy)
+      {
+        Target.ZeroCopyPending.push_back(std::make_pair(Packet, Target.ZeroCopySent));
+      }
+      else
+      {
+        Buffer->ReleaseRead(Packet);
+      }
+    }
+  }
+
+  SetWantsWrite(Target, false);
+  return true;
+}
+
+void TCPServer::ReceiveData(Client &Target)
+{
+  // Clients only send subscriptions, which are collected until they are complete
+  while(true)
+  {
+    const ssize_t Received = recv(Target.Fd, Target.Received + Target.NumReceived, sizeof(Target.Received) - Target.NumReceived, MSG_DONTWAIT);
+    if(Received > 0)
+    {
+      Target.NumReceived += Received;
+      if(Target.NumReceived == sizeof(Subscription))
+      {
+        Subscription Request;
+        memcpy(&Request, Target.Received, sizeof(Request));
+        Target.NumReceived = 0;
+        if(!Subscribe(Target, Request))
+        {
+          CloseClient(Target);
+          return;
+        }
+      }
       continue;
     }
+    if(Received == 0)
+    {
+      OUT_WARN(TEXT("Client disconnected"));
+      CloseClient(Target);
+    }
+    else if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+    {
+      OUT_WARN(TEXT("recv failed: %s"), UTF8_TO_TCHAR(strerror(errno)));
+      CloseClient(Target);
+    }
+    return;
+  }
+}
 
-    // Everything is fine, wait for buffer to be readable
-    Buffer->StartReading();
-    if(!Running)
+void TCPServer::ReapZeroCopy(Client &Target)
+{
+  // Completions are reported on the error queue of the socket as ranges of sendmsg calls
+  while(!Target.ZeroCopyPending.empty())
+  {
+    uint8 Control[128];
+    msghdr Message = {};
+    Message.msg_control = Control;
+    Message.msg_controllen = sizeof(Control);
+    if(recvmsg(Target.Fd, &Message, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
     {
-      Buffer->DoneReading();
       break;
     }
 
-    MEASURE_TIME("Transmitting data");
-    int32 BytesSent = 0;
-    OUT_INFO(TEXT("sending images."));
+    for(cmsghdr *Cmsg = CMSG_FIRSTHDR(&Message); Cmsg; Cmsg = CMSG_NXTHDR(&Message, Cmsg))
+    {
+      const sock_extended_err *Error = reinterpret_cast<const sock_extended_err *>(CMSG_DATA(Cmsg));
+      if(Cmsg->cmsg_level == SOL_IP && Cmsg->cmsg_type == IP_RECVERR && Error->ee_errno == 0 && Error->ee_origin == SO_EE_ORIGIN_ZEROCOPY)
+      {
+        // ee_data is the last completed call, counting from 0
+        if(static_cast<int32>(Error->ee_data + 1 - Target.ZeroCopyCompleted) > 0)
+        {
+          Target.ZeroCopyCompleted = Error->ee_data + 1;
+        }
+      }
+    }
+  }
+
+  while(!Target.ZeroCopyPending.empty() && static_cast<int32>(Target.ZeroCopyCompleted - Target.ZeroCopyPending.front().second) >= 0)
+  {
+    Buffer->ReleaseRead(Target.ZeroCopyPending.front().first);
+    Target.ZeroCopyPending.pop_front();
+  }
+}
+
+void TCPServer::SetWantsWrite(Client &Target, const bool WantsWrite)
+{
+  if(Target.WantsWrite == WantsWrite)
+  {
+    return;
+  }
+
+  epoll_event Event = {};
+  Event.events = EPOLLIN | EPOLLRDHUP | (WantsWrite ? EPOLLOUT : 0);
+  Event.data.ptr = &Target;
+  epoll_ctl(EpollFd, EPOLL_CTL_MOD, Target.Fd, &Event);
+  Target.WantsWrite = WantsWrite;
+}
+
+void TCPServer::CloseClient(Client &Target)
+{
+  if(Target.Fd < 0)
+  {
+    return;
+  }
+
+  epoll_ctl(EpollFd, EPOLL_CTL_DEL, Target.Fd, nullptr);
+  close(Target.Fd);
+  Target.Fd = -1;
+  --NumClients;
+
+  OUT_INFO(TEXT("Closed client %s. Packets sent: %llu, dropped: %llu, queue depth avg: %.2f, max: %u"), *Target.Name, Target.PacketsSent,
+    Target.PacketsDropped, Target.QueueDepthSamples > 0 ? Target.QueueDepthSum / (double)Target.QueueDepthSamples : 0.0, Target.QueueDepthMax);
+
+  // The socket is gone, so neither the queue nor the kernel needs the packets anymore
+  for(PacketBuffer::Packet *Packet : Target.Queue)
+  {
+    Buffer->ReleaseRead(Packet);
+  }
+  Target.Queue.clear();
+  for(const auto &Pending : Target.ZeroCopyPending)
+  {
+    Buffer->ReleaseRead(Pending.first);
+  }
+  Target.ZeroCopyPending.clear();
+
+  UpdateSubscriptions();
+}
+
+bool TCPServer::IsConnected(const Client &Target)
+{
+  return Target.Fd >= 0;
+}
+
+#else
+
+void TCPServer::ServerLoop()
+{
+  while(Running)
+  {
+    // New clients are accepted between packets, existing connections are kept
+    AcceptConnections();
 
-    // Send data to client
-    FDateTime Now = FDateTime::UtcNow();
-    Buffer->HeaderRead->TimestampSent = Now.ToUnixTimestamp() * 1000000000 + Now.GetMillisecond() * 1000000;
-    if(!ClientSocket->Send(Buffer->Read, Buffer->HeaderRead->Size, BytesSent) || BytesSent != Buffer->HeaderRead->Size)
+    // Check if connections are still good and pick up subscriptions
+    for(std::unique_ptr<Client> &Entry : Clients)
     {
-      OUT_WARN(TEXT("BytesSent: %d"), BytesSent);
-      OUT_WARN(TEXT("Buffer->HeaderRead->Size: %d"), Buffer->HeaderRead->Size);
+      ReceiveData(*Entry);
+    }
+    Clients.erase(std::remove_if(Clients.begin(), Clients.end(), [](const std::unique_ptr<Client> &Entry) {return !IsConnected(*Entry); }), Clients.end());
 
-      OUT_WARN(TEXT("Not all bytes sent. Client disconnected."));
-      ClientSocket->Close();
-      ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM)->DestroySocket(ClientSocket);
-      ClientSocket = nullptr;
+    // Packets are only taken while someone receives them. The ring is polled, so that new clients don't wait for the next packet.
+    PacketBuffer::Packet *Packet = Clients.empty() ? nullptr : Buffer->TryAcquireRead();
+    if(!Packet)
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(Clients.empty() ? 10 : 1));
+      continue;
     }
-    OUT_WARN(TEXT("BytesSent: %d"), BytesSent);
-    
-    // Release buffer
-    Buffer->DoneReading();
+
+    MEASURE_TIME("Transmitting data");
+
+    // Send data to the clients that want this packet
+    for(std::unique_ptr<Client> &Entry : Clients)
+    {
+      if(IsConnected(*Entry) && IsDue(*Entry, *Packet->Header) && SendPacket(*Entry, *Packet))
+      {
+        UpdateCadence(*Entry, *Packet->Header);
+      }
+    }
+    UpdateEarliestDue();
+
+    // Give the packet back to the ring
+    Buffer->ReleaseRead(Packet);
   }
 }
 
-bool TCPServer::ListenConnections()
+void TCPServer::AcceptConnections()
 {
   if(!ListenSocket)
   {
     OUT_ERROR(TEXT("No socket for listening."));
-    return false;
+    return;
   }
 
-  //Remote address
-  TSharedRef<FInternetAddr> RemoteAddress = ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM)->CreateInternetAddr();
-  bool Pending = false;
-
   // handle incoming connections
-  if(ListenSocket->HasPendingConnection(Pending) && Pending)
+  bool Pending = false;
+  while(ListenSocket->HasPendingConnection(Pending) && Pending)
   {
     OUT_INFO(TEXT("New connection."));
 
-    // Destroy previous connection if available
-    if(ClientSocket)
+    //Remote address
+    TSharedRef<FInternetAddr> RemoteAddress = ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM)->CreateInternetAddr();
+    FSocket *NewSocket = ListenSocket->Accept(*RemoteAddress, TEXT("Received socket connection"));
+    if(!NewSocket)
     {
-      ClientSocket->Close();
-      ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM)->DestroySocket(ClientSocket);
-      ClientSocket = nullptr;
+      return;
     }
 
-    // Set new connection
-    ClientSocket = ListenSocket->Accept(*RemoteAddress, TEXT("Received socket connection"));
+    std::unique_ptr<Client> NewClient(new Client());
+    NewClient->Socket = NewSocket;
+    NewClient->Name = RemoteAddress->ToString(true);
+    NewClient->Cropped = false;
+    NewClient->Subscribed = {SubscriptionMagic, SubscribeAll, 0.0f, 1, 0, 0, 0, 0};
+    NewClient->NextCapture = 0;
+    NewClient->NumReceived = 0;
+    OUT_INFO(TEXT("Client connected: %s"), *NewClient->Name);
 
-    if(ClientSocket)
+    int32 NewSize = 0;
+    NewSocket->SetSendBufferSize(Buffer->Size, NewSize);
+    if(NewSize < (int32)Buffer->Size)
     {
-      OUT_INFO(TEXT("Client connected: %s"), *RemoteAddress->ToString(true));
-      if(Buffer.IsValid())
+      OUT_WARN(TEXT("Could not set socket buffer size. New size: %d"), NewSize);
+    }
+
+    Clients.push_back(std::move(NewClient));
+    ++NumClients;
+    UpdateSubscriptions();
+  }
+}
+
+bool TCPServer::SendPacket(Client &Target, const PacketBuffer::Packet &Packet)
+{
+  // The header is followed by the data of the subscribed sections, as on Linux
+  PrepareHeader(Target, Packet);
+  uint32 Sent = 0;
+  auto Send = [&](const uint8 *Data, const uint32 Length)
+  {
+    // Short writes are continued, only a failing send means that the client is gone
+    for(uint32 Done = 0; Done < Length;)
+    {
+      int32 BytesSent = 0;
+      if(!Target.Socket->Send(Data + Done, Length - Done, BytesSent))
       {
-        int32 NewSize = 0;
-        ClientSocket->SetSendBufferSize(Buffer->Size, NewSize);
-        if(NewSize < (int32)Buffer->Size)
-        {
-          OUT_WARN(TEXT("Could not set socket buffer size. New size: %d"), NewSize);
-        }
+        return false;
       }
-      return true;
+      Done += BytesSent;
+      Sent += BytesSent;
     }
+    return true;
+  };
+
+  bool Good = Send(reinterpret_cast<const uint8 *>(&Target.Header), Target.Header.SizeHeader);
+  for(uint32 Index = 0; Good && Index < Target.Header.NumSections; ++Index)
+  {
+    Good = Send(Target.Sources[Index], Target.Header.Sections[Index].Length);
   }
-  return false;
+  if(!Good)
+  {
+    OUT_WARN(TEXT("Sent %u of %u bytes. Client %s disconnected."), Sent, Target.Header.Size, *Target.Name);
+    CloseClient(Target);
+  }
+  return Good;
 }
 
-bool TCPServer::HasClient() const
+void TCPServer::ReceiveData(Client &Target)
 {
-  return ClientSocket != nullptr;
-}
\ No newline at end of file
+  if(Target.Socket->GetConnectionState() != ESocketConnectionState::SCS_Connected)
+  {
+    OUT_WARN(TEXT("Client disconnected"));
+    CloseClient(Target);
+    return;
+  }
+
+  // Clients only send subscriptions, which are collected until they are complete
+  uint32 Pending = 0;
+  while(Target.Socket->HasPendingData(Pending) && Pending > 0)
+  {
+    int32 Received = 0;
+    if(!Target.Socket->Recv(Target.Received + Target.NumReceived, std::min<uint32>(Pending, sizeof(Target.Received) - Target.NumReceived), Received) || Received <= 0)
+    {
+      OUT_WARN(TEXT("Client disconnected"));
+      CloseClient(Target);
+      return;
+    }
+
+    Target.NumReceived += Received;
+    if(Target.NumReceived == sizeof(Subscription))
+    {
+      Subscription Request;
+      memcpy(&Request, Target.Received, sizeof(Request));
+      Target.NumReceived = 0;
+      if(!Subscribe(Target, Request))
+      {
+        CloseClient(Target);
+        return;
+      }
+    }
+  }
+}
+
+void TCPServer::CloseClient(Client &Target)
+{
+  if(!Target.Socket)
+  {
+    return;
+  }
+
+  Target.Socket->Close();
+  ISocketSubsystem::Get(PLATFORM_SOCKETSUBSYSTEM)->DestroySocket(Target.Socket);
+  Target.Socket = nullptr;
+  --NumClients;
+  OUT_INFO(TEXT("Closed client %s."), *Target.Name);
+
+  UpdateSubscriptions();
+}
+
+bool TCPServer::IsConnected(const Client &Target)
+{
+  return Target.Socket != nullptr;
+}
+
+#endif
@@ -0,0 +1,234 @@
+// Copyright 2017, Institute for Artificial Intelligence - University of Bremen
+
+#include "SharedMemoryServer.h"
+#include "StopTime.h"
+
+#if PLATFORM_LINUX
+#include <string.h>
+#include <errno.h>
+#endif
+
+SharedMemoryServer::SharedMemoryServer() : Running(false), NextSequence(1), NumSlots(4), PacketsPublished(0), PacketsTooLarge(0)
+{
+#if PLATFORM_LINUX
+  Ring = nullptr;
+  MappedSize = 0;
+#endif
+}
+
+SharedMemoryServer::~SharedMemoryServer()
+{
+  if(Running)
+  {
+    Stop();
+  }
+}
+
+#if PLATFORM_LINUX
+
+void SharedMemoryServer::Start(const FString &_Name)
+{
+  OUT_INFO(TEXT("Starting shared memory server."));
+
+  // Check if buffer is set
+  if(!Buffer.IsValid())
+  {
+    OUT_ERROR(TEXT("No package buffer set."));
+    return;
+  }
+
+  Name = _Name.StartsWith(TEXT("/")) ? _Name : TEXT("/") + _Name;
+
+  // Annotations are appended behind the images, so leave the same headroom as the packet buffer
+  if(!Create(Buffer->Size + 1024 * 1024, 0))
+  {
+    return;
+  }
+
+  Running = true;
+  Thread = std::thread(&SharedMemoryServer::ServerLoop, this);
+}
+
+void SharedMemoryServer::Stop()
+{
+  if(Running)
+  {
+    // Release buffer and wait for thread to stop
+    Running = false;
+    Buffer->Release();
+    Thread.join();
+  }
+
+  std::lock_guard<std::mutex> Lock(LockRings);
+  if(Ring)
+  {
+    // Wake up waiting readers so that they notice the closed ring
+    Ring->Closed.store(1);
+    SharedMemoryRing::WakeReaders(Ring);
+
+    munmap(Ring, MappedSize);
+    shm_unlink(TCHAR_TO_UTF8(*Name));
+    Ring = nullptr;
+  }
+  for(const auto &Old : Retired)
+  {
+    munmap(Old.first, Old.second);
+  }
+  Retired.clear();
+
+  OUT_INFO(TEXT("Shared memory server stopped. Packets published: %llu, too large: %llu"), PacketsPublished, PacketsTooLarge);
+}
+
+bool SharedMemoryServer::Create(const uint32 SlotSize, const uint32 Generation)
+{
+  uint64_t SlotStride, OffsetSlots;
+  const uint64 Size = SharedMemoryRing::MemorySize(FMath::Max<uint32>(NumSlots, 2), SlotSize, SlotStride, OffsetSlots);
+
+  // A ring left behind by a crashed process or replaced by this one is unlinked, attached readers keep their old mapping
+  shm_unlink(TCHAR_TO_UTF8(*Name));
+  const int Fd = shm_open(TCHAR_TO_UTF8(*Name), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if(Fd < 0 || ftruncate(Fd, Size) < 0)
+  {
+    OUT_ERROR(TEXT("Could not create shared memory %s: %s"), *Name, UTF8_TO_TCHAR(strerror(errno)));
+    if(Fd >= 0)
+    {
+      close(Fd);
+      shm_unlink(TCHAR_TO_UTF8(*Name));
+    }
+    return false;
+  }
+
+  void *Memory = mmap(nullptr, Size, PROT_READ | PROT_WRITE, MAP_SHARED, Fd, 0);
+  close(Fd);
+  if(Memory == MAP_FAILED)
+  {
+    OUT_ERROR(TEXT("Could not map shared memory %s: %s"), *Name, UTF8_TO_TCHAR(strerror(errno)));
+    shm_unlink(TCHAR_TO_UTF8(*Name));
+    return false;
+  }
+
+  // The memory is zero filled by ftruncate, so only the constants have to be set
+  SharedMemoryRing::RingHeader *NewRing = static_cast<SharedMemoryRing::RingHeader *>(Memory);
+  NewRing->NumSlots = FMath::Max<uint32>(NumSlots, 2);
+  NewRing->SlotSize = SlotSize;
+  NewRing->SlotStride = SlotStride;
+  NewRing->OffsetSlots = OffsetSlots;
+  NewRing->Generation = Generation;
+  NewRing->Version = SharedMemoryRing::Version;
+  std::atomic_thread_fence(std::memory_order_release);
+  NewRing->Magic = SharedMemoryRing::Magic;
+
+  SharedMemoryRing::RingHeader *OldRing = nullptr;
+  {
+    std::lock_guard<std::mutex> Lock(LockRings);
+    if(Ring)
+    {
+      OldRing = Ring;
+      Retired.push_back(std::make_pair(Ring, MappedSize));
+    }
+    Ring = NewRing;
+    MappedSize = Size;
+  }
+  NextSequence = 1;
+  OUT_INFO(TEXT("Shared memory created: %s (%llu bytes, slots of %u bytes)"), *Name, Size, SlotSize);
+
+  // Readers of the old ring notice that it is closed and open the new one, which is already in place
+  if(OldRing)
+  {
+    OldRing->Closed.store(1);
+    SharedMemoryRing::WakeReaders(OldRing);
+  }
+  return true;
+}
+
+void SharedMemoryServer::ServerLoop()
+{
+  while(Running)
+  {
+    PacketBuffer::Packet *Packet = Buffer->AcquireRead();
+    if(!Packet || !Running)
+    {
+      break;
+    }
+
+    Publish(*Packet);
+
+    // Give the packet back to the ring
+    Buffer->ReleaseRead(Packet);
+  }
+}
+
+void SharedMemoryServer::Publish(const PacketBuffer::Packet &Packet)
+{
+  MEASURE_TIME("Publishing to shared memory");
+  const uint32 Size = Packet.Header->Size;
+  if(Size > Ring->SlotSize)
+  {
+    // The annotations outgrew the headroom, so the slots are doubled at least to avoid recreating the ring for every packet
+    const uint32 SlotSize = (uint32)FMath::Min<uint64>(FMath::Max<uint64>(Ring->SlotSize * 2ull, Size), MAX_uint32);
+    OUT_INFO(TEXT("Packet of %u bytes does not fit into a slot of %u bytes, growing the slots to %u bytes."), Size, Ring->SlotSize, SlotSize);
+    if(!Create(SlotSize, Ring->Generation + 1))
+    {
+      ++PacketsTooLarge;
+      return;
+    }
+  }
+
+  const uint64 Sequence = NextSequence++;
+  SharedMemoryRing::SlotHeader *Slot = SharedMemoryRing::GetSlot(Ring, Sequence);
+  uint8 *Data = SharedMemoryRing::GetData(Slot);
+
+  // Mark the slot as being written, readers still processing the previous packet in it will notice
+  Slot->Sequence.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  FMemory::Memcpy(Data, Packet.Data.data(), Size);
+  FDateTime Now = FDateTime::UtcNow();
+  reinterpret_cast<PacketBuffer::PacketHeader *>(Data)->TimestampSent = Now.ToUnixTimestamp() * 1000000000 + Now.GetMillisecond() * 1000000;
+  Slot->Size = Size;
+
+  Slot->Sequence.store(Sequence, std::memory_order_release);
+  Ring->Published.store(Sequence, std::memory_order_release);
+  SharedMemoryRing::WakeReaders(Ring);
+  ++PacketsPublished;
+}
+
+bool SharedMemoryServer::HasClient() const
+{
+  // Readers of replaced rings are about to open the current one
+  std::lock_guard<std::mutex> Lock(LockRings);
+  if(Ring && Ring->Readers.load() > 0)
+  {
+    return true;
+  }
+  for(const auto &Old : Retired)
+  {
+    if(Old.first->Readers.load() > 0)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+#else
+
+void SharedMemoryServer::Start(const FString &_Name)
+{
+  OUT_ERROR(TEXT("Shared memory transport is only available on Linux."));
+}
+
+void SharedMemoryServer::Stop()
+{
+}
+
+void SharedMemoryServer::ServerLoop()
+{
+}
+
+bool SharedMemoryServer::HasClient() const
+{
+  return false;
+}
+
+#endif
@@ -0,0 +1,206 @@
+// Copyright 2017, Institute for Artificial Intelligence - University of Bremen
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+#include "ImageConversion.h"
+#include <limits>
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace
+{
+  // Elements behind the output that must not be written, they catch kernels overrunning their range
+  const uint32 GuardElements = 64;
+
+  // Every length up to a few vectors of the widest kernel, so that all tail lengths are covered, and a typical image row
+  TArray<uint32> GetTestLengths()
+  {
+    TArray<uint32> Lengths;
+    for(uint32 Count = 0; Count <= 67; ++Count)
+    {
+      Lengths.Add(Count);
+    }
+    Lengths.Add(1927);
+    return Lengths;
+  }
+
+  // Runs a kernel and the scalar reference on the given lengths, also from an unaligned source, and compares the bytes.
+  // Kernels write Outputs elements per pixel.
+  template<typename SourceType, typename TargetType>
+  void CompareKernel(FAutomationTestBase &Test, const FString &What, void (*Reference)(const SourceType *, TargetType *, const uint32),
+    void (*Kernel)(const SourceType *, TargetType *, const uint32), const TArray<SourceType> &Source, const TArray<uint32> &Lengths,
+    const uint32 Outputs = 1)
+  {
+    if(!Kernel)
+    {
+      return;
+    }
+
+    TArray<TargetType> Expected, Actual;
+    for(const uint32 Count : Lengths)
+    {
+      for(uint32 Offset = 0; Offset < 2 && Offset + Count <= (uint32)Source.Num(); ++Offset)
+      {
+        Expected.SetNumUninitialized(Count * Outputs + GuardElements);
+        Actual.SetNumUninitialized(Count * Outputs + GuardElements);
+        FMemory::Memset(Expected.GetData(), 0xCD, Expected.Num() * sizeof(TargetType));
+        FMemory::Memset(Actual.GetData(), 0xCD, Actual.Num() * sizeof(TargetType));
+
+        Reference(Source.GetData() + Offset, Expected.GetData(), Count);
+        Kernel(Source.GetData() + Offset, Actual.GetData(), Count);
+        if(FMemory::Memcmp(Expected.GetData(), Actual.GetData(), Expected.Num() * sizeof(TargetType)) != 0)
+        {
+          Test.AddError(FString::Printf(TEXT("%s differs from the scalar kernel for %u pixels at offset %u."), *What, Count, Offset));
+          return;
+        }
+      }
+    }
+  }
+
+  // Runs a kernel on a whole image and returns the memory throughput (read and written) in GB/s
+  template<typename SourceType, typename TargetType>
+  double MeasureKernel(void (*Kernel)(const SourceType *, TargetType *, const uint32), const TArray<SourceType> &Source, TArray<TargetType> &Target,
+    const uint32 Outputs = 1)
+  {
+    Target.SetNumUninitialized(Source.Num() * Outputs);
+    Kernel(Source.GetData(), Target.GetData(), Source.Num());
+
+    const int32 Iterations = 50;
+    const double Start = FPlatformTime::Seconds();
+    for(int32 Iteration = 0; Iteration < Iterations; ++Iteration)
+    {
+      Kernel(Source.GetData(), Target.GetData(), Source.Num());
+    }
+    const double Seconds = FPlatformTime::Seconds() - Start;
+    return Source.Num() * (double)(sizeof(SourceType) + sizeof(TargetType) * Outputs) * Iterations / (Seconds * 1e9);
+  }
+
+  // Compares the kernels of every supported set with the scalar ones, arrays that are too short for a length are skipped
+  void CompareKernelSets(FAutomationTestBase &Test, const TArray<FColor> &Color, const TArray<FFloat16Color> &Depth, const TArray<float> &Meters,
+    const TArray<uint32> &Lengths)
+  {
+    const TArray<ImageConversion::KernelSet> Sets = ImageConversion::GetSupportedKernels();
+    const ImageConversion::KernelSet &Scalar = Sets[0];
+    for(int32 Index = 1; Index < Sets.Num(); ++Index)
+    {
+      const ImageConversion::KernelSet &Set = Sets[Index];
+      Test.AddInfo(FString::Printf(TEXT("Checking %s kernels."), Set.Name));
+      CompareKernel(Test, FString::Printf(TEXT("%s ColorToBGR"), Set.Name), Scalar.ColorToBGR, Set.ColorToBGR, Color, Lengths, 3);
+      CompareKernel(Test, FString::Printf(TEXT("%s DepthToFloat16"), Set.Name), Scalar.DepthToFloat16, Set.DepthToFloat16, Depth, Lengths);
+      CompareKernel(Test, FString::Printf(TEXT("%s DepthToFloat32"), Set.Name), Scalar.DepthToFloat32, Set.DepthToFloat32, Depth, Lengths);
+      CompareKernel(Test, FString::Printf(TEXT("%s DepthToMillimeters"), Set.Name), Scalar.DepthToMillimeters, Set.DepthToMillimeters, Depth, Lengths);
+      CompareKernel(Test, FString::Printf(TEXT("%s MetersToMillimeters"), Set.Name), Scalar.MetersToMillimeters, Set.MetersToMillimeters, Meters, Lengths);
+    }
+  }
+
+  void CreateImages(const int32 Count, TArray<FColor> &Color, TArray<FFloat16Color> &Depth, TArray<float> &Meters)
+  {
+    FRandomStream Stream(42);
+    Color.SetNumUninitialized(Count);
+    Depth.SetNumUninitialized(Count);
+    Meters.SetNumUninitialized(Count);
+    for(int32 Index = 0; Index < Count; ++Index)
+    {
+      Color[Index] = FColor(Stream.RandRange(0, 255), Stream.RandRange(0, 255), Stream.RandRange(0, 255), Stream.RandRange(0, 255));
+
+      // Only the red channel holds the depth, the others must be ignored
+      Depth[Index].R = FFloat16(Stream.FRandRange(0.0f, 100.0f));
+      Depth[Index].G = FFloat16(Stream.FRand());
+      Depth[Index].B = FFloat16(Stream.FRand());
+      Depth[Index].A = FFloat16(1.0f);
+
+      // Includes values below 0 and beyond 65.535 m to check the clamping
+      Meters[Index] = Stream.FRandRange(-1.0f, 70.0f);
+    }
+  }
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FImageConversionKernelTest, "AutonomousRGBDCamera.ImageConversion.Kernels",
+  EAutomationTestFlags::EditorContext | EAutomationTestFlags::ProductFilter)
+
+bool FImageConversionKernelTest::RunTest(const FString &Parameters)
+{
+  TArray<FColor> Color;
+  TArray<FFloat16Color> Depth;
+  TArray<float> Meters;
+  CreateImages(2048, Color, Depth, Meters);
+
+  CompareKernelSets(*this, Color, Depth, Meters, GetTestLengths());
+  return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FImageConversionSpecialValueTest, "AutonomousRGBDCamera.ImageConversion.SpecialValues",
+  EAutomationTestFlags::EditorContext | EAutomationTestFlags::ProductFilter)
+
+bool FImageConversionSpecialValueTest::RunTest(const FString &Parameters)
+{
+  // Every half float, including denormals, infinities, NaNs and values whose millimeters are exact ties
+  TArray<FColor> Color;
+  TArray<FFloat16Color> Depth;
+  Depth.SetNumZeroed(65536);
+  for(int32 Index = 0; Index < Depth.Num(); ++Index)
+  {
+    Depth[Index].R.Encoded = Index;
+  }
+
+  // Floats where the rounding, the clamping or the conversion to integers can go wrong, followed by random bit patterns
+  TArray<float> Meters = {0.0f, -0.0f, 1e-45f, -1e-45f, 1.17549435e-38f, 0.0005f, 0.0015f, 0.0625f, 0.1875f, -0.0004f, -0.0005f,
+    -1.0f, 65.5345f, 65.535f, 65.5355f, 65.536f, 1e10f, -1e10f, 3.40282347e38f, -3.40282347e38f,
+    std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity(), std::numeric_limits<float>::quiet_NaN(),
+    -std::numeric_limits<float>::quiet_NaN(), std::numeric_limits<float>::signaling_NaN()};
+  FRandomStream Stream(7);
+  while(Meters.Num() < 65536)
+  {
+    const uint32 Bits = ((uint32)Stream.RandRange(0, 0xFFFF) << 16) | (uint32)Stream.RandRange(0, 0xFFFF);
+    float Value;
+    FMemory::Memcpy(&Value, &Bits, sizeof(Value));
+    Meters.Add(Value);
+  }
+
+  // Each array is compared as a whole and with the tail lengths
+  TArray<uint32> Lengths = GetTestLengths();
+  Lengths.Add(65535);
+  CompareKernelSets(*this, Color, Depth, Meters, Lengths);
+  return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FImageConversionThroughputTest, "AutonomousRGBDCamera.ImageConversion.Throughput",
+  EAutomationTestFlags::EditorContext | EAutomationTestFlags::PerfFilter)
+
+bool FImageConversionThroughputTest::RunTest(const FString &Parameters)
+{
+  TArray<FColor> Color;
+  TArray<FFloat16Color> Depth;
+  TArray<float> Meters;
+  CreateImages(1920 * 1080, Color, Depth, Meters);
+
+  TArray<uint8> Bytes;
+  TArray<uint16> Shorts;
+  TArray<float> Floats;
+  for(const ImageConversion::KernelSet &Set : ImageConversion::GetSupportedKernels())
+  {
+    if(Set.ColorToBGR)
+    {
+      AddInfo(FString::Printf(TEXT("%s ColorToBGR: %.2f GB/s"), Set.Name, MeasureKernel(Set.ColorToBGR, Color, Bytes, 3)));
+    }
+    if(Set.DepthToFloat16)
+    {
+      AddInfo(FString::Printf(TEXT("%s DepthToFloat16: %.2f GB/s"), Set.Name, MeasureKernel(Set.DepthToFloat16, Depth, Shorts)));
+    }
+    if(Set.DepthToFloat32)
+    {
+      AddInfo(FString::Printf(TEXT("%s DepthToFloat32: %.2f GB/s"), Set.Name, MeasureKernel(Set.DepthToFloat32, Depth, Floats)));
+    }
+    if(Set.DepthToMillimeters)
+    {
+      AddInfo(FString::Printf(TEXT("%s DepthToMillimeters: %.2f GB/s"), Set.Name, MeasureKernel(Set.DepthToMillimeters, Depth, Shorts)));
+    }
+    if(Set.MetersToMillimeters)
+    {
+      AddInfo(FString::Printf(TEXT("%s MetersToMillimeters: %.2f GB/s"), Set.Name, MeasureKernel(Set.MetersToMillimeters, Meters, Shorts)));
+    }
+  }
+  return true;
+}
+
+#endif
@@ -0,0 +1,123 @@
+// Copyright 2017, Institute for Artificial Intelligence - University of Bremen
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+#include "PCGStream.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace
+{
+  // PCGStream mixes the seed before using it, Mix of this seed is 42
+  const uint64 SeedOf42 = 0x3B0EF8D59DC12EE3ULL;
+
+  // Whether two generators continue with the same values
+  bool IsSameSequence(PCGStream A, PCGStream B)
+  {
+    for(int32 Index = 0; Index < 8; ++Index)
+    {
+      if(A.Next() != B.Next())
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FPCGStreamKnownAnswerTest, "AutonomousRGBDCamera.PCGStream.KnownAnswer",
+  EAutomationTestFlags::EditorContext | EAutomationTestFlags::ProductFilter)
+
+bool FPCGStreamKnownAnswerTest::RunTest(const FString &Parameters)
+{
+  // Output of the reference implementation (pcg32-demo) for pcg32_srandom(42, 54). Runs can only be generated again
+  // as long as this sequence does not change.
+  const uint32 Expected[] = {0xA15C02B7, 0x7B47F409, 0xBA1D3330, 0x83D2F293, 0xBFA4784B, 0xCBED606E};
+  PCGStream Random(SeedOf42, 54);
+  for(const uint32 Value : Expected)
+  {
+    const uint32 Actual = Random.Next();
+    if(Actual != Value)
+    {
+      AddError(FString::Printf(TEXT("Expected 0x%08X of the reference sequence, got 0x%08X."), Value, Actual));
+    }
+  }
+  return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FPCGStreamAdvanceTest, "AutonomousRGBDCamera.PCGStream.Advance",
+  EAutomationTestFlags::EditorContext | EAutomationTestFlags::ProductFilter)
+
+bool FPCGStreamAdvanceTest::RunTest(const FString &Parameters)
+{
+  // Jumping ahead ends where drawing one value at a time does
+  for(const uint64 Delta : {0ull, 1ull, 2ull, 3ull, 64ull, 1000ull, 123457ull})
+  {
+    PCGStream Stepped(7, PCGStream::StreamOf(3, ERandomSubsystem::SceneSwaps));
+    PCGStream Jumped = Stepped;
+    for(uint64 Index = 0; Index < Delta; ++Index)
+    {
+      Stepped.Next();
+    }
+    Jumped.Advance(Delta);
+    TestTrue(*FString::Printf(TEXT("Advance(%llu) matches %llu calls of Next"), Delta, Delta), IsSameSequence(Stepped, Jumped));
+  }
+
+  // Every draw takes exactly one value, also for ranges of a single value and values close to the rejection zone
+  // of unbiased methods, so consumers can count their position in the stream
+  PCGStream Drawn(11, 5), Counted(11, 5);
+  uint32 Values = 0;
+  int32 Integers[100];
+  float Floats[100];
+  for(int32 Round = 0; Round < 1000; ++Round)
+  {
+    Drawn.Bounded(0x80000001u);
+    Drawn.Bounded(3);
+    Drawn.RandRange(4, 4);
+    Drawn.RandRange(-1, 1);
+    Drawn.FRand();
+    Drawn.FRandRange(-10.0f, 10.0f);
+    Drawn.FillRange(Integers, 100, 0, -2);
+    Drawn.FillRange(Floats, 100, -1.0f, 1.0f);
+    Values += 6 + 100 + 100;
+  }
+  Counted.Advance(Values);
+  TestTrue(TEXT("Draws take one value each"), IsSameSequence(Drawn, Counted));
+  return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FPCGStreamRangeTest, "AutonomousRGBDCamera.PCGStream.Ranges",
+  EAutomationTestFlags::EditorContext | EAutomationTestFlags::ProductFilter)
+
+bool FPCGStreamRangeTest::RunTest(const FString &Parameters)
+{
+  PCGStream Random(1, 2);
+  int32 Counts[3] = {0, 0, 0};
+  bool bInRange = true;
+  const int32 Draws = 300000;
+  for(int32 Index = 0; Index < Draws; ++Index)
+  {
+    const int32 Value = Random.RandRange(-1, 1);
+    bInRange &= Value >= -1 && Value <= 1;
+    ++Counts[FMath::Clamp(Value + 1, 0, 2)];
+
+    const float Float = Random.FRandRange(2.0f, 3.0f);
+    bInRange &= Float >= 2.0f && Float < 3.0f;
+  }
+  TestTrue(TEXT("Draws are within their range"), bInRange);
+  for(const int32 Count : Counts)
+  {
+    TestTrue(*FString::Printf(TEXT("RandRange(-1, 1) is uniform (%d of %d)"), Count, Draws), FMath::Abs(Count - Draws / 3) < Draws / 100);
+  }
+
+  // Shards that only differ in the highest bit and subsystems of the same shard get different sequences
+  const PCGStream Low(1, PCGStream::StreamOf(0, ERandomSubsystem::Trajectory));
+  const PCGStream High(1, PCGStream::StreamOf(0x80000000u, ERandomSubsystem::Trajectory));
+  const PCGStream Other(1, PCGStream::StreamOf(0, ERandomSubsystem::SceneSwaps));
+  TestFalse(TEXT("Shard 2^31 has its own sequence"), IsSameSequence(Low, High));
+  TestFalse(TEXT("Subsystems have their own sequences"), IsSameSequence(Low, Other));
+  TestTrue(TEXT("Stream numbers fit into the increment"), PCGStream::StreamOf(0xFFFFFFFFu, ERandomSubsystem::SequenceOffsets) < (1ull << 63));
+  return true;
+}
+
+#endif
@@ -0,0 +1,415 @@
+// Copyright 2017, Institute for Artificial Intelligence - University of Bremen
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+#include "HAL/MemoryBase.h"
+#include "PacketBuffer.h"
+#include <atomic>
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace
+{
+  // Forwards to the real allocator and counts the allocations made by the thread that started counting. It only
+  // replaces GMalloc while a test measures, but other threads may still be inside of it after GMalloc was restored,
+  // so there is a single instance that is never destroyed.
+  class FCountingMalloc : public FMalloc
+  {
+  private:
+    FMalloc *Inner;
+    // Thread whose allocations are counted, 0 while not counting
+    std::atomic<uint32> ThreadId;
+
+    FCountingMalloc() : Inner(GMalloc), ThreadId(0), Allocations(0)
+    {
+    }
+
+    void Count()
+    {
+      if(FPlatformTLS::GetCurrentThreadId() == ThreadId)
+      {
+        ++Allocations;
+      }
+    }
+
+  public:
+    std::atomic<uint32> Allocations;
+
+    static FCountingMalloc &Get()
+    {
+      static FCountingMalloc *Instance = new FCountingMalloc();
+      return *Instance;
+    }
+
+    // Counts the allocations of the calling thread until Stop is called
+    void Start()
+    {
+      Allocations = 0;
+      ThreadId = FPlatformTLS::GetCurrentThreadId();
+      FPlatformMisc::MemoryBarrier();
+      GMalloc = this;
+    }
+
+    void Stop()
+    {
+      GMalloc = Inner;
+      FPlatformMisc::MemoryBarrier();
+      ThreadId = 0;
+    }
+
+    virtual void *Malloc(SIZE_T Size, uint32 Alignment) override
+    {
+      Count();
+      return Inner->Malloc(Size, Alignment);
+    }
+
+    virtual void *Realloc(void *Original, SIZE_T Size, uint32 Alignment) override
+    {
+      Count();
+      return Inner->Realloc(Original, Size, Alignment);
+    }
+
+    virtual void Free(void *Original) override
+    {
+      Inner->Free(Original);
+    }
+
+    virtual SIZE_T QuantizeSize(SIZE_T Size, uint32 Alignment) override
+    {
+      return Inner->QuantizeSize(Size, Alignment);
+    }
+
+    virtual bool GetAllocationSize(void *Original, SIZE_T &SizeOut) override
+    {
+      return Inner->GetAllocationSize(Original, SizeOut);
+    }
+
+    virtual bool IsInternallyThreadSafe() const override
+    {
+      return Inner->IsInternallyThreadSafe();
+    }
+
+    virtual const TCHAR *GetDescriptiveName() override
+    {
+      return TEXT("CountingMalloc");
+    }
+  };
+
+  // Reads the values of a section in the order they were written, remembers the first problem
+  struct FSectionReader
+  {
+    const uint8 *Data;
+    uint32 Offset, End;
+    FString Error;
+
+    FSectionReader(const PacketBuffer::Packet &Packet, const PacketBuffer::Section &Section) : Data(Packet.Data.data()), Offset(Section.Offset),
+      End(Section.Offset + Section.Length)
+    {
+    }
+
+    bool Read(void *Target, const uint32 Bytes)
+    {
+      if(!Error.IsEmpty() || Offset + Bytes > End)
+      {
+        Error = Error.IsEmpty() ? FString::Printf(TEXT("Read of %u bytes at %u passes the end of the section at %u."), Bytes, Offset, End) : Error;
+        FMemory::Memzero(Target, Bytes);
+        return false;
+      }
+      FMemory::Memcpy(Target, Data + Offset, Bytes);
+      Offset += Bytes;
+      return true;
+    }
+
+    uint32 ReadUInt32()
+    {
+      uint32 Value;
+      Read(&Value, sizeof(Value));
+      return Value;
+    }
+
+    float ReadFloat()
+    {
+      float Value;
+      Read(&Value, sizeof(Value));
+      return Value;
+    }
+
+    FString ReadString(const uint32 Length)
+    {
+      std::vector<ANSICHAR> Chars(Length + 1, 0);
+      Read(Chars.data(), Length);
+      return FString(ANSI_TO_TCHAR(Chars.data()));
+    }
+
+    // Whether everything was read and nothing is left over
+    bool Finish(const TCHAR *Name, FString &OutError)
+    {
+      if(Error.IsEmpty() && Offset != End)
+      {
+        Error = FString::Printf(TEXT("%u bytes are left over."), End - Offset);
+      }
+      if(!Error.IsEmpty())
+      {
+        OutError = FString::Printf(TEXT("%s: %s"), Name, *Error);
+      }
+      return Error.IsEmpty();
+    }
+  };
+
+  // Decodes the annotations of a packet and compares them with the input, describes the first difference
+  bool CheckAnnotations(const PacketBuffer::Packet &Packet, const TMap<FString, uint32> &ObjectToColor, const TArray<FColor> &ObjectColors,
+    const PacketBuffer::SceneGraph &Scene, FString &Error)
+  {
+    const PacketBuffer::PacketHeader &Header = *Packet.Header;
+    const PacketBuffer::Section *Map = PacketBuffer::FindSection(Header, PacketBuffer::SectionMap);
+    const PacketBuffer::Section *Objects = PacketBuffer::FindSection(Header, PacketBuffer::SectionObjects);
+    const PacketBuffer::Section *Relations = PacketBuffer::FindSection(Header, PacketBuffer::SectionRelations);
+    if(!Map || !Objects || !Relations)
+    {
+      Error = TEXT("An annotation section is missing from the table.");
+      return false;
+    }
+
+    // Map entries: size, color and the name without a terminating zero
+    if((int32)Header.MapEntries != ObjectToColor.Num())
+    {
+      Error = FString::Printf(TEXT("%u map entries instead of %d."), Header.MapEntries, ObjectToColor.Num());
+      return false;
+    }
+    FSectionReader MapReader(Packet, *Map);
+    std::vector<bool> Seen(ObjectColors.Num(), false);
+    for(uint32 Entry = 0; Entry < Header.MapEntries && MapReader.Error.IsEmpty(); ++Entry)
+    {
+      const uint32 Size = MapReader.ReadUInt32();
+      uint8 Color[3];
+      MapReader.Read(Color, sizeof(Color));
+      const FString Name = MapReader.ReadString(Size >= 7 ? Size - 7 : 0);
+      const uint32 *Index = ObjectToColor.Find(Name);
+      if(!Index || Seen[*Index])
+      {
+        Error = FString::Printf(TEXT("Map entry %u has the %s name %s."), Entry, Index ? TEXT("repeated") : TEXT("unknown"), *Name);
+        return false;
+      }
+      Seen[*Index] = true;
+      const FColor &Expected = ObjectColors[*Index];
+      if(Color[0] != Expected.R || Color[1] != Expected.G || Color[2] != Expected.B)
+      {
+        Error = FString::Printf(TEXT("Map entry %s has the color %u %u %u instead of %u %u %u."), *Name, Color[0], Color[1], Color[2],
+          Expected.R, Expected.G, Expected.B);
+        return false;
+      }
+    }
+    if(!MapReader.Finish(TEXT("Map"), Error))
+    {
+      return false;
+    }
+
+    // Objects: ID, mesh and material with their lengths, location and rotation
+    if((int32)Header.numberOfObjects != Scene.Objects.Num())
+    {
+      Error = FString::Printf(TEXT("%u objects instead of %d."), Header.numberOfObjects, Scene.Objects.Num());
+      return false;
+    }
+    FSectionReader ObjectReader(Packet, *Objects);
+    for(const PacketBuffer::ObjectDescription &Object : Scene.Objects)
+    {
+      for(const PacketBuffer::ObjectProperty &Property : Object.Properties)
+      {
+        const uint32 ID = ObjectReader.ReadUInt32();
+        const FString Mesh = ObjectReader.ReadString(ObjectReader.ReadUInt32());
+        const FString Material = ObjectReader.ReadString(ObjectReader.ReadUInt32());
+        bool bSame = ID == Property.ID && Mesh.Equals(Property.Mesh, ESearchCase::CaseSensitive) && Material.Equals(Property.Material, ESearchCase::CaseSensitive);
+        for(const FFloat32 &Value : Property.Location)
+        {
+          bSame &= ObjectReader.ReadFloat() == Value.FloatValue;
+        }
+        for(const FFloat32 &Value : Property.Rotation)
+        {
+          bSame &= ObjectReader.ReadFloat() == Value.FloatValue;
+        }
+        if(!bSame && ObjectReader.Error.IsEmpty())
+        {
+          Error = FString::Printf(TEXT("Object %u (%s, %s) differs from object %u."), ID, *Mesh, *Material, Property.ID);
+          return false;
+        }
+      }
+    }
+    if(!ObjectReader.Finish(TEXT("Objects"), Error))
+    {
+      return false;
+    }
+
+    // Relations: both IDs around the relationship with its length
+    if((int32)Header.numberOfRelations != Scene.Relations.Num())
+    {
+      Error = FString::Printf(TEXT("%u relations instead of %d."), Header.numberOfRelations, Scene.Relations.Num());
+      return false;
+    }
+    FSectionReader RelationReader(Packet, *Relations);
+    for(const PacketBuffer::ObjectRelation &Relation : Scene.Relations)
+    {
+      const uint32 ID1 = RelationReader.ReadUInt32();
+      const FString Relationship = RelationReader.ReadString(RelationReader.ReadUInt32());
+      const uint32 ID2 = RelationReader.ReadUInt32();
+      if((ID1 != Relation.ID1 || !Relationship.Equals(Relation.SpatialRelationship, ESearchCase::CaseSensitive) || ID2 != Relation.ID2) && RelationReader.Error.IsEmpty())
+      {
+        Error = FString::Printf(TEXT("Relation %u %s %u differs from %u %s %u."), ID1, *Relationship, ID2, Relation.ID1, *Relation.SpatialRelationship, Relation.ID2);
+        return false;
+      }
+    }
+    return RelationReader.Finish(TEXT("Relations"), Error);
+  }
+
+  // Scene with N objects, relations and map entries, the names have realistic lengths
+  void CreateScene(const int32 N, TMap<FString, uint32> &ObjectToColor, TArray<FColor> &ObjectColors, PacketBuffer::SceneGraph &Scene)
+  {
+    for(int32 Index = 0; Index < N; ++Index)
+    {
+      ObjectToColor.Add(FString::Printf(TEXT("StaticMeshActor_%d"), Index), Index);
+      ObjectColors.Add(FColor(Index & 0xFF, (Index >> 8) & 0xFF, (Index >> 16) & 0xFF));
+
+      PacketBuffer::ObjectProperty Property;
+      Property.ID = Index;
+      Property.Mesh = FString::Printf(TEXT("/Game/Meshes/SM_Object_%d"), Index % 50);
+      Property.Material = FString::Printf(TEXT("/Game/Materials/M_Object_%d"), Index % 20);
+      Property.Location = {FFloat32(Index * 1.0f), FFloat32(2.0f), FFloat32(3.0f)};
+      Property.Rotation = {FFloat32(0.0f), FFloat32(0.0f), FFloat32(0.0f), FFloat32(1.0f)};
+
+      PacketBuffer::ObjectDescription Object;
+      Object.Properties.Add(Property);
+      Scene.Objects.Add(Object);
+
+      PacketBuffer::ObjectRelation Relation;
+      Relation.ID1 = Index;
+      Relation.SpatialRelationship = Index % 2 ? TEXT("on") : TEXT("next_to");
+      Relation.ID2 = (Index + 1) % N;
+      Scene.Relations.Add(Relation);
+    }
+  }
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FPacketBufferSerializationTest, "AutonomousRGBDCamera.PacketBuffer.Serialization",
+  EAutomationTestFlags::EditorContext | EAutomationTestFlags::ProductFilter)
+
+bool FPacketBufferSerializationTest::RunTest(const FString &Parameters)
+{
+  for(const int32 N : {100, 1000, 10000})
+  {
+    TMap<FString, uint32> ObjectToColor;
+    TArray<FColor> ObjectColors;
+    PacketBuffer::SceneGraph Scene;
+    CreateScene(N, ObjectToColor, ObjectColors, Scene);
+
+    PacketBuffer Buffer(64, 48, 90.0f, 2);
+    PacketBuffer::Packet *Packet = Buffer.AcquireWrite();
+    Buffer.SetChannels(*Packet, PacketBuffer::ChannelAll);
+
+    // The first packet grows to the size of the annotations, every further one has to reuse its memory
+    Buffer.StartWriting(*Packet, ObjectToColor, ObjectColors, Scene);
+
+    const int32 Iterations = FMath::Max(1000000 / N, 10);
+    FCountingMalloc &Counter = FCountingMalloc::Get();
+    Counter.Start();
+    const double Start = FPlatformTime::Seconds();
+    for(int32 Iteration = 0; Iteration < Iterations; ++Iteration)
+    {
+      Buffer.SetChannels(*Packet, PacketBuffer::ChannelAll);
+      Buffer.StartWriting(*Packet, ObjectToColor, ObjectColors, Scene);
+    }
+    const double Seconds = FPlatformTime::Seconds() - Start;
+    Counter.Stop();
+
+    const uint32 Bytes = Packet->Header->Size - Buffer.OffsetMap;
+    AddInfo(FString::Printf(TEXT("N = %d: %.2f us per packet, %.1f MB/s of annotations, %u allocations"), N, Seconds * 1e6 / Iterations,
+      Bytes * (double)Iterations / (Seconds * 1024.0 * 1024.0), Counter.Allocations.load()));
+    TestEqual(*FString::Printf(TEXT("Allocations after warm-up for N = %d"), N), (int32)Counter.Allocations.load(), 0);
+
+    // Packets written into reused memory decode to the same annotations
+    FString Error;
+    if(!CheckAnnotations(*Packet, ObjectToColor, ObjectColors, Scene, Error))
+    {
+      AddError(FString::Printf(TEXT("N = %d: %s"), N, *Error));
+    }
+
+    Buffer.CancelWrite(Packet);
+  }
+  return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FPacketBufferLayoutTest, "AutonomousRGBDCamera.PacketBuffer.Layout",
+  EAutomationTestFlags::EditorContext | EAutomationTestFlags::ProductFilter)
+
+bool FPacketBufferLayoutTest::RunTest(const FString &Parameters)
+{
+  // The packets start with too little room for the annotations, so they grow while they are written
+  TMap<FString, uint32> ObjectToColor;
+  TArray<FColor> ObjectColors;
+  PacketBuffer::SceneGraph Scene;
+  CreateScene(20000, ObjectToColor, ObjectColors, Scene);
+
+  for(const PacketBuffer::DepthFormat Encoding : {PacketBuffer::DepthFormat::Float16, PacketBuffer::DepthFormat::Meters})
+  {
+    PacketBuffer Buffer(64, 48, 90.0f, 2, PacketBuffer::OverflowPolicy::DropOldest, PacketBuffer::ChannelAll, Encoding);
+    for(const uint32 Active : {(uint32)PacketBuffer::ChannelAll, (uint32)(PacketBuffer::ChannelColor | PacketBuffer::ChannelObject)})
+    {
+      PacketBuffer::Packet *Packet = Buffer.AcquireWrite();
+      Buffer.SetChannels(*Packet, Active);
+      Buffer.StartWriting(*Packet, ObjectToColor, ObjectColors, Scene);
+      const PacketBuffer::PacketHeader &Header = *Packet->Header;
+
+      // Expected sections in the order of the format, inactive channels are left out but keep their space
+      std::vector<PacketBuffer::Section> Expected;
+      if(Active & PacketBuffer::ChannelColor)
+      {
+        Expected.push_back({PacketBuffer::SectionColor, Buffer.OffsetColor, Buffer.SizeRGB});
+      }
+      if(Active & PacketBuffer::ChannelDepth)
+      {
+        const uint32 Type = Encoding == PacketBuffer::DepthFormat::Meters ? PacketBuffer::SectionDepthMeters : PacketBuffer::SectionDepth;
+        Expected.push_back({Type, Buffer.OffsetDepth, 64 * 48 * (Encoding == PacketBuffer::DepthFormat::Meters ? 4u : 2u)});
+      }
+      if(Active & PacketBuffer::ChannelObject)
+      {
+        Expected.push_back({PacketBuffer::SectionObject, Buffer.OffsetObject, Buffer.SizeRGB});
+      }
+
+      // The annotations follow each other behind the images and end with the packet
+      const PacketBuffer::Section *Map = PacketBuffer::FindSection(Header, PacketBuffer::SectionMap);
+      const PacketBuffer::Section *Objects = PacketBuffer::FindSection(Header, PacketBuffer::SectionObjects);
+      const PacketBuffer::Section *Relations = PacketBuffer::FindSection(Header, PacketBuffer::SectionRelations);
+      if(!Map || !Objects || !Relations)
+      {
+        AddError(TEXT("An annotation section is missing from the table."));
+        Buffer.CancelWrite(Packet);
+        continue;
+      }
+      Expected.push_back({PacketBuffer::SectionMap, Buffer.OffsetMap, Map->Length});
+      Expected.push_back({PacketBuffer::SectionObjects, Map->Offset + Map->Length, Objects->Length});
+      Expected.push_back({PacketBuffer::SectionRelations, Objects->Offset + Objects->Length, Relations->Length});
+      TestTrue(TEXT("Relations end with the packet"), Relations->Offset + Relations->Length == Header.Size);
+      TestTrue(TEXT("Packet holds all data"), Header.Size <= Packet->Data.size());
+
+      TestEqual(TEXT("Number of sections"), (int32)Header.NumSections, (int32)Expected.size());
+      for(uint32 Index = 0; Index < Header.NumSections && Index < Expected.size(); ++Index)
+      {
+        const PacketBuffer::Section &Entry = Header.Sections[Index];
+        if(Entry.Type != Expected[Index].Type || Entry.Offset != Expected[Index].Offset || Entry.Length != Expected[Index].Length)
+        {
+          AddError(FString::Printf(TEXT("Section %u is type %u at %u with %u bytes instead of type %u at %u with %u bytes."), Index, Entry.Type, Entry.Offset,
+            Entry.Length, Expected[Index].Type, Expected[Index].Offset, Expected[Index].Length));
+        }
+      }
+      TestTrue(TEXT("Header size and version"), Header.SizeHeader == sizeof(PacketBuffer::PacketHeader) && Header.Version == PacketBuffer::FormatVersion);
+
+      FString Error;
+      if(!CheckAnnotations(*Packet, ObjectToColor, ObjectColors, Scene, Error))
+      {
+        AddError(Error);
+      }
+      Buffer.CancelWrite(Packet);
+    }
+  }
+  return true;
+}
+
+#endif
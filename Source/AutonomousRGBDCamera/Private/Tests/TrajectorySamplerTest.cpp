@@ -0,0 +1,251 @@
+// Copyright 2017, Institute for Artificial Intelligence - University of Bremen
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+#include "TrajectorySampler.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace
+{
+  typedef TrajectorySampler::Bounds Bounds;
+  const uint32 NumAxes = TrajectorySampler::NumAxes;
+
+  // Bounds of 0 to 1 on every axis, so that low-discrepancy poses are the plain values of the sequence
+  void InitUnitCube(TrajectorySampler &Sampler, PCGStream &Random, const uint32 BlockSize)
+  {
+    const Bounds Limits[NumAxes] = {{0.0f, 1.0f, 0.25f}, {0.0f, 1.0f, 0.25f}, {0.0f, 1.0f, 0.25f}, {0.0f, 1.0f, 0.25f}, {0.0f, 1.0f, 0.25f}, {0.0f, 1.0f, 0.25f}};
+    const float Start[NumAxes] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+    Sampler.Init(Limits, Start, Random, BlockSize);
+  }
+
+  // Whether two samplers are at the same pose, describes the first difference otherwise
+  bool IsSamePose(const TrajectorySampler &A, const TrajectorySampler &B, FString &Error)
+  {
+    for(uint32 Target = 0; Target < NumAxes; ++Target)
+    {
+      const TrajectorySampler::Axis Axis = (TrajectorySampler::Axis)Target;
+      if(A.Get(Axis) != B.Get(Axis) || A.GetDirection(Axis) != B.GetDirection(Axis))
+      {
+        Error = FString::Printf(TEXT("Axis %u: %f (%d) instead of %f (%d)"), Target, A.Get(Axis), A.GetDirection(Axis), B.Get(Axis), B.GetDirection(Axis));
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Compares Count poses of an axis with the expected values of the sequence
+  void CheckSequence(FAutomationTestBase &Test, const TCHAR *Name, const TrajectorySampler::Mode Sampling, const TrajectorySampler::Axis Axis,
+    const float *Expected, const uint32 Count)
+  {
+    PCGStream Random(1, 1);
+    TrajectorySampler Sampler;
+    InitUnitCube(Sampler, Random, 4);
+    const float Offsets[NumAxes] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+    Sampler.SetLowDiscrepancy(Sampling, 0, 1, Offsets, 0.0f);
+    for(uint32 Position = 0; Position < Count; ++Position)
+    {
+      Sampler.Next();
+      if(FMath::Abs(Sampler.Get(Axis) - Expected[Position]) > 1e-6f)
+      {
+        Test.AddError(FString::Printf(TEXT("%s: element %u is %f instead of %f."), Name, Position, Sampler.Get(Axis), Expected[Position]));
+      }
+    }
+  }
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FTrajectorySamplerWalkTest, "AutonomousRGBDCamera.TrajectorySampler.Walk",
+  EAutomationTestFlags::EditorContext | EAutomationTestFlags::ProductFilter)
+
+bool FTrajectorySamplerWalkTest::RunTest(const FString &Parameters)
+{
+  // Narrow bounds, so that the walk hits them often, and an axis without a range
+  const Bounds Limits[NumAxes] = {{-2.0f, 2.0f, 1.0f}, {0.0f, 10.0f, 2.5f}, {5.0f, 5.0f, 1.0f}, {-180.0f, 180.0f, 45.0f}, {-10.0f, 10.0f, 15.0f}, {0.0f, 1.0f, 0.25f}};
+  const float Start[NumAxes] = {0.0f, 10.0f, 5.0f, 0.0f, 0.0f, 0.5f};
+  PCGStream Random(3, PCGStream::StreamOf(0, ERandomSubsystem::Trajectory));
+  TrajectorySampler Sampler;
+  Sampler.Init(Limits, Start, Random, 64);
+
+  // Every step moves by the direction times the step length and stays within the bounds
+  float Previous[NumAxes];
+  for(uint32 Target = 0; Target < NumAxes; ++Target)
+  {
+    Previous[Target] = Start[Target];
+  }
+  FString Error;
+  for(int32 Step = 0; Step < 10000 && Error.IsEmpty(); ++Step)
+  {
+    Sampler.Next();
+    for(uint32 Target = 0; Target < NumAxes && Error.IsEmpty(); ++Target)
+    {
+      const TrajectorySampler::Axis Axis = (TrajectorySampler::Axis)Target;
+      const float Value = Sampler.Get(Axis);
+      const int32 Direction = Sampler.GetDirection(Axis);
+      if(Value < Limits[Target].Min - 1e-3f || Value > Limits[Target].Max + 1e-3f)
+      {
+        Error = FString::Printf(TEXT("Step %d: axis %u left its bounds with %f."), Step, Target, Value);
+      }
+      else if(Direction < -1 || Direction > 1 || FMath::Abs(Value - Previous[Target] - Direction * Limits[Target].Step) > 1e-3f)
+      {
+        Error = FString::Printf(TEXT("Step %d: axis %u moved from %f to %f with direction %d."), Step, Target, Previous[Target], Value, Direction);
+      }
+      Previous[Target] = Value;
+    }
+  }
+  if(!Error.IsEmpty())
+  {
+    AddError(Error);
+  }
+
+  // Far from the bounds, every direction is equally likely
+  const Bounds Wide[NumAxes] = {{-1e6f, 1e6f, 1.0f}, {-1e6f, 1e6f, 1.0f}, {-1e6f, 1e6f, 1.0f}, {-1e6f, 1e6f, 1.0f}, {-1e6f, 1e6f, 1.0f}, {-1e6f, 1e6f, 1.0f}};
+  const float Origin[NumAxes] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+  TrajectorySampler Free;
+  Free.Init(Wide, Origin, Random, 1024);
+  int32 Counts[3] = {0, 0, 0};
+  const int32 Steps = 50000;
+  for(int32 Step = 0; Step < Steps; ++Step)
+  {
+    Free.Next();
+    for(uint32 Target = 0; Target < NumAxes; ++Target)
+    {
+      ++Counts[FMath::Clamp(Free.GetDirection((TrajectorySampler::Axis)Target) + 1, 0, 2)];
+    }
+  }
+  const int32 Total = Steps * NumAxes;
+  for(int32 Direction = 0; Direction < 3; ++Direction)
+  {
+    TestTrue(*FString::Printf(TEXT("Direction %d is uniform (%d of %d)"), Direction - 1, Counts[Direction], Total),
+      FMath::Abs(Counts[Direction] - Total / 3) < Total / 100);
+  }
+  return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FTrajectorySamplerSkipTest, "AutonomousRGBDCamera.TrajectorySampler.Skip",
+  EAutomationTestFlags::EditorContext | EAutomationTestFlags::ProductFilter)
+
+bool FTrajectorySamplerSkipTest::RunTest(const FString &Parameters)
+{
+  // Counts within a block, up to its end, across it and over several blocks of 16 poses
+  const float Offsets[NumAxes] = {0.1f, 0.2f, 0.3f, 0.4f, 0.5f, 0.6f};
+  for(const TrajectorySampler::Mode Sampling : {TrajectorySampler::Mode::RandomWalk, TrajectorySampler::Mode::Halton, TrajectorySampler::Mode::Sobol})
+  {
+    for(const uint64 Count : {0ull, 1ull, 14ull, 15ull, 16ull, 17ull, 100ull, 1000ull})
+    {
+      PCGStream RandomStepped(5, 7), RandomSkipped(5, 7);
+      TrajectorySampler Stepped, Skipped;
+      InitUnitCube(Stepped, RandomStepped, 16);
+      InitUnitCube(Skipped, RandomSkipped, 16);
+      if(Sampling != TrajectorySampler::Mode::RandomWalk)
+      {
+        Stepped.SetLowDiscrepancy(Sampling, 3, 2, Offsets, 0.2f, 8);
+        Skipped.SetLowDiscrepancy(Sampling, 3, 2, Offsets, 0.2f, 8);
+      }
+
+      // Start within a block, then continue after the skipped poses
+      for(int32 Step = 0; Step < 3; ++Step)
+      {
+        Stepped.Next();
+        Skipped.Next();
+      }
+      for(uint64 Step = 0; Step < Count; ++Step)
+      {
+        Stepped.Next();
+      }
+      Skipped.Skip(Count);
+      FString Error;
+      for(int32 Step = 0; Step < 20 && IsSamePose(Skipped, Stepped, Error); ++Step)
+      {
+        Stepped.Next();
+        Skipped.Next();
+      }
+      if(!Error.IsEmpty())
+      {
+        AddError(FString::Printf(TEXT("Mode %d, Skip(%llu) differs from calling Next: %s"), (int32)Sampling, Count, *Error));
+      }
+    }
+  }
+  return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FTrajectorySamplerSequenceTest, "AutonomousRGBDCamera.TrajectorySampler.Sequences",
+  EAutomationTestFlags::EditorContext | EAutomationTestFlags::ProductFilter)
+
+bool FTrajectorySamplerSequenceTest::RunTest(const FString &Parameters)
+{
+  // First elements of the Sobol sequence in dimensions 1 to 3 of Joe and Kuo in gray code order
+  const float SobolX[] = {0.0f, 0.5f, 0.75f, 0.25f, 0.375f, 0.875f, 0.625f, 0.125f};
+  const float SobolY[] = {0.0f, 0.5f, 0.25f, 0.75f, 0.375f, 0.875f, 0.125f, 0.625f};
+  const float SobolZ[] = {0.0f, 0.5f, 0.25f, 0.75f, 0.625f, 0.125f, 0.875f, 0.375f};
+  CheckSequence(*this, TEXT("Sobol X"), TrajectorySampler::Mode::Sobol, TrajectorySampler::AxisX, SobolX, 8);
+  CheckSequence(*this, TEXT("Sobol Y"), TrajectorySampler::Mode::Sobol, TrajectorySampler::AxisY, SobolY, 8);
+  CheckSequence(*this, TEXT("Sobol Z"), TrajectorySampler::Mode::Sobol, TrajectorySampler::AxisZ, SobolZ, 8);
+
+  // Radical inverses in the bases 2, 3 and 5
+  const float HaltonX[] = {0.0f, 1.0f / 2, 1.0f / 4, 3.0f / 4, 1.0f / 8, 5.0f / 8};
+  const float HaltonY[] = {0.0f, 1.0f / 3, 2.0f / 3, 1.0f / 9, 4.0f / 9, 7.0f / 9};
+  const float HaltonZ[] = {0.0f, 1.0f / 5, 2.0f / 5, 3.0f / 5, 4.0f / 5, 1.0f / 25};
+  CheckSequence(*this, TEXT("Halton X"), TrajectorySampler::Mode::Halton, TrajectorySampler::AxisX, HaltonX, 6);
+  CheckSequence(*this, TEXT("Halton Y"), TrajectorySampler::Mode::Halton, TrajectorySampler::AxisY, HaltonY, 6);
+  CheckSequence(*this, TEXT("Halton Z"), TrajectorySampler::Mode::Halton, TrajectorySampler::AxisZ, HaltonZ, 6);
+
+  // Two shards with a stride of 2 take turns on the sequence of a single one
+  const float Offsets[NumAxes] = {0.25f, 0.5f, 0.75f, 0.0f, 0.0f, 0.0f};
+  PCGStream Random(1, 1);
+  TrajectorySampler Single, Shards[2];
+  InitUnitCube(Single, Random, 16);
+  Single.SetLowDiscrepancy(TrajectorySampler::Mode::Sobol, 0, 1, Offsets, 0.0f);
+  for(uint32 Shard = 0; Shard < 2; ++Shard)
+  {
+    InitUnitCube(Shards[Shard], Random, 16);
+    Shards[Shard].SetLowDiscrepancy(TrajectorySampler::Mode::Sobol, Shard, 2, Offsets, 0.0f);
+  }
+  // Directions differ, they are relative to the previous pose of the same shard
+  bool bInterleaved = true, bWrapped = true;
+  for(int32 Position = 0; Position < 100; ++Position)
+  {
+    TrajectorySampler &Shard = Shards[Position % 2];
+    Single.Next();
+    Shard.Next();
+    for(uint32 Target = 0; Target < NumAxes; ++Target)
+    {
+      const TrajectorySampler::Axis Axis = (TrajectorySampler::Axis)Target;
+      bInterleaved &= Shard.Get(Axis) == Single.Get(Axis);
+      bWrapped &= Single.Get(Axis) >= 0.0f && Single.Get(Axis) < 1.0f;
+    }
+  }
+  TestTrue(TEXT("Shards take turns on the sequence"), bInterleaved);
+  TestTrue(TEXT("Offset values are wrapped around"), bWrapped);
+
+  // Accepted poses keep the minimum distance to the poses in the window, which covers all of them here
+  const float MinDistance = 0.3f;
+  TrajectorySampler Spread;
+  InitUnitCube(Spread, Random, 64);
+  Spread.SetLowDiscrepancy(TrajectorySampler::Mode::Halton, 0, 1, Offsets, MinDistance, 256);
+  std::vector<std::vector<float>> Poses;
+  for(int32 Position = 0; Position < 200; ++Position)
+  {
+    Spread.Next();
+    std::vector<float> Pose(NumAxes);
+    for(uint32 Target = 0; Target < NumAxes; ++Target)
+    {
+      Pose[Target] = Spread.Get((TrajectorySampler::Axis)Target);
+    }
+    for(uint32 Other = 0; Other < Poses.size(); ++Other)
+    {
+      float DistanceSquared = 0.0f;
+      for(uint32 Target = 0; Target < NumAxes; ++Target)
+      {
+        DistanceSquared += (Pose[Target] - Poses[Other][Target]) * (Pose[Target] - Poses[Other][Target]);
+      }
+      if(DistanceSquared < MinDistance * MinDistance * 0.999f)
+      {
+        AddError(FString::Printf(TEXT("Pose %d is %f away from pose %u."), Position, FMath::Sqrt(DistanceSquared), Other));
+      }
+    }
+    Poses.push_back(Pose);
+  }
+  return true;
+}
+
+#endif
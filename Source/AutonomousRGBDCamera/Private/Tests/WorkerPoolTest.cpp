@@ -0,0 +1,136 @@
+// Copyright 2017, Institute for Artificial Intelligence - University of Bremen
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+#include "WorkerPool.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace
+{
+  // Job that counts how often each of its tiles ran and how often it was done
+  struct CountingJob
+  {
+    WorkerPool::Job Job;
+    std::vector<std::atomic<uint32>> Runs;
+    std::atomic<uint32> DoneCalls;
+    std::mutex Lock;
+    std::condition_variable CVDone;
+
+    CountingJob(const uint32 NumTiles) : Runs(NumTiles), DoneCalls(0)
+    {
+      Job.Work = [this](const uint32 Tile)
+      {
+        ++Runs[Tile];
+      };
+      Job.Done = [this]()
+      {
+        std::lock_guard<std::mutex> LockDone(Lock);
+        ++DoneCalls;
+        CVDone.notify_all();
+      };
+    }
+
+    void Reset()
+    {
+      for(std::atomic<uint32> &Count : Runs)
+      {
+        Count = 0;
+      }
+      DoneCalls = 0;
+    }
+
+    bool WaitUntilDone()
+    {
+      std::unique_lock<std::mutex> LockDone(Lock);
+      return CVDone.wait_for(LockDone, std::chrono::seconds(10), [this] {return DoneCalls > 0; });
+    }
+
+    // Whether every tile ran exactly once and Done was called once, describes the first difference otherwise
+    bool Check(FString &Error)
+    {
+      for(uint32 Tile = 0; Tile < Runs.size(); ++Tile)
+      {
+        if(Runs[Tile] != 1)
+        {
+          Error = FString::Printf(TEXT("Tile %u of %u ran %u times."), Tile, (uint32)Runs.size(), Runs[Tile].load());
+          return false;
+        }
+      }
+      if(DoneCalls != 1)
+      {
+        Error = FString::Printf(TEXT("Done of a job with %u tiles was called %u times."), (uint32)Runs.size(), DoneCalls.load());
+        return false;
+      }
+      return true;
+    }
+  };
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FWorkerPoolTilesTest, "AutonomousRGBDCamera.WorkerPool.Tiles",
+  EAutomationTestFlags::EditorContext | EAutomationTestFlags::ProductFilter)
+
+bool FWorkerPoolTilesTest::RunTest(const FString &Parameters)
+{
+  // Fewer, as many and more tiles than workers, submitted from two threads at once so that jobs overlap and get stolen
+  WorkerPool Pool;
+  Pool.Start(4);
+  const int32 Rounds = 200;
+  std::vector<std::unique_ptr<CountingJob>> Jobs;
+  for(const uint32 NumTiles : {1u, 3u, 4u, 7u, 1080u})
+  {
+    Jobs.emplace_back(new CountingJob(NumTiles));
+  }
+
+  // Errors are reported from the test thread only, each submitting thread keeps its first one
+  FString Errors[2];
+  auto SubmitJobs = [&](const uint32 First)
+  {
+    for(int32 Round = 0; Round < Rounds; ++Round)
+    {
+      for(uint32 Index = First; Index < Jobs.size(); Index += 2)
+      {
+        Jobs[Index]->Reset();
+        Pool.Submit(Jobs[Index]->Job, Jobs[Index]->Runs.size());
+      }
+      for(uint32 Index = First; Index < Jobs.size(); Index += 2)
+      {
+        if(!Jobs[Index]->WaitUntilDone())
+        {
+          Errors[First] = FString::Printf(TEXT("Round %d did not finish within 10 s."), Round);
+          return;
+        }
+      }
+      for(uint32 Index = First; Index < Jobs.size(); Index += 2)
+      {
+        if(!Jobs[Index]->Check(Errors[First]))
+        {
+          return;
+        }
+      }
+    }
+  };
+  std::thread Other(SubmitJobs, 1);
+  SubmitJobs(0);
+  Other.join();
+  for(const FString &Error : Errors)
+  {
+    if(!Error.IsEmpty())
+    {
+      AddError(Error);
+    }
+  }
+
+  // Stopping finishes the tiles that are still queued
+  CountingJob Last(1000);
+  Pool.Submit(Last.Job, Last.Runs.size());
+  Pool.Stop();
+  FString Error;
+  if(!Last.Check(Error))
+  {
+    AddError(FString::Printf(TEXT("After stopping: %s"), *Error));
+  }
+  return true;
+}
+
+#endif
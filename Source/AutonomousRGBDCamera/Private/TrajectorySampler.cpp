@@ -0,0 +1,385 @@
+// Copyright 2017, Institute for Artificial Intelligence - University of Bremen
+
+#include "TrajectorySampler.h"
+#include "StopTime.h"
+#include <algorithm>
+
+namespace
+{
+  // Primitive polynomial (degree and inner coefficients) and initial direction numbers of the Sobol sequence
+  // for every axis, from the table of Joe and Kuo (new-joe-kuo-6.21201). The first axis is the van der Corput sequence.
+  struct SobolParameters
+  {
+    uint32 Degree, Coefficients;
+    uint32 Initial[4];
+  };
+
+  const SobolParameters SobolTable[TrajectorySampler::NumAxes] = {
+    {0, 0, {0}},
+    {1, 0, {1}},
+    {2, 1, {1, 3}},
+    {3, 1, {1, 3, 1}},
+    {3, 2, {1, 1, 1}},
+    {4, 1, {1, 1, 3, 3}}
+  };
+
+  // Coprime bases of the Halton sequence for every axis
+  const uint32 HaltonBases[TrajectorySampler::NumAxes] = {2, 3, 5, 7, 11, 13};
+}
+
+TrajectorySampler::TrajectorySampler() : BlockSize(0), Cursor(0), Random(nullptr), Sampling(Mode::RandomWalk), Index(0), Stride(1), MinDistance(0.0f),
+  NumRecent(0), NextRecent(0), NumServed(0), NumCellsPose(0), NumCellsLocation(0), NumRejected(0), NumForced(0), SumStepDistance(0.0)
+{
+  for(uint32 Target = 0; Target < NumAxes; ++Target)
+  {
+    Limits[Target] = {0.0f, 0.0f, 0.0f};
+    Last[Target] = 0.0f;
+    Offsets[Target] = 0.0f;
+    Previous[Target] = 0.0f;
+
+    // Direction numbers of the Sobol sequence, bit 31 is the most significant bit of the fraction
+    const SobolParameters &Parameters = SobolTable[Target];
+    uint32 *Numbers = SobolDirections[Target];
+    for(uint32 Bit = 0; Bit < 32; ++Bit)
+    {
+      if(Parameters.Degree == 0)
+      {
+        Numbers[Bit] = 1u << (31 - Bit);
+      }
+      else if(Bit < Parameters.Degree)
+      {
+        Numbers[Bit] = Parameters.Initial[Bit] << (31 - Bit);
+      }
+      else
+      {
+        const uint32 Degree = Parameters.Degree;
+        Numbers[Bit] = Numbers[Bit - Degree] ^ (Numbers[Bit - Degree] >> Degree);
+        for(uint32 Term = 1; Term < Degree; ++Term)
+        {
+          if((Parameters.Coefficients >> (Degree - 1 - Term)) & 1)
+          {
+            Numbers[Bit] ^= Numbers[Bit - Term];
+          }
+        }
+      }
+    }
+  }
+}
+
+void TrajectorySampler::Init(const Bounds (&_Limits)[NumAxes], const float (&Start)[NumAxes], PCGStream &_Random, const uint32 _BlockSize)
+{
+  Random = &_Random;
+  BlockSize = FMath::Max<uint32>(_BlockSize, 1);
+  Draws.resize(BlockSize * NumAxes);
+  Sampling = Mode::RandomWalk;
+  for(uint32 Target = 0; Target < NumAxes; ++Target)
+  {
+    Limits[Target] = _Limits[Target];
+    Last[Target] = Start[Target];
+    Values[Target].resize(BlockSize);
+    Directions[Target].resize(BlockSize);
+  }
+
+  // The first call of Next generates the first block
+  Cursor = BlockSize - 1;
+  for(uint32 Target = 0; Target < NumAxes; ++Target)
+  {
+    Values[Target][Cursor] = Start[Target];
+    Directions[Target][Cursor] = 0;
+  }
+
+  // Axes without a range only have a single cell
+  uint32 NumCells = 1;
+  for(uint32 Target = 0; Target < NumAxes; ++Target)
+  {
+    NumCells *= Limits[Target].Max > Limits[Target].Min ? CellsPerAxisPose : 1;
+  }
+  VisitedPose.assign(NumCells, false);
+  NumCells = 1;
+  for(uint32 Target = AxisX; Target <= AxisZ; ++Target)
+  {
+    NumCells *= Limits[Target].Max > Limits[Target].Min ? CellsPerAxisLocation : 1;
+  }
+  VisitedLocation.assign(NumCells, false);
+  NumServed = 0;
+  NumCellsPose = 0;
+  NumCellsLocation = 0;
+  NumRejected = 0;
+  NumForced = 0;
+  SumStepDistance = 0.0;
+  CountCoverage();
+}
+
+void TrajectorySampler::SetLowDiscrepancy(const Mode _Sampling, const uint64 IndexStart, const uint64 IndexStride, const float (&_Offsets)[NumAxes],
+  const float _MinDistance, const uint32 DistanceWindow)
+{
+  Sampling = _Sampling;
+  Index = IndexStart;
+  Stride = FMath::Max<uint64>(IndexStride, 1);
+  for(uint32 Target = 0; Target < NumAxes; ++Target)
+  {
+    Offsets[Target] = _Offsets[Target] - FMath::FloorToFloat(_Offsets[Target]);
+    Recent[Target].assign(_MinDistance > 0.0f ? DistanceWindow : 0, 0.0f);
+  }
+  MinDistance = _MinDistance;
+  NumRecent = 0;
+  NextRecent = 0;
+}
+
+void TrajectorySampler::Next()
+{
+  if(++Cursor == BlockSize)
+  {
+    GenerateBlock();
+    Cursor = 0;
+  }
+  CountCoverage();
+}
+
+void TrajectorySampler::Skip(uint64 Count)
+{
+  while(Count > GetNumAhead())
+  {
+    Count -= GetNumAhead() + 1;
+    GenerateBlock();
+    Cursor = 0;
+  }
+  Cursor += (uint32)Count;
+}
+
+float TrajectorySampler::Get(const Axis Target) const
+{
+  return Values[Target][Cursor];
+}
+
+int32 TrajectorySampler::GetDirection(const Axis Target) const
+{
+  return Directions[Target][Cursor];
+}
+
+uint32 TrajectorySampler::GetNumAhead() const
+{
+  return BlockSize - Cursor - 1;
+}
+
+const float *TrajectorySampler::GetAhead(const Axis Target) const
+{
+  return Values[Target].data() + Cursor + 1;
+}
+
+void TrajectorySampler::GenerateBlock()
+{
+  if(Sampling == Mode::RandomWalk)
+  {
+    GenerateWalk();
+  }
+  else
+  {
+    GenerateLowDiscrepancy();
+  }
+}
+
+void TrajectorySampler::GenerateWalk()
+{
+  Random->Fill(Draws.data(), Draws.size());
+
+  // Axes are independent of each other, so each one is walked through the whole block at once
+  for(uint32 Target = 0; Target < NumAxes; ++Target)
+  {
+    const Bounds &Limit = Limits[Target];
+    const uint32 *Draw = Draws.data() + Target * BlockSize;
+    float *Value = Values[Target].data();
+    int32 *Direction = Directions[Target].data();
+    float Current = Last[Target];
+
+    for(uint32 Step = 0; Step < BlockSize; ++Step)
+    {
+      // Allowed directions in the order -1, 0, +1. Staying is always allowed, so there are 1 to 3 of them.
+      const uint32 Down = Current - Limit.Step >= Limit.Min;
+      const uint32 Up = Current + Limit.Step <= Limit.Max;
+      const uint32 Count = 1 + Down + Up;
+
+      // Maps the random value to one of the allowed directions (multiply and shift instead of modulo, bias below 2^-31)
+      const int32 Choice = (int32)(((uint64)Draw[Step] * Count) >> 32) - (int32)Down;
+      Current += Limit.Step * Choice;
+      Value[Step] = Current;
+      Direction[Step] = Choice;
+    }
+    Last[Target] = Current;
+  }
+}
+
+void TrajectorySampler::GenerateLowDiscrepancy()
+{
+  for(uint32 Step = 0; Step < BlockSize; ++Step)
+  {
+    // Skip candidates close to recent poses, but don't get stuck once the bounds are densely covered
+    float Normalized[NumAxes];
+    for(uint32 Attempt = 1; ; ++Attempt)
+    {
+      for(uint32 Target = 0; Target < NumAxes; ++Target)
+      {
+        const float Shifted = Sequence(Target, Index) + Offsets[Target];
+        Normalized[Target] = Shifted >= 1.0f ? Shifted - 1.0f : Shifted;
+      }
+      Index += Stride;
+
+      if(IsFarEnough(Normalized))
+      {
+        break;
+      }
+      if(Attempt == MaxAttempts)
+      {
+        ++NumForced;
+        break;
+      }
+      ++NumRejected;
+    }
+    Remember(Normalized);
+
+    for(uint32 Target = 0; Target < NumAxes; ++Target)
+    {
+      const float Value = Limits[Target].Min + Normalized[Target] * (Limits[Target].Max - Limits[Target].Min);
+      Values[Target][Step] = Value;
+      Directions[Target][Step] = (Value > Last[Target]) - (Value < Last[Target]);
+      Last[Target] = Value;
+    }
+  }
+}
+
+float TrajectorySampler::Sequence(const uint32 Target, const uint64 Position) const
+{
+  if(Sampling == Mode::Sobol)
+  {
+    // Gray code order, so that consecutive elements differ in a single direction number
+    uint32 Gray = (uint32)(Position ^ (Position >> 1));
+    uint32 Result = 0;
+    for(uint32 Bit = 0; Gray != 0; ++Bit, Gray >>= 1)
+    {
+      Result ^= (Gray & 1) ? SobolDirections[Target][Bit] : 0;
+    }
+    return (Result >> 8) * (1.0f / 16777216.0f);
+  }
+
+  // Radical inverse of the position in the base of the axis
+  const uint32 Base = HaltonBases[Target];
+  const double InverseBase = 1.0 / Base;
+  double Factor = InverseBase, Result = 0.0;
+  for(uint64 Remaining = Position; Remaining > 0; Remaining /= Base)
+  {
+    Result += (Remaining % Base) * Factor;
+    Factor *= InverseBase;
+  }
+  return std::min((float)Result, 0.99999994f);
+}
+
+void TrajectorySampler::Normalize(const float (&Pose)[NumAxes], float (&Normalized)[NumAxes]) const
+{
+  for(uint32 Target = 0; Target < NumAxes; ++Target)
+  {
+    const float Range = Limits[Target].Max - Limits[Target].Min;
+    Normalized[Target] = Range > 0.0f ? FMath::Clamp((Pose[Target] - Limits[Target].Min) / Range, 0.0f, 1.0f) : 0.0f;
+  }
+}
+
+bool TrajectorySampler::IsFarEnough(const float (&Normalized)[NumAxes]) const
+{
+  const float MinDistanceSquared = MinDistance * MinDistance;
+  for(uint32 Entry = 0; Entry < NumRecent; ++Entry)
+  {
+    float DistanceSquared = 0.0f;
+    for(uint32 Target = 0; Target < NumAxes; ++Target)
+    {
+      const float Difference = Recent[Target][Entry] - Normalized[Target];
+      DistanceSquared += Difference * Difference;
+    }
+    if(DistanceSquared < MinDistanceSquared)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+void TrajectorySampler::Remember(const float (&Normalized)[NumAxes])
+{
+  const uint32 Size = Recent[0].size();
+  if(Size == 0)
+  {
+    return;
+  }
+
+  for(uint32 Target = 0; Target < NumAxes; ++Target)
+  {
+    Recent[Target][NextRecent] = Normalized[Target];
+  }
+  NextRecent = (NextRecent + 1) % Size;
+  NumRecent = std::min(NumRecent + 1, Size);
+}
+
+void TrajectorySampler::CountCoverage()
+{
+  float Pose[NumAxes], Normalized[NumAxes];
+  for(uint32 Target = 0; Target < NumAxes; ++Target)
+  {
+    Pose[Target] = Values[Target][Cursor];
+  }
+  Normalize(Pose, Normalized);
+
+  // Cell of the pose in a grid over the bounds, axes without a range are left out
+  uint32 CellPose = 0, CellLocation = 0;
+  for(uint32 Target = 0; Target < NumAxes; ++Target)
+  {
+    if(Limits[Target].Max > Limits[Target].Min)
+    {
+      CellPose = CellPose * CellsPerAxisPose + std::min((uint32)(Normalized[Target] * CellsPerAxisPose), CellsPerAxisPose - 1);
+      if(Target <= AxisZ)
+      {
+        CellLocation = CellLocation * CellsPerAxisLocation + std::min((uint32)(Normalized[Target] * CellsPerAxisLocation), CellsPerAxisLocation - 1);
+      }
+    }
+  }
+  if(!VisitedPose[CellPose])
+  {
+    VisitedPose[CellPose] = true;
+    ++NumCellsPose;
+  }
+  if(!VisitedLocation[CellLocation])
+  {
+    VisitedLocation[CellLocation] = true;
+    ++NumCellsLocation;
+  }
+
+  // Distance to the previous pose, small values mean nearly identical frames
+  if(NumServed > 0)
+  {
+    float DistanceSquared = 0.0f;
+    for(uint32 Target = 0; Target < NumAxes; ++Target)
+    {
+      DistanceSquared += (Normalized[Target] - Previous[Target]) * (Normalized[Target] - Previous[Target]);
+    }
+    SumStepDistance += FMath::Sqrt(DistanceSquared);
+  }
+  for(uint32 Target = 0; Target < NumAxes; ++Target)
+  {
+    Previous[Target] = Normalized[Target];
+  }
+  ++NumServed;
+}
+
+void TrajectorySampler::LogCoverage() const
+{
+  if(NumServed == 0)
+  {
+    return;
+  }
+
+  const TCHAR *Name = Sampling == Mode::Sobol ? TEXT("Sobol") : Sampling == Mode::Halton ? TEXT("Halton") : TEXT("random walk");
+  OUT_INFO(TEXT("Trajectory (%s): %llu poses, visited cells: %llu of %u poses (%.1f%%), %llu of %u locations (%.1f%%), mean step: %.4f"), Name, NumServed,
+    NumCellsPose, (uint32)VisitedPose.size(), NumCellsPose * 100.0 / VisitedPose.size(), NumCellsLocation, (uint32)VisitedLocation.size(),
+    NumCellsLocation * 100.0 / VisitedLocation.size(), NumServed > 1 ? SumStepDistance / (NumServed - 1) : 0.0);
+  if(MinDistance > 0.0f)
+  {
+    OUT_INFO(TEXT("Candidates closer than %.4f to a recent pose: %llu skipped, %llu accepted after %u attempts"), MinDistance, NumRejected, NumForced, MaxAttempts);
+  }
+}
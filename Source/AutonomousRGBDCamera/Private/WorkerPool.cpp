@@ -0,0 +1,225 @@
+// Copyright 2017, Institute for Artificial Intelligence - University of Bremen
+
+#include "WorkerPool.h"
+#include "StopTime.h"
+#include <algorithm>
+
+WorkerPool::WorkerPool() : Pending(0), Stopping(false), NextWorker(0), PeriodBusyTime(0)
+{
+}
+
+WorkerPool::~WorkerPool()
+{
+  Stop();
+}
+
+void WorkerPool::Start(uint32 NumThreads)
+{
+  if(NumThreads == 0)
+  {
+    NumThreads = std::max<uint32>(std::thread::hardware_concurrency(), 1);
+  }
+
+  Stopping = false;
+  for(uint32 Index = 0; Index < NumThreads; ++Index)
+  {
+    std::unique_ptr<Worker> NewWorker(new Worker());
+    NewWorker->BusyTime = 0;
+    Workers.push_back(std::move(NewWorker));
+  }
+  // Threads are started after all workers exist, because they steal from each other
+  for(uint32 Index = 0; Index < NumThreads; ++Index)
+  {
+    Workers[Index]->Thread = std::thread(&WorkerPool::WorkerLoop, this, Index);
+  }
+
+  PeriodStart = std::chrono::steady_clock::now();
+  PeriodBusyTime = 0;
+  OUT_INFO(TEXT("Worker pool started with %u threads."), NumThreads);
+}
+
+void WorkerPool::Stop()
+{
+  if(Workers.empty())
+  {
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> Lock(LockWait);
+    Stopping = true;
+  }
+  CVWork.notify_all();
+
+  for(std::unique_ptr<Worker> &Entry : Workers)
+  {
+    Entry->Thread.join();
+  }
+  Workers.clear();
+}
+
+uint32 WorkerPool::GetNumThreads() const
+{
+  return Workers.size();
+}
+
+void WorkerPool::Submit(Job &Target, const uint32 NumTiles)
+{
+  if(NumTiles == 0 || Workers.empty())
+  {
+    // Without workers the job is processed right away
+    for(uint32 Tile = 0; Tile < NumTiles; ++Tile)
+    {
+      Target.Work(Tile);
+    }
+    Target.Done();
+    return;
+  }
+
+  Target.Remaining = NumTiles;
+
+  // Every worker gets a consecutive share, starting with a different worker for each job
+  const uint32 NumWorkers = Workers.size();
+  const uint32 Shares = std::min(NumWorkers, NumTiles);
+  const uint32 First = NextWorker.fetch_add(Shares);
+  {
+    // Lock, so that no worker misses the tiles between checking and waiting. Pending is increased first, awake workers
+    // may take tiles as soon as they are queued.
+    std::lock_guard<std::mutex> Lock(LockWait);
+    Pending += NumTiles;
+
+    uint32 Begin = 0;
+    for(uint32 Share = 0; Share < Shares; ++Share)
+    {
+      const uint32 End = Begin + (NumTiles - Begin) / (Shares - Share);
+      Worker &Owner = *Workers[(First + Share) % NumWorkers];
+      std::lock_guard<std::mutex> LockQueue(Owner.Lock);
+      Owner.Queue.push_back({&Target, Begin, End});
+      Begin = End;
+    }
+  }
+  CVWork.notify_all();
+}
+
+bool WorkerPool::HasQueuedTiles()
+{
+  if(Pending == 0)
+  {
+    return false;
+  }
+  for(std::unique_ptr<Worker> &Entry : Workers)
+  {
+    std::lock_guard<std::mutex> Lock(Entry->Lock);
+    if(!Entry->Queue.empty())
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool WorkerPool::TakeTile(Worker &Owner, Range &Tile)
+{
+  std::lock_guard<std::mutex> Lock(Owner.Lock);
+  if(Owner.Queue.empty())
+  {
+    return false;
+  }
+
+  // Take one tile from the front, the rest stays available for thieves
+  Range &Front = Owner.Queue.front();
+  Tile.Target = Front.Target;
+  Tile.Begin = Front.Begin;
+  Tile.End = Front.Begin + 1;
+  if(++Front.Begin == Front.End)
+  {
+    Owner.Queue.pop_front();
+  }
+  --Pending;
+  return true;
+}
+
+bool WorkerPool::StealTiles(const uint32 Thief)
+{
+  const uint32 NumWorkers = Workers.size();
+  Worker &Owner = *Workers[Thief];
+  for(uint32 Offset = 1; Offset < NumWorkers; ++Offset)
+  {
+    Worker &Victim = *Workers[(Thief + Offset) % NumWorkers];
+
+    // Both queues are locked, so the stolen tiles are always visible in one of them
+    std::unique_lock<std::mutex> LockVictim(Victim.Lock, std::defer_lock), LockOwner(Owner.Lock, std::defer_lock);
+    std::lock(LockVictim, LockOwner);
+    if(Victim.Queue.empty())
+    {
+      continue;
+    }
+
+    // Take the upper half of the last range, the victim continues at the front
+    Range &Back = Victim.Queue.back();
+    const uint32 Middle = Back.Begin + (Back.End - Back.Begin) / 2;
+    Owner.Queue.push_back({Back.Target, Middle, Back.End});
+    Back.End = Middle;
+    if(Back.Begin == Back.End)
+    {
+      Victim.Queue.pop_back();
+    }
+    return true;
+  }
+  return false;
+}
+
+void WorkerPool::RunTile(Worker &Owner, const Range &Tile)
+{
+  const auto Start = std::chrono::steady_clock::now();
+  Tile.Target->Work(Tile.Begin);
+  Owner.BusyTime += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - Start).count();
+
+  if(--Tile.Target->Remaining == 0)
+  {
+    Tile.Target->Done();
+  }
+}
+
+void WorkerPool::WorkerLoop(const uint32 Index)
+{
+  Worker &Owner = *Workers[Index];
+  while(true)
+  {
+    Range Tile;
+    if(TakeTile(Owner, Tile))
+    {
+      RunTile(Owner, Tile);
+      continue;
+    }
+    if(StealTiles(Index))
+    {
+      continue;
+    }
+
+    // Nothing left to do, sleep until new tiles are submitted. Queued tiles are finished before stopping.
+    std::unique_lock<std::mutex> Lock(LockWait);
+    CVWork.wait(Lock, [this] {return Stopping || HasQueuedTiles(); });
+    if(Stopping && !HasQueuedTiles())
+    {
+      break;
+    }
+  }
+}
+
+float WorkerPool::GetUtilization()
+{
+  uint64 BusyTime = 0;
+  for(const std::unique_ptr<Worker> &Entry : Workers)
+  {
+    BusyTime += Entry->BusyTime;
+  }
+
+  const auto Now = std::chrono::steady_clock::now();
+  const double Elapsed = std::chrono::duration<double, std::nano>(Now - PeriodStart).count() * std::max<size_t>(Workers.size(), 1);
+  const float Utilization = Elapsed > 0.0 ? (float)((BusyTime - PeriodBusyTime) / Elapsed) : 0.0f;
+
+  PeriodStart = Now;
+  PeriodBusyTime = BusyTime;
+  return Utilization;
+}
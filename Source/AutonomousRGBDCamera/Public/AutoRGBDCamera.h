@@ -15,8 +15,19 @@
 #include "DefaultRGBDCamera.h"
 #include "CameraTrajectory.h"
 #include "SceneConfiguration.h"
+#include "PCGStream.h"
+#include "TrajectorySampler.h"
 #include "AutoRGBDCamera.generated.h"
 
+// Steps of the lockstep generation
+enum class ELockstepState : uint8
+{
+	// Waiting for the scene to settle after randomizing it
+	Settle,
+	// Waiting for the capture of the current scene to be handed to the server
+	WaitForHandoff
+};
+
 UCLASS()
 class AUTONOMOUSRGBDCAMERA_API AAutoRGBDCamera : public ADefaultRGBDCamera
 {
@@ -49,15 +60,27 @@ public:
 	// Get X, Y, Z, Roll, Pitch and Yaw values
 	void GetLocationAndRotationValues();
 
-	// Generates a value within bounds for the variable used as the parameter
-	float GenerateValueInBounds(FString VariableName);
-
-	// Check if value is >= min and <= max (bounds) after the step in a certain direction
-	bool CheckInBounds(float Min, float Max, float Step, float Value, int32 Direction);
+	// Start the random walk of the pose at the current location and rotation
+	void InitializePoseSampler();
 
 	// Update SceneGraph using the current annotation data
 	void UpdateSceneGraph();
 
+	// Move the camera to a new pose and randomize the scene objects
+	void RandomizeScene(float DeltaTime);
+
+	// Move the camera to the current pose of PoseSampler
+	void ApplyPose();
+
+	// Move the camera and the scene forward by Count frames without rendering them
+	void SkipFrames(uint64 Count);
+
+	// One step of the lockstep generation, called by Tick() instead of the wall clock based capturing
+	void LockstepTick(float DeltaTime);
+
+	// Report the progress towards FrameBudget and quit once it is reached, returns true if no frames should be generated anymore
+	bool CheckFrameBudget();
+
 
 	// Checkbox to enable Tick()
 	UPROPERTY(EditAnywhere)
@@ -79,6 +102,76 @@ public:
 	UPROPERTY(EditAnywhere)
 	bool ShowSpatialRelationships;
 
+	// Generate frames as fast as the pipeline allows: randomize the scene, let it settle, capture it and continue
+	// as soon as the frame was handed to the server. The engine runs with a fixed time step instead of the wall clock,
+	// so runs are reproducible. TickInterval and Framerate are ignored.
+	UPROPERTY(EditAnywhere)
+	bool bLockstep;
+
+	// Simulated seconds per engine frame in lockstep mode
+	UPROPERTY(EditAnywhere, meta = (ClampMin = "0.001", EditCondition = "bLockstep"))
+	float FixedTimeStep;
+
+	// Engine frames between randomizing the scene and capturing it in lockstep mode.
+	// Without bCaptureOnDemand at least 1 is needed, so that the captures rendered the new scene.
+	UPROPERTY(EditAnywhere, meta = (ClampMin = "0", EditCondition = "bLockstep"))
+	int32 SettleTicks;
+
+	// Seed of the random streams. Together with ShardId it selects the sequence of poses and scene changes,
+	// so a run can be reproduced and every shard generates different frames
+	UPROPERTY(EditAnywhere)
+	int32 Seed;
+
+	// Random stream of the camera trajectory, the scene configuration has its own ones
+	PCGStream RandomTrajectory;
+
+	// Index of the first frame to generate. The frames of the run before it are skipped without rendering them,
+	// so any range of a lockstep run can be generated again from Seed and ShardId.
+	UPROPERTY(EditAnywhere, meta = (ClampMin = "0"))
+	int32 FirstFrame;
+
+	// Frames left to skip until FirstFrame
+	uint64 FramesToSkip;
+
+	// Number of poses generated ahead of time as one block
+	UPROPERTY(EditAnywhere, meta = (ClampMin = "1"))
+	int32 PoseBlockSize;
+
+	// Poses within the bounds of CameraTrajectory, a random walk or a low-discrepancy sequence
+	TrajectorySampler PoseSampler;
+
+	// Current step of the lockstep generation
+	ELockstepState LockstepState;
+
+	// Engine frames left until the scene is captured
+	int32 SettleTicksLeft;
+
+	// Number of published frames that signals the handoff of the last capture
+	uint64 LockstepFramesPublished;
+
+	// Quit the game once this many frames were handed to the server, 0 generates frames until the game is stopped.
+	// Exact in lockstep mode, otherwise frames still in flight are published as well.
+	UPROPERTY(EditAnywhere, meta = (ClampMin = "0"))
+	int32 FrameBudget;
+
+	// Seconds between two progress reports while a FrameBudget is set
+	UPROPERTY(EditAnywhere, meta = (ClampMin = "0.1"))
+	float ProgressInterval;
+
+	// Move the camera into the middle of the CameraTrajectory bounds on BeginPlay,
+	// e.g. when it was spawned from the command line (see BatchGeneration.h)
+	UPROPERTY(EditAnywhere)
+	bool bStartInBounds;
+
+	// Wall clock time of BeginPlay and of the last progress report
+	double TimeStart, TimeLastReport;
+
+	// Published frames at the last progress report
+	uint64 FramesLastReport;
+
+	// FrameBudget was reached and quitting was requested
+	bool bBudgetReached;
+
 
 	// Camera trajectory
 	UPROPERTY(EditAnywhere)
@@ -0,0 +1,46 @@
+// Copyright 2017, Institute for Artificial Intelligence - University of Bremen
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/World.h"
+
+/**
+ * Headless batch generation configured from the command line. If the game is started with -AutoRGBDFrames=N,
+ * an AAutoRGBDCamera is spawned into the loaded map, or the one placed in it is used. It generates exactly N frames
+ * in lockstep mode and quits the game afterwards. Progress and throughput are logged, -stdout prints them to the console:
+ *
+ *   UE4Editor MyProject.uproject /Game/Maps/Kitchen -game -RenderOffscreen -unattended -stdout
+ *     -AutoRGBDFrames=10000 -AutoRGBDOutput=/data/kitchen.bin
+ *
+ * Further options:
+ *   -AutoRGBDOutput=<file>   Write the packets into a file (see FileSink.h), otherwise they are sent via TCP
+ *   -AutoRGBDPort=<port>     TCP port of the server
+ *   -AutoRGBDWidth=<pixels>, -AutoRGBDHeight=<pixels>
+ *   -AutoRGBDStep=<seconds>  Fixed time step of the simulation
+ *   -AutoRGBDSettle=<ticks>  Engine frames between randomizing the scene and capturing it
+ *   -AutoRGBDSeed=<seed>     Seed of the random streams
+ *   -AutoRGBDShard=<id> -AutoRGBDShards=<count>
+ *                            Shard of this process when several generate one dataset, each shard draws from its
+ *                            own random stream. PacketRelay merges the output of the shards into one socket.
+ *   -AutoRGBDFirstFrame=<index>
+ *                            Start at this frame of the run with the same seed and shard, e.g. to generate a range
+ *                            of it again. The frames before it are skipped without rendering them.
+ */
+class AUTONOMOUSRGBDCAMERA_API BatchGeneration
+{
+private:
+	static FDelegateHandle WorldHandle;
+
+	// Spawns or configures the camera before the world begins play
+	static void OnWorldInitializedActors(const UWorld::FActorsInitializedParams &Params);
+
+	// Applies the command line options to a camera
+	static void Configure(class AAutoRGBDCamera &Camera, const TCHAR *CommandLine, const int32 Frames);
+
+public:
+	// Starts batch generation for every game world if the command line requests it
+	static void Register();
+
+	static void Unregister();
+};
@@ -126,4 +126,15 @@ public:
 	// Step length for Yaw
 	UPROPERTY(EditAnywhere)
 	float YawStep;
+
+
+	// How poses are chosen: "RandomWalk" moves by one step per axis, "Halton" and "Sobol" jump through
+	// low-discrepancy sequences that cover the bounds evenly and ignore the step lengths
+	UPROPERTY(EditAnywhere)
+	FString Mode;
+
+	// Minimum distance of a new pose to the recent ones in the Halton and Sobol modes, measured with every axis
+	// scaled to the range 0 to 1. 0 accepts every pose.
+	UPROPERTY(EditAnywhere)
+	float MinPoseDistance;
 };
\ No newline at end of file
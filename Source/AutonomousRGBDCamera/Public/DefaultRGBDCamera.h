@@ -11,6 +11,18 @@
 #include "PacketBuffer.h"
 #include "DefaultRGBDCamera.generated.h"
 
+// Encoding of the depth image in the packets
+UENUM()
+enum class EDepthFormat : uint8
+{
+	// Half floats as rendered by the depth material
+	Float16,
+	// 32 bit floats in meters
+	Meters,
+	// 16 bit unsigned integers in millimeters, clamped to 0 to 65535
+	Millimeters
+};
+
 UCLASS()
 class AUTONOMOUSRGBDCAMERA_API ADefaultRGBDCamera : public ACameraActor
 {
@@ -41,6 +53,13 @@ public:
 	// Check if paused
 	bool IsPaused() const;
 
+	// Captures a frame right away, independent of the framerate. Returns false if the frame was skipped,
+	// because no client is connected, all frames are in flight or no packet is free.
+	bool CaptureFrame();
+
+	// Number of frames handed over to the server so far
+	uint64 GetFramesPublished() const;
+
 	// Camera Width
 	UPROPERTY(EditAnywhere, Category = "RGB-D Settings")
 	uint32 Width;
@@ -70,6 +89,102 @@ public:
 	UPROPERTY(EditAnywhere, Category = "RGB-D Settings")
 	bool bBindToAnyIP;
 
+	// Additionally listen on this AF_UNIX socket path, empty disables it.
+	// Local clients receive every frame as a memfd descriptor, so the images are not copied through the socket.
+	// Access is restricted to the user and group of the socket file (Linux only)
+	UPROPERTY(EditAnywhere, Category = "RGB-D Settings")
+	FString UnixSocketPath;
+
+	// Publish packets into a POSIX shared memory ring instead of sending them via TCP.
+	// Consumers on the same host map the packets without copies (Linux only, see SharedMemoryRing.h)
+	UPROPERTY(EditAnywhere, Category = "RGB-D Settings")
+	bool bUseSharedMemory;
+
+	// Name of the shared memory object, readers open it with the same name
+	UPROPERTY(EditAnywhere, Category = "RGB-D Settings", meta = (EditCondition = "bUseSharedMemory"))
+	FString SharedMemoryName;
+
+	// Write the packets into this file instead of sending them, empty disables it.
+	// The packets are stored back to back, no client has to be connected (see FileSink.h)
+	UPROPERTY(EditAnywhere, Category = "RGB-D Settings")
+	FString OutputFile;
+
+	// Shard of this camera when several processes generate one dataset, written into every packet.
+	// Subclasses derive their random streams from it, so that the shards generate different frames
+	UPROPERTY(EditAnywhere, Category = "RGB-D Settings", meta = (ClampMin = "0"))
+	int32 ShardId;
+
+	// Number of processes generating the same dataset
+	UPROPERTY(EditAnywhere, Category = "RGB-D Settings", meta = (ClampMin = "1"))
+	int32 ShardCount;
+
+	// Number of preallocated packets between capturing and sending.
+	// More packets allow the server to fall further behind before frames get lost.
+	UPROPERTY(EditAnywhere, Category = "RGB-D Settings", meta = (ClampMin = "2"))
+	int32 PacketSlots;
+
+	// If all packets are in use, overwrite the oldest packet that was not sent yet.
+	// Otherwise the newest frame is skipped.
+	UPROPERTY(EditAnywhere, Category = "RGB-D Settings")
+	bool bDropOldestPackets;
+
+	// Number of packets queued per client before frames are skipped for it.
+	// All clients together never pin more packets than PacketSlots leaves besides the frames in flight,
+	// beyond that the oldest queued packets are dropped (Linux only)
+	UPROPERTY(EditAnywhere, Category = "RGB-D Settings", meta = (ClampMin = "1"))
+	int32 ClientQueueLimit;
+
+	// Disconnect clients that had to skip SlowClientLag frames in a row,
+	// instead of only skipping frames for them (Linux only)
+	UPROPERTY(EditAnywhere, Category = "RGB-D Settings")
+	bool bDisconnectSlowClients;
+
+	UPROPERTY(EditAnywhere, Category = "RGB-D Settings", meta = (ClampMin = "1", EditCondition = "bDisconnectSlowClients"))
+	int32 SlowClientLag;
+
+	// Leave packets in the ring while a client's queue is full, so that slow clients slow down the camera
+	// instead of missing frames. Takes precedence over bDisconnectSlowClients (Linux only)
+	UPROPERTY(EditAnywhere, Category = "RGB-D Settings")
+	bool bWaitForSlowClients;
+
+	// Seconds EndPlay waits for connected clients to receive the queued packets before closing their sockets.
+	// The game thread is blocked meanwhile, 0 closes them right away.
+	UPROPERTY(EditAnywhere, Category = "RGB-D Settings", meta = (ClampMin = "0"))
+	float StopDrainTimeout;
+
+	// Send large packets with MSG_ZEROCOPY, so that the kernel reads the images
+	// directly from the packet instead of copying them (Linux only)
+	UPROPERTY(EditAnywhere, Category = "RGB-D Settings")
+	bool bZeroCopySend;
+
+	// Number of threads converting the images, 0 uses one per logical core.
+	// All channels share these threads, so a large image does not leave the others idle
+	UPROPERTY(EditAnywhere, Category = "RGB-D Settings", meta = (ClampMin = "0"))
+	int32 WorkerThreads;
+
+	// Render the scene captures only for frames that are sent to at least one client,
+	// instead of rendering every capture component on every engine frame
+	UPROPERTY(EditAnywhere, Category = "RGB-D Settings")
+	bool bCaptureOnDemand;
+
+	// Read the images back from the GPU asynchronously instead of waiting for it on the game thread.
+	// Every frame keeps the timestamp and pose of its capture, but is sent ReadbackLatency frames later
+	UPROPERTY(EditAnywhere, Category = "RGB-D Settings")
+	bool bAsyncReadback;
+
+	// Number of engine frames the GPU has to finish a readback before the game thread waits for it
+	UPROPERTY(EditAnywhere, Category = "RGB-D Settings", meta = (ClampMin = "1", ClampMax = "3", EditCondition = "bAsyncReadback"))
+	int32 ReadbackLatency;
+
+	// Number of frames that can be converted and published at the same time.
+	// Frames are still published in the order they were captured
+	UPROPERTY(EditAnywhere, Category = "RGB-D Settings", meta = (ClampMin = "1"))
+	int32 FramesInFlight;
+
+	// Number of image rows converted as one piece of work by a worker thread
+	UPROPERTY(EditAnywhere, Category = "RGB-D Settings", meta = (ClampMin = "1"))
+	int32 TileRows;
+
 	// Capture color image
 	UPROPERTY(EditAnywhere, Category = "RGB-D Settings")
 	bool bCaptureColorImage;
@@ -78,6 +193,10 @@ public:
 	UPROPERTY(EditAnywhere, Category = "RGB-D Settings")
 	bool bCaptureDepthImage;
 
+	// Encoding of the depth image, converted while extracting it from the render target
+	UPROPERTY(EditAnywhere, Category = "RGB-D Settings", meta = (EditCondition = "bCaptureDepthImage"))
+	EDepthFormat DepthFormat;
+
 	// Capture object mask image
 	UPROPERTY(EditAnywhere, Category = "RGB-D Settings")
 	bool bCaptureObjectMaskImage;
@@ -110,6 +229,10 @@ public:
 	// Scene graph for annotation data
 	PacketBuffer::SceneGraph SceneGraph;
 
+protected:
+	// Tick does not capture frames on its own, CaptureFrame is called by the subclass instead
+	bool bManualCapture;
+
 private:
 	// Camera capture component for color images (RGB)
 	USceneCaptureComponent2D* ColorImgCaptureComp;
@@ -130,12 +253,9 @@ private:
 	// Are the capture components active
 	bool bCompActive;
 
-	// Buffers for reading the data from the GPU
-	TArray<FFloat16Color>  ImageDepth, ImageObject;
-
 	float FrameTime, TimePassed;
 	TArray<uint8> DataColor, DataDepth, DataObject;
-	TArray<FColor>ImageColor, ObjectColors;
+	TArray<FColor> ObjectColors;
 	TMap<FString, uint32> ObjectToColor;
 	uint32 ColorsUsed;
 	TArray<uint32> FreedColors;
@@ -146,17 +266,14 @@ private:
 	void ShowFlagsLit(FEngineShowFlags &ShowFlags) const;
 	void ShowFlagsPostProcess(FEngineShowFlags &ShowFlags) const;
 	void ShowFlagsVertexColor(FEngineShowFlags &ShowFlags) const;
-	void ReadImage(UTextureRenderTarget2D *RenderTarget, TArray<FFloat16Color> &ImageData) const;
-        void ReadColorImage(UTextureRenderTarget2D *RenderTarget, TArray<FColor> &ImageData) const;
-	void ToColorImage(const TArray<FFloat16Color> &ImageData, uint8 *Bytes) const;
-        void ToColorRGBImage(const TArray<FColor> &ImageData, uint8 *Bytes) const;
-	void ToDepthImage(const TArray<FFloat16Color> &ImageData, uint8 *Bytes) const;
+	void ReadImage(class ImageReadback &Readback, TArray<uint8> &ImageData) const;
+        void ReadColorImage(class ImageReadback &Readback, TArray<FColor> &ImageData) const;
+        void ToColorRGBImage(const TArray<FColor> &ImageData, uint8 *Bytes, const uint32 Begin, const uint32 Count) const;
+	void ToDepthImage(const TArray<uint8> &ImageData, uint8 *Bytes, const uint32 Begin, const uint32 Count) const;
 	void StoreImage(const uint8 *ImageData, const uint32 Size, const char *Name) const;
 	void GenerateColors(const uint32_t NumberOfColors);
 	bool ColorObject(AActor *Actor, const FString &name);
 	bool ColorAllObjects();
 	void RemoveNonExistingActorsFromColorMap();
-	void ProcessColor();
-	void ProcessDepth();
-	void ProcessObject();
+	void FinishChannel(const uint32 Index);
 };
\ No newline at end of file
@@ -0,0 +1,42 @@
+// Copyright 2017, Institute for Artificial Intelligence - University of Bremen
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "PacketBuffer.h"
+#include <thread>
+
+class IFileHandle;
+
+/**
+ * Writes the packets of a PacketBuffer into a file instead of sending them, e.g. for batch generation without a client.
+ * The packets are stored back to back in the format described in PacketBuffer.h, PacketHeader::Size leads to the next one.
+ * Stop writes the packets that are still queued before closing the file, so no committed packet is lost.
+ */
+class AUTONOMOUSRGBDCAMERA_API FileSink
+{
+private:
+  IFileHandle *File;
+  std::thread Thread;
+  volatile bool Running;
+
+  void ServerLoop();
+  void Write(const PacketBuffer::Packet &Packet);
+
+public:
+  // This pointer has to be set before starting the sink
+  TSharedPtr<PacketBuffer> Buffer;
+
+  // Statistics about the written packets and packets that could not be written
+  uint64 PacketsWritten, PacketsFailed, BytesWritten;
+
+  FileSink();
+  ~FileSink();
+
+  // Creates or truncates the file at Path
+  void Start(const FString &Path);
+  void Stop();
+
+  // The file acts as a client that is always connected
+  bool HasClient() const;
+};
@@ -0,0 +1,57 @@
+// Copyright 2017, Institute for Artificial Intelligence - University of Bremen
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * Conversion kernels from the render target formats to the packet format. Each conversion has a scalar
+ * reference implementation and vectorized variants, the fastest one supported by the CPU is selected at runtime.
+ * All functions work on pixel ranges, so an image can be split into tiles.
+ */
+class AUTONOMOUSRGBDCAMERA_API ImageConversion
+{
+public:
+  typedef void (*ColorToBGRKernel)(const FColor *, uint8 *, const uint32);
+  typedef void (*DepthToUInt16Kernel)(const FFloat16Color *, uint16 *, const uint32);
+  typedef void (*DepthToFloat32Kernel)(const FFloat16Color *, float *, const uint32);
+  typedef void (*MetersToMillimetersKernel)(const float *, uint16 *, const uint32);
+
+  // Kernels for one instruction set, nullptr for the conversions it has no variant of
+  struct KernelSet
+  {
+    const TCHAR *Name;
+    ColorToBGRKernel ColorToBGR;
+    DepthToUInt16Kernel DepthToFloat16;
+    DepthToFloat32Kernel DepthToFloat32;
+    DepthToUInt16Kernel DepthToMillimeters;
+    MetersToMillimetersKernel MetersToMillimeters;
+  };
+
+  // Converts Count BGRA pixels to packed BGR
+  static void ColorToBGR(const FColor *Source, uint8 *Target, const uint32 Count);
+  static void ColorToBGRScalar(const FColor *Source, uint8 *Target, const uint32 Count);
+
+  // Extracts the depth from the red channel of Count half float pixels and keeps the half floats
+  static void DepthToFloat16(const FFloat16Color *Source, uint16 *Target, const uint32 Count);
+  static void DepthToFloat16Scalar(const FFloat16Color *Source, uint16 *Target, const uint32 Count);
+
+  // Extracts the depth and converts it to 32 bit floats
+  static void DepthToFloat32(const FFloat16Color *Source, float *Target, const uint32 Count);
+  static void DepthToFloat32Scalar(const FFloat16Color *Source, float *Target, const uint32 Count);
+
+  // Extracts the depth, scales it by 1000 and rounds it to 16 bit integers clamped to 0 to 65535
+  static void DepthToMillimeters(const FFloat16Color *Source, uint16 *Target, const uint32 Count);
+  static void DepthToMillimetersScalar(const FFloat16Color *Source, uint16 *Target, const uint32 Count);
+
+  // Scales Count depth values in meters by 1000 and rounds them to 16 bit integers clamped to 0 to 65535,
+  // used for single channel 32 bit float render targets
+  static void MetersToMillimeters(const float *Source, uint16 *Target, const uint32 Count);
+  static void MetersToMillimetersScalar(const float *Source, uint16 *Target, const uint32 Count);
+
+  // Names of the selected kernels, e.g. for logging
+  static const TCHAR *GetKernelNames();
+
+  // Kernel sets the CPU supports, the scalar one first. Used to compare the variants with each other.
+  static TArray<KernelSet> GetSupportedKernels();
+};
@@ -0,0 +1,107 @@
+// Copyright 2017, Institute for Artificial Intelligence - University of Bremen
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "RHI.h"
+#include "Engine/TextureRenderTarget2D.h"
+#include <vector>
+#include <functional>
+
+/**
+ * Reads a render target back to the CPU through persistent staging textures. The pixels are copied row by row
+ * from the mapped staging texture directly into a buffer of the caller, so the readback does not allocate any memory,
+ * unlike ReadPixels and ReadFloat16Pixels which recreate their output array on every call.
+ *
+ * Read blocks until the GPU finished. ReadAsync only queues the copy into the staging texture of a slot and returns,
+ * the copy to the target happens on the render thread once the GPU fence of the slot passed, but at the latest
+ * Latency calls of Poll later. OnReady is called on the render thread afterwards.
+ *
+ * With the null RHI nothing is rendered, so the targets are filled with a test pattern instead.
+ */
+class AUTONOMOUSRGBDCAMERA_API ImageReadback
+{
+public:
+  // Called on the render thread when the image of a slot was copied to its target
+  std::function<void(const uint32 Slot)> OnReady;
+
+private:
+  // Readback waiting for the GPU
+  struct Request
+  {
+    uint8 *Target;
+    uint32 Slot;
+    // Number of polls since the request was queued
+    uint32 Age;
+  };
+
+  UTextureRenderTarget2D *RenderTarget;
+  // CPU readable copies of the render target and fences marking the end of the copies, one per slot.
+  // Only used on the render thread.
+  std::vector<FTexture2DRHIRef> Staging;
+  std::vector<FGPUFenceRHIRef> Fences;
+  // Ring of queued requests in the order of ReadAsync, only used on the render thread
+  std::vector<Request> Requests;
+  uint32 FirstRequest, NumRequests;
+  EPixelFormat Format;
+  uint32 Width, Height, BytesPerPixel, Latency;
+  // Number of images read, used for the test pattern
+  uint64 NumReads;
+
+  // Copies the render target to the staging texture of a slot, called on the render thread
+  void CopyToStaging(FRHICommandListImmediate &RHICmdList, FTextureRenderTargetResource *Resource, const uint32 Slot);
+
+  // Copies the staging texture of a slot to Target, waits for the GPU if the copy did not finish yet
+  void CopyToTarget(FRHICommandListImmediate &RHICmdList, const uint32 Slot, uint8 *Target);
+
+  // Completes the queued requests whose copy finished, all of them if Force is set
+  void CompleteRequests(FRHICommandListImmediate &RHICmdList, const bool Force);
+
+  // Fills Target with a pattern that changes with every image, used instead of the GPU with the null RHI
+  void FillTestPattern(uint8 *Target);
+
+  bool CheckSize(const uint32 Size) const;
+
+public:
+  ImageReadback();
+  ~ImageReadback();
+
+  // Uses the size and pixel format the render target currently has, has to be called after it was initialized.
+  // NumSlots images can be read asynchronously at the same time.
+  void Init(UTextureRenderTarget2D *_RenderTarget, const uint32 NumSlots = 1, const uint32 _Latency = 0);
+
+  // Releases the staging textures, queued requests are completed first
+  void Release();
+
+  // Size of a pixel in the format of the render target
+  uint32 GetBytesPerPixel() const;
+
+  // Size of a complete image in bytes
+  uint32 GetSize() const;
+
+  // Reads the render target into Target, which has to hold GetSize() bytes. Blocks until the GPU finished the copy.
+  bool Read(void *Target, const uint32 Size);
+
+  // Queues reading the current content of the render target into Target using the staging texture of Slot.
+  // Target has to stay valid until OnReady was called for the slot.
+  bool ReadAsync(const uint32 Slot, void *Target, const uint32 Size);
+
+  // Checks the queued requests on the render thread, should be called once per frame
+  void Poll();
+
+  // Completes all queued requests and waits for them
+  void Flush();
+
+  // Reads the render target into ImageData, which has to be preallocated with Width * Height pixels of the matching format
+  template<typename T>
+  bool Read(TArray<T> &ImageData)
+  {
+    return Read(ImageData.GetData(), ImageData.Num() * sizeof(T));
+  }
+
+  template<typename T>
+  bool ReadAsync(const uint32 Slot, TArray<T> &ImageData)
+  {
+    return ReadAsync(Slot, ImageData.GetData(), ImageData.Num() * sizeof(T));
+  }
+};
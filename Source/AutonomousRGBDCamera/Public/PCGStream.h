@@ -0,0 +1,146 @@
+// Copyright 2017, Institute for Artificial Intelligence - University of Bremen
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+// Subsystems drawing from their own stream, so each of them can be reproduced and run independently of the others.
+// At most 256 subsystems fit into a stream number.
+enum class ERandomSubsystem : uint32
+{
+  Trajectory,
+  SceneSwaps,
+  SceneDisables,
+  RotationJitter,
+  // Offsets of the low-discrepancy trajectory, drawn with shard 0 so that all shards share them
+  SequenceOffsets
+};
+
+/**
+ * Seedable PCG32 random number generator (permuted congruential generator, pcg-random.org). Generators with the
+ * same seed but a different stream number use different increments, so their sequences never overlap. This is used
+ * to give every shard of a distributed data generation its own reproducible sequence, independent of the global
+ * engine RNG that other engine code draws from as well.
+ *
+ * Values can be drawn one at a time or in batches. Every draw takes exactly one 32 bit value, so a consumer that draws
+ * a fixed number of values per frame knows the position of every frame in its stream, and Advance jumps there in
+ * logarithmic time without drawing everything before it.
+ */
+class AUTONOMOUSRGBDCAMERA_API PCGStream
+{
+private:
+  uint64 State;
+  uint64 Increment;
+
+public:
+  PCGStream(const uint64 Seed = 0, const uint64 Stream = 0)
+  {
+    SetSeed(Seed, Stream);
+  }
+
+  // Restarts the generator with the sequence selected by Seed and Stream
+  void SetSeed(const uint64 Seed, const uint64 Stream)
+  {
+    State = 0;
+    Increment = (Stream << 1) | 1;
+    Next();
+    State += Mix(Seed);
+    Next();
+  }
+
+  // Stream number of a subsystem in a shard, unique for every combination. It uses 40 bits, the increment keeps 63 of them.
+  static uint64 StreamOf(const uint32 ShardId, const ERandomSubsystem Subsystem)
+  {
+    return ((uint64)ShardId << 8) | ((uint32)Subsystem & 0xFF);
+  }
+
+  // Uniformly distributed 32 bit value
+  uint32 Next()
+  {
+    const uint64 Old = State;
+    State = Old * 6364136223846793005ULL + Increment;
+    const uint32 Shifted = (uint32)(((Old >> 18) ^ Old) >> 27);
+    const uint32 Rotation = (uint32)(Old >> 59);
+    return (Shifted >> Rotation) | (Shifted << ((0u - Rotation) & 31));
+  }
+
+  // Value from 0 to Range - 1 (multiply and shift instead of rejection, so the bias is below Range / 2^32)
+  uint32 Bounded(const uint32 Range)
+  {
+    return (uint32)(((uint64)Next() * Range) >> 32);
+  }
+
+  // Integer from Min to Max, both inclusive, like FMath::RandRange. Takes a value even if Max is not above Min.
+  int32 RandRange(const int32 Min, const int32 Max)
+  {
+    return Min + (int32)Bounded(Max > Min ? (uint32)(Max - Min) + 1 : 1);
+  }
+
+  // Float from 0 (inclusive) to 1 (exclusive) with 24 bits of precision
+  float FRand()
+  {
+    return (Next() >> 8) * (1.0f / 16777216.0f);
+  }
+
+  // Float from Min to Max, like FMath::FRandRange
+  float FRandRange(const float Min, const float Max)
+  {
+    return Min + (Max - Min) * FRand();
+  }
+
+  // Fills Target with Count uniformly distributed 32 bit values
+  void Fill(uint32 *Target, const uint32 Count)
+  {
+    for(uint32 Index = 0; Index < Count; ++Index)
+    {
+      Target[Index] = Next();
+    }
+  }
+
+  // Fills Target with Count integers from Min to Max, both inclusive
+  void FillRange(int32 *Target, const uint32 Count, const int32 Min, const int32 Max)
+  {
+    for(uint32 Index = 0; Index < Count; ++Index)
+    {
+      Target[Index] = RandRange(Min, Max);
+    }
+  }
+
+  // Fills Target with Count floats from Min to Max
+  void FillRange(float *Target, const uint32 Count, const float Min, const float Max)
+  {
+    const float Scale = (Max - Min) * (1.0f / 16777216.0f);
+    for(uint32 Index = 0; Index < Count; ++Index)
+    {
+      Target[Index] = Min + (Next() >> 8) * Scale;
+    }
+  }
+
+  // Skips Delta values in O(log Delta) steps (Brown, "Random Number Generation with Arbitrary Strides")
+  void Advance(uint64 Delta)
+  {
+    uint64 Multiplier = 6364136223846793005ULL, Add = Increment;
+    uint64 AccumulatedMultiplier = 1, AccumulatedAdd = 0;
+    while(Delta > 0)
+    {
+      if(Delta & 1)
+      {
+        AccumulatedMultiplier *= Multiplier;
+        AccumulatedAdd = AccumulatedAdd * Multiplier + Add;
+      }
+      Add = (Multiplier + 1) * Add;
+      Multiplier *= Multiplier;
+      Delta >>= 1;
+    }
+    State = AccumulatedMultiplier * State + AccumulatedAdd;
+  }
+
+  // SplitMix64 finalizer, spreads similar seeds (e.g. consecutive shard numbers) over the whole state space
+  static uint64 Mix(uint64 Value)
+  {
+    Value += 0x9E3779B97F4A7C15ULL;
+    Value = (Value ^ (Value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    Value = (Value ^ (Value >> 27)) * 0x94D049BB133111EBULL;
+    return Value ^ (Value >> 31);
+  }
+};
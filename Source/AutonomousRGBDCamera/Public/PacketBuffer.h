@@ -3,28 +3,78 @@
 #pragma once
 
 #include <mutex>
+#include <deque>
+#include <atomic>
 #include <vector>
+#include <functional>
 #include <condition_variable>
 
 /**
- * This is a double buffer, one for reading and one for writing. When writing is done they will be swapped.
- * It also acts as the connection between VisionCamera and Server. The StartReading method is blocking until
- * the DoneWriting method is called. So when the VisionActor is done writing, the StartReading methods returns
- * and the Server will start reading and sending the packet.
+ * This is a ring of preallocated packets. It acts as the connection between the camera and the server.
+ * The camera acquires a free packet with AcquireWrite, fills it and hands it over with CommitWrite. The server
+ * waits in AcquireRead for the oldest committed packet and gives it back with ReleaseRead. Writing never waits
+ * for reading: if no packet is free, the overflow policy decides whether the oldest queued packet is overwritten
+ * or the new frame is dropped.
  */
 class AUTONOMOUSRGBDCAMERA_API PacketBuffer
 {
 public:
   /**
-   * packet format:
-   * - PacketHeader
-   * - Color image data (width * height * 3 Bytes (BGR))
-   * - Depth image data (width * height * 2 Bytes (Float16))
-   * - Object image data (width * height * 3 Bytes (BGR))
+   * packet format (version 3):
+   * - PacketHeader, including a table with the type, offset and length of every section
+   * - Color image data (width * height * 3 Bytes (BGR)), if the color channel is enabled
+   * - Depth image data, if the depth channel is enabled. The section type tells the encoding:
+   *   SectionDepth (width * height * 2 Bytes (Float16)), SectionDepthMeters (width * height * 4 Bytes (float32))
+   *   or SectionDepthMillimeters (width * height * 2 Bytes (uint16))
+   * - Object image data (width * height * 3 Bytes (BGR)), if the object channel is enabled
    * - List of map entries
-   * - SceneGraph (annotations)
+   * - Objects of the SceneGraph (annotations)
+   * - Relations of the SceneGraph (annotations)
+   *
+   * Consumers should locate sections through the table instead of relying on this order.
    */
 
+  // Version of the packet format written to PacketHeader::Version
+  static const uint32_t FormatVersion = 3;
+
+  // Types of the sections in a packet
+  enum SectionType : uint32_t
+  {
+    SectionColor = 0,
+    SectionDepth = 1,
+    SectionObject = 2,
+    SectionMap = 3,
+    SectionObjects = 4,
+    SectionRelations = 5,
+    SectionDepthMeters = 6,
+    SectionDepthMillimeters = 7,
+    SectionTypes = 8 // Number of section types
+  };
+
+  // Image channels that can be part of a packet
+  enum Channel : uint32_t
+  {
+    ChannelColor = 1 << 0,
+    ChannelDepth = 1 << 1,
+    ChannelObject = 1 << 2,
+    ChannelAll = ChannelColor | ChannelDepth | ChannelObject
+  };
+
+  // Encodings of the depth image
+  enum class DepthFormat
+  {
+    Float16, // Raw half floats as rendered
+    Meters, // 32 bit floats
+    Millimeters // 16 bit unsigned integers, clamped to 0 to 65535
+  };
+
+  struct Section
+  {
+    uint32_t Type; // SectionType of the data
+    uint32_t Offset; // Offset from the beginning of the packet
+    uint32_t Length; // Length of the data in bytes
+  };
+
   struct Vector
   {
     float X;
@@ -44,17 +94,22 @@ public:
   {
     uint32_t Size; // Size of the complete packet
     uint32_t SizeHeader; // Size of the header
-    uint32_t MapEntries; // Number of map entries at the end of the packet
+    uint32_t Version; // Version of the packet format
+    uint32_t NumSections; // Number of valid entries in Sections
+    uint32_t MapEntries; // Number of map entries in the map section
     uint32_t Width; // Width of the images
     uint32_t Height; // Height of the images
+    uint32_t numberOfObjects; // Number of objects in the objects section
     uint64_t TimestampCapture; // Timestamp from capture
     uint64_t TimestampSent; // Timestamp from sending
     float FieldOfViewX; // FOV in X direction
     float FieldOfViewY; // FOV in Y dircetion
     Vector Translation; // Translation of the camera for current frame
     Quaternion Rotation; // Rotation of the camera for current frame
-    uint32_t numberOfObjects; // Maximum number of objects = 100
-    uint32_t numberOfRelations; // Maximum number of relations = 10000
+    uint32_t numberOfRelations; // Number of relations in the relations section
+    Section Sections[SectionTypes]; // Table of the sections in the packet
+    uint32_t ShardId; // Shard of the camera that generated the packet, set by PacketRelay for relayed packets
+    uint32_t ShardCount; // Number of shards generating the same dataset
   };
 
   struct MapEntry
@@ -98,58 +153,152 @@ public:
 	};
 
 
+  // What happens when a new frame is captured while all packets are queued or being sent
+  enum class OverflowPolicy
+  {
+    DropOldest, // Overwrite the oldest packet that was not sent yet
+    DropNewest // Keep the queued packets and skip the new frame
+  };
+
+  // A preallocated packet of the ring
+  struct Packet
+  {
+    // Raw packet data
+    std::vector<uint8> Data;
+    // Pointer to the packet header
+    PacketHeader *Header;
+    // Pointers to the beginning of the images and the map, nullptr for disabled channels
+    uint8 *Color, *Depth, *Object, *Map;
+    // Increasing number of the frame stored in this packet
+    uint64 Sequence;
+  };
+
 private:
-  std::vector<uint8> ReadBuffer, WriteBuffer;
-  bool IsDataReadable;
-  std::mutex LockBuffer, LockRead;
-  std::condition_variable CVWait;
+  enum class SlotState
+  {
+    Free,
+    Writing,
+    Ready,
+    Reading
+  };
+
+  std::vector<Packet> Slots;
+  std::vector<SlotState> States;
+  // Number of readers that still use a packet in the Reading state
+  std::vector<uint32> Readers;
+  // Committed packets in the order they were written
+  std::deque<uint32> ReadyQueue;
+  bool IsReleased;
+  uint64 NextSequence;
+  std::mutex LockSlots;
+  std::condition_variable CVReadable;
+  // Signaled whenever the last reader released a packet
+  std::condition_variable CVReleased;
+
+  // Index of a packet in the ring
+  uint32 IndexOf(const Packet *Target) const;
+
+  // Sets the data pointers of a packet after its data was (re)allocated
+  void UpdatePointers(Packet &Target);
+
+  // Makes sure that Bytes can be written at Offset and returns a pointer to it
+  uint8 *Reserve(Packet &Target, const uint32 Offset, const uint32 Bytes);
+
+  // Writes an ANSI string to the packet at Offset, optionally prefixed by its length, and advances Offset
+  void WriteString(Packet &Target, uint32 &Offset, const FString &String, const bool WithLength);
+
+  // Sets the entry of a section in the header
+  void SetSection(Packet &Target, const SectionType Type, const uint32 Offset, const uint32 Length);
 
 public:
-  // Sizes of the Header, the raw color and depth image data
-  const uint32 SizeHeader, SizeRGB, SizeFloat;
-  // Size of the scene graph
-  uint32 SizeSceneGraph;
-  // Offsets for the images and map entries in the packet buffer
+  // Enabled image channels, a combination of Channel flags
+  const uint32 Channels;
+  // Encoding of the depth image
+  const DepthFormat DepthEncoding;
+  // Sizes of the Header, the raw color and the depth image data
+  const uint32 SizeHeader, SizeRGB, SizeDepth;
+  // Offsets for the images and map entries in the packet buffer, disabled channels take no space
   const uint32 OffsetColor, OffsetDepth, OffsetObject, OffsetMap;
-  // Offset for SceneGraph in the packet buffer
-  uint32 OffsetSceneGraph;
-  // Size of the complete packet
+  // Size of the packet without annotations
   const uint32 Size;
-  // Pointers to the beginning of the images, map and SceneGraph for writing and a pointer to the beginning of a completed packet for reading
-  uint8 *Color, *Depth, *Object, *Map, *PointerSceneGraph, *Read;
-  // Pointer to the packet headers
-  PacketHeader *HeaderWrite, *HeaderRead;
+  // Policy used when all packets are in use
+  const OverflowPolicy Policy;
+
+  // Number of committed packets
+  std::atomic<uint64> PacketsCommitted;
+  // Number of committed packets that were overwritten before they were sent
+  std::atomic<uint64> PacketsOverwritten;
+  // Number of frames that were skipped because no packet was available
+  std::atomic<uint64> PacketsDropped;
+
+  // Called after every commit, e.g. to wake up an event loop. Has to be set before writing starts.
+  std::function<void()> CommitCallback;
+
+  // Initializes the ring with NumSlots packets containing the given channels, widht and height are not changeable afterwards
+  PacketBuffer(const uint32 Width, const uint32 Height, const float FieldOfView, const uint32 NumSlots = 3, const OverflowPolicy Policy = OverflowPolicy::DropOldest,
+    const uint32 Channels = ChannelAll, const DepthFormat DepthEncoding = DepthFormat::Float16);
 
-  // Initializes the buffer, widht and height are not changeable afterwards
-  PacketBuffer(const uint32 Width, const uint32 Height, const float FieldOfView);
+  // Returns a packet for writing or nullptr if the frame has to be dropped. Never blocks on the reader.
+  Packet *AcquireWrite();
+
+  // Waits up to TimeoutMs for a free packet, e.g. to slow down a producer that must not lose packets.
+  // Returns nullptr on timeout or after Release was called, packets are never overwritten or counted as dropped.
+  Packet *WaitForWrite(const uint32 TimeoutMs);
+
+  // Queues a written packet for reading and wakes up the reader
+  void CommitWrite(Packet *Target);
+
+  // Gives an acquired packet back without queuing it, e.g. if it could not be filled completely
+  void CancelWrite(Packet *Target);
+
+  // Selects the image channels contained in a packet, others keep their space but are left out of the section table.
+  // Has to be called before StartWriting.
+  void SetChannels(Packet &Target, const uint32 ActiveChannels);
 
   // Starts writing and copies the map entries and the scene graph to the end of the packet.
-  void StartWriting(const TMap<FString, uint32> &ObjectToColor, const TArray<FColor> &ObjectColors, const struct SceneGraph &pSceneGraph);
+  void StartWriting(Packet &Target, const TMap<FString, uint32> &ObjectToColor, const TArray<FColor> &ObjectColors, const struct SceneGraph &pSceneGraph);
+
+  // Prepares a packet for Size bytes of raw packet data received from another camera, e.g. by PacketRelay.
+  // Returns where the complete packet including its header has to be written to.
+  uint8 *ReserveRaw(Packet &Target, const uint32 Size);
 
   // Serialize a float array
-  void SerializeFloatArray(uint8 *pBuffer, TArray<FFloat32> FloatArray);
+  void SerializeFloatArray(Packet &Target, uint32 &Offset, const TArray<FFloat32> &FloatArray);
 
   // Copy properties to buffer
-  void CopyProperties(uint8*& pBuffer, ObjectProperty Properties);
+  void CopyProperties(Packet &Target, uint32 &Offset, const ObjectProperty &Properties);
 
   // Copy objects to buffer
-  void CopyObjects(uint8*& pBuffer, TArray<ObjectDescription> Objects);
+  void CopyObjects(Packet &Target, uint32 &Offset, const TArray<ObjectDescription> &Objects);
 
   // Copy relations to buffer
-  void CopyRelations(uint8*& pBuffer, TArray<ObjectRelation> Relations);
+  void CopyRelations(Packet &Target, uint32 &Offset, const TArray<ObjectRelation> &Relations);
+
+  // Returns the image channel a section belongs to, 0 for annotations
+  static uint32 ChannelOf(const uint32 Type);
+
+  // Returns the section of the given type or nullptr if the packet does not contain it
+  static const Section *FindSection(const PacketHeader &Header, const SectionType Type);
+
+  // Waits for the oldest committed packet. Returns nullptr after Release was called.
+  Packet *AcquireRead();
+
+  // Returns the oldest committed packet or nullptr if there is none. Never blocks.
+  Packet *TryAcquireRead();
 
-  // Copy SceneGraph to buffer
-  void CopySceneGraph(uint8*& pBuffer, SceneGraph pSceneGraph);
+  // Shares an acquired packet read-only with additional readers, each of them has to call ReleaseRead
+  void ShareRead(Packet *Target, const uint32 AdditionalReaders);
 
-  // Swaps reading and writing buffer and unblocks the reading thread
-  void DoneWriting();
+  // Gives a packet back to the ring after it was sent, it is reused once the last reader released it
+  void ReleaseRead(Packet *Target);
 
-  // Waits until the reading buffer is valid and locks it.
-  void StartReading();
+  // Number of packets that are acquired for reading and not released by all of their readers yet
+  uint32 GetNumReading();
 
-  // Unlocks the reading buffer
-  void DoneReading();
+  // Waits until every committed packet was read and released, Release was called or TimeoutMs passed (-1 waits forever).
+  // Returns whether all packets were read.
+  bool WaitUntilRead(const int32 TimeoutMs = -1);
 
-  // Releases the lock so that StartReading will return, this is needed to stop the server in the end.
+  // Wakes up AcquireRead so that it returns, this is needed to stop the server in the end.
   void Release();
 };
\ No newline at end of file
@@ -0,0 +1,75 @@
+// Copyright 2017, Institute for Artificial Intelligence - University of Bremen
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "PacketBuffer.h"
+#include "Server.h"
+#include <thread>
+#include <vector>
+#include <memory>
+#include <atomic>
+
+class FSocket;
+
+/**
+ * Merges the packets of several cameras (shards) into one server. The relay connects as a client to the TCP server
+ * of every generator process, receives their packets into its own ring and publishes them through a TCPServer, so a
+ * consumer reads the whole dataset from one socket. Every packet is tagged with the position of its generator in the
+ * upstream list (PacketHeader::ShardId) and the number of upstreams (PacketHeader::ShardCount).
+ * Packets are passed on unchanged otherwise, consumers of the relay can subscribe like consumers of a camera.
+ * Nothing is dropped: the relay only receives while a consumer is connected and the ring has room, so slow consumers
+ * slow down the generators through TCP flow control.
+ */
+class AUTONOMOUSRGBDCAMERA_API PacketRelay
+{
+private:
+  // Connection to a generator process
+  struct Upstream
+  {
+    FString Host;
+    int32 Port;
+    uint32 ShardId;
+    // Set by the receiving thread once it is connected
+    std::atomic<FSocket *> Socket;
+    std::thread Thread;
+    // Set once the generator closed the connection
+    std::atomic<bool> Finished;
+    std::atomic<uint64> PacketsReceived, BytesReceived;
+  };
+
+  std::vector<std::unique_ptr<Upstream>> Upstreams;
+  TSharedPtr<PacketBuffer> Buffer;
+  TCPServer Server;
+  // Atomic, so that Stop either sees a new socket or the receiving thread sees the stop before it blocks
+  std::atomic<bool> Running;
+
+  void ReceiveLoop(Upstream &Source);
+  bool WaitForConsumer();
+  bool Connect(Upstream &Source);
+  bool ReceivePacket(Upstream &Source);
+  bool Receive(Upstream &Source, uint8 *Target, const uint32 Size);
+
+public:
+  // Number of packets queued for the consumers before the relay stops receiving from the generators
+  uint32 NumSlots;
+
+  // Largest packet accepted from a generator in bytes, a generator sending a larger one is disconnected
+  uint32 MaxPacketSize;
+
+  PacketRelay();
+  ~PacketRelay();
+
+  // Connects to the generators at Addresses ("host:port", the index is the shard ID) and serves their packets on ServerPort.
+  // Generators that are not running yet are retried until they accept the connection.
+  bool Start(const TArray<FString> &Addresses, const int32 ServerPort, const bool BindToAnyIp);
+
+  // Passes the queued packets on and closes all connections
+  void Stop();
+
+  // True while at least one generator is connected or was not reached yet
+  bool IsRunning() const;
+
+  // Logs received packets per shard
+  void LogStatistics() const;
+};
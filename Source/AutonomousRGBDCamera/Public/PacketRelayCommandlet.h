@@ -0,0 +1,33 @@
+// Copyright 2017, Institute for Artificial Intelligence - University of Bremen
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "PacketRelayCommandlet.generated.h"
+
+/**
+ * Runs a PacketRelay without loading a map, e.g. to merge the output of several batch generation processes
+ * (see BatchGeneration.h) into one socket:
+ *
+ *   UE4Editor-Cmd MyProject.uproject -run=PacketRelay -Upstream=node1:10000,node2:10000 -Port=10000
+ *
+ * Options:
+ *   -Upstream=<host:port,...>  Generators in the order of their shard IDs
+ *   -Port=<port>               Port the consumers connect to
+ *   -Slots=<count>             Packets queued for the consumers before the generators are held back
+ *   -MaxPacketMB=<megabytes>   Largest packet accepted from a generator, larger ones drop its connection (default 256)
+ *   -Interval=<seconds>        Seconds between two statistics reports
+ *
+ * The relay exits once all generators closed their connection.
+ */
+UCLASS()
+class AUTONOMOUSRGBDCAMERA_API UPacketRelayCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	UPacketRelayCommandlet();
+
+	virtual int32 Main(const FString &Params) override;
+};
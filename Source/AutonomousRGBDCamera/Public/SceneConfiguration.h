@@ -15,6 +15,7 @@
 #include "GameFramework/Actor.h"
 #include "Containers/List.h"
 #include "SceneObject.h"
+#include "PCGStream.h"
 #include "Misc/FileHelper.h"
 #include "HAL/PlatformFilemanager.h"
 #include "Dom/JsonObject.h"
@@ -54,15 +55,21 @@ public:
 	// Randomly swap scene objects
 	void RandomlySwapSceneObjects();
 
-	// Swap scene objects using the argument, a random swap partner and new rotations for both
-	void SwapSceneObjects(ASceneObject* pSceneObject);
+	// Swap the scene object at pIndex with a random swap partner and rotate both by the given steps
+	void SwapSceneObjects(int32 pIndex, int32 pPartnerDraw, float pZAxisStep, float pPartnerZAxisStep);
 
-	// Get a random partner for SwapSceneObjects
-	ASceneObject* GetSwapPartner(ASceneObject* pSceneObject);
+	// Get the random partner for SwapSceneObjects, pPartnerDraw is from 0 to the number of scene objects - 2
+	ASceneObject* GetSwapPartner(int32 pIndex, int32 pPartnerDraw);
 
 	// Set MaxZRotationSceneObject
 	void SetMaxZRotationSceneObject(float pMaxZRotationSceneObject);
 
+	// Seed the random streams of swaps, disables and rotation jitter for a shard
+	void SetRandomSeed(uint64 pSeed, uint32 pShardId);
+
+	// Move the random streams and the scene forward by pCount ticks, without the log output
+	void SkipTicks(uint64 pCount);
+
 	// Randomly disable scene objects
 	void RandomlyDisableSceneObjects();
 
@@ -112,4 +119,14 @@ public:
 	// Show spatial relationships of scene objects in Output Log
 	UPROPERTY(EditAnywhere)
 	bool bShowSpatialRelationships;
+
+	// Random streams for swapping scene objects, disabling them and the rotation of swapped objects
+	PCGStream RandomSwaps;
+	PCGStream RandomDisables;
+	PCGStream RandomRotation;
+
+	// Values drawn as one batch for all scene objects. Each tick takes two values per scene object from the swap
+	// and rotation streams and one from the disable stream.
+	TArray<int32> RandomDraws;
+	TArray<float> RandomSteps;
 };
\ No newline at end of file
@@ -6,23 +6,191 @@
 #include "Networking.h"
 #include "PacketBuffer.h"
 #include <thread>
+#include <deque>
+#include <memory>
+#include <atomic>
+#include <utility>
 
 class AUTONOMOUSRGBDCAMERA_API TCPServer
 {
+public:
+  // What happens to a client that can't keep up with the camera
+  enum class SlowClientPolicy
+  {
+    // Skip frames for this client, other clients are not affected
+    DropFrames,
+    // Disconnect the client once it fell behind for too many frames in a row
+    Disconnect,
+    // Stop taking packets from the ring until every client has room again, so the camera is slowed down instead
+    Wait
+  };
+
+  // Requests the annotation sections (map entries, objects and relations) in Subscription::Channels
+  static const uint32_t SubscribeAnnotations = 1 << 3;
+  static const uint32_t SubscribeAll = PacketBuffer::ChannelAll | SubscribeAnnotations;
+
+  // Value of Subscription::Magic ("SUB1")
+  static const uint32_t SubscriptionMagic = 0x31425553;
+
+  /**
+   * Control message a client can send at any time to change what it receives. Until the first one arrives,
+   * a client receives every packet with all channels. Packets keep the format described in PacketBuffer.h,
+   * the section table and the image size in the header reflect the selected data.
+   * Clients on the unix socket receive the whole frame, only MaxRate applies to them. The queue limit counts the frames
+   * they did not receive from the socket yet.
+   */
+  struct Subscription
+  {
+    uint32_t Magic; // SubscriptionMagic
+    uint32_t Channels; // Combination of PacketBuffer::Channel flags and SubscribeAnnotations
+    float MaxRate; // Maximum number of packets per second, 0 for no limit
+    uint32_t Downscale; // Keep every n-th pixel in both directions, 0 or 1 for the full resolution
+    uint32_t RoiX, RoiY, RoiWidth, RoiHeight; // Region of interest before downscaling, a width or height of 0 selects the whole image
+  };
+
 private:
+  // State of a connected client
+  struct Client
+  {
+    FString Name;
+    // Copy of the header of the packet being sent, so that the shared packet is never modified while sending.
+    // Its section table describes the data as sent to this client.
+    PacketBuffer::PacketHeader Header;
+    // Data of the sections in Header, either inside the packet or in Scratch
+    const uint8 *Sources[PacketBuffer::SectionTypes];
+    // Cropped and downscaled images of the packet being sent, only valid if Cropped is set
+    std::vector<uint8> Scratch;
+    bool Cropped;
+
+    // Current subscription and the capture time from which on the next packet is due
+    Subscription Subscribed;
+    uint64 NextCapture;
+    // Bytes of a control message that was not received completely yet
+    uint8 Received[sizeof(Subscription)];
+    uint32 NumReceived;
+
+#if PLATFORM_LINUX
+    int Fd;
+    // Connected through the AF_UNIX socket, such clients receive frames as memfd descriptors
+    bool Local;
+    // Packets waiting to be sent, the front one is being sent
+    std::deque<PacketBuffer::Packet *> Queue;
+    // Bytes of the front packet that were already sent
+    uint32 Sent;
+    // Bytes a frame message occupies in the send queue of a local client, 0 until it was measured
+    uint32 MessageSize;
+    // Whether parts of the front packet were sent with MSG_ZEROCOPY
+    bool SentZeroCopy;
+    // Whether the socket is registered for EPOLLOUT
+    bool WantsWrite;
+
+    // Number of zero copy sendmsg calls issued and completed on the socket
+    uint32 ZeroCopySent, ZeroCopyCompleted;
+    // Packets still referenced by the kernel together with the number of their last sendmsg call
+    std::deque<std::pair<PacketBuffer::Packet *, uint32>> ZeroCopyPending;
+
+    // Number of consecutive packets that had to be dropped for this client
+    uint32 Lag;
+
+    // Statistics about the queue depth, sampled whenever a packet is queued
+    uint64 PacketsSent, PacketsDropped, QueueDepthSum, QueueDepthSamples;
+    uint32 QueueDepthMax;
+#else
+    FSocket *Socket;
+#endif
+  };
+
+  std::vector<std::unique_ptr<Client>> Clients;
+  // Earliest NextCapture of all clients, 0 if a client takes every packet
+  std::atomic<uint64> EarliestDue;
+
+  // Whether the connection of a client is still open, closed clients are removed from Clients later
+  static bool IsConnected(const Client &Target);
+  // Whether a packet is due for a client because of its MaxRate, UpdateCadence moves on to the next one once it was sent or queued
+  bool IsDue(const Client &Target, const PacketBuffer::PacketHeader &Header) const;
+  void UpdateCadence(Client &Target, const PacketBuffer::PacketHeader &Header);
+  void PrepareHeader(Client &Target, const PacketBuffer::Packet &Packet);
+  bool Subscribe(Client &Target, const Subscription &Request);
+  void UpdateSubscriptions();
+  void UpdateEarliestDue();
+  void ReceiveData(Client &Target);
+  void CloseClient(Client &Target);
+  void CloseClients();
+
+#if PLATFORM_LINUX
+  // Native sockets and the epoll instance of the event loop
+  int ListenFd;
+  // Listening AF_UNIX socket, -1 if UnixSocketPath is empty
+  int UnixFd;
+  int EpollFd;
+  // Event signaled by the packet buffer whenever a packet was committed
+  int WakeFd;
+
+  // Clients a packet is dispatched to, kept to avoid allocations
+  std::vector<Client *> Receivers;
+  // Set while packets are left in the ring because a client is full and SlowPolicy is Wait
+  bool Blocked;
+
+  void Wake();
+  void AcceptConnections(const int Fd, const bool Local);
+  void DispatchPackets();
+  int CreateFrame(const PacketBuffer::Packet &Packet);
+  // Passes a frame to a local client, returns false if it was skipped or the client was closed
+  bool SendFrame(Client &Target, const int FrameFd, const uint32 Size);
+  uint32 GetQueueDepth(const Client &Target) const;
+  bool IsFull(const Client &Target) const;
+  void SampleQueueDepth(Client &Target, const uint32 Depth);
+  void EnqueuePacket(Client &Target, PacketBuffer::Packet *Packet);
+  bool SkipFrame(Client &Target);
+  void EvictPackets();
+  bool SendPackets(Client &Target);
+  void ReapZeroCopy(Client &Target);
+  void SetWantsWrite(Client &Target, const bool WantsWrite);
+#else
+  // Every packet is sent to one client after another with blocking sends, so a slow client delays the others
   FSocket *ListenSocket;
-  FSocket *ClientSocket;
+
+  void AcceptConnections();
+  // Sends the subscribed parts of a packet, returns false if the client was closed
+  bool SendPacket(Client &Target, const PacketBuffer::Packet &Packet);
+#endif
 
   std::thread Thread;
   volatile bool Running;
+  std::atomic<int32> NumClients;
+  // Union of the channels subscribed by all clients
+  std::atomic<uint32> SubscribedChannels;
 
   void ServerLoop();
-  bool ListenConnections();
 
 public:
   // This pointer has to be set before starting the server
   TSharedPtr<PacketBuffer> Buffer;
 
+  // Send packets of at least this size with MSG_ZEROCOPY, 0 disables zero copy sends (Linux only)
+  uint32 ZeroCopyThreshold;
+
+  // Path of an additional AF_UNIX socket, empty disables it (Linux only). Clients connected to it receive
+  // every frame as a sealed memfd through SCM_RIGHTS together with the packet size as a uint32.
+  // Access is controlled by the permissions of the socket file.
+  FString UnixSocketPath;
+
+  // Maximum number of packets queued or in flight per client before the oldest waiting one is dropped (Linux only,
+  // other platforms send every packet to all clients one after another). Local clients skip new frames instead.
+  uint32 QueueLimit;
+
+  // Handling of clients that exceed their queue limit and the number of consecutive drops before disconnecting (Linux only)
+  SlowClientPolicy SlowPolicy;
+  uint32 DisconnectLag;
+
+  // Maximum number of slots all clients together may pin, 0 for no limit (Linux only). Beyond it the oldest waiting
+  // packets are dropped from the queues, so that slow clients never starve the camera of free slots.
+  uint32 MaxPinnedSlots;
+
+  // Milliseconds Stop waits for connected clients to receive the packets left in the ring, 0 closes them right away
+  // and -1 waits until they are received. Queued and partially sent packets are lost once the sockets are closed.
+  int32 DrainTimeoutMs;
+
   TCPServer();
   ~TCPServer();
 
@@ -31,4 +199,11 @@ public:
 
   bool HasClient() const;
 
-};
\ No newline at end of file
+  // Channels requested by at least one client, the camera can skip the others
+  uint32 GetSubscribedChannels() const;
+
+  // Capture timestamp before which no client takes a packet because of its MaxRate, 0 if one is due anytime.
+  // The camera can skip rendering frames that would only be dropped.
+  uint64 GetNextCaptureDue() const;
+
+};
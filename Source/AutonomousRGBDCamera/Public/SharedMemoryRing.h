@@ -0,0 +1,252 @@
+// Copyright 2017, Institute for Artificial Intelligence - University of Bremen
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+#if defined(__linux__)
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <climits>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+/**
+ * Layout of the POSIX shared memory ring written by SharedMemoryServer and a small reader for local consumers.
+ * This header does not depend on Unreal Engine, so that it can be copied into other projects (e.g. the ROS bridge).
+ *
+ * memory layout:
+ * - RingHeader
+ * - NumSlots slots, each SlotStride bytes: SlotHeader followed by up to SlotSize bytes of packet data
+ *
+ * The packet data uses the packet format described in PacketBuffer.h. Slots are written round robin: the packet
+ * with sequence number N (starting at 1) is stored in slot N % NumSlots. Every slot works as a seqlock: its sequence
+ * is 0 while the writer changes it, so readers can process a packet in place and check afterwards that it was
+ * not overwritten in the meantime.
+ *
+ * If a packet does not fit into a slot, the writer replaces the ring by a new one with larger slots under the same name
+ * and closes the old one. Readers have to open the ring again, the new ring starts over at sequence number 1.
+ */
+namespace SharedMemoryRing
+{
+  static const uint32_t Magic = 0x44424752; // "RGBD"
+  static const uint32_t Version = 2;
+
+  // Slots start on a page boundary, their header is padded to a cache line
+  static const uint32_t PageSize = 4096;
+  static const uint32_t SlotHeaderSize = 64;
+
+  struct RingHeader
+  {
+    uint32_t Magic;
+    uint32_t Version;
+    uint32_t NumSlots;
+    uint32_t SlotSize; // Maximum packet size
+    uint64_t SlotStride; // Distance between two slots in bytes
+    uint64_t OffsetSlots; // Offset of the first slot from the beginning of the memory
+    uint32_t Generation; // Number of times the ring was replaced by a larger one
+
+    std::atomic<uint64_t> Published; // Sequence number of the newest complete packet, 0 if there is none
+    std::atomic<uint32_t> Signal; // Futex word, incremented for every packet
+    std::atomic<uint32_t> Waiters; // Number of readers sleeping on Signal
+    std::atomic<uint32_t> Readers; // Number of attached readers
+    std::atomic<uint32_t> Closed; // Set once the writer stopped
+  };
+
+  struct SlotHeader
+  {
+    std::atomic<uint64_t> Sequence; // Sequence number of the packet in the slot, 0 while it is written
+    uint32_t Size; // Size of the packet in bytes
+  };
+
+  // Returns the size of the memory for the given number of slots and slot size
+  inline uint64_t MemorySize(const uint32_t NumSlots, const uint32_t SlotSize, uint64_t &SlotStride, uint64_t &OffsetSlots)
+  {
+    OffsetSlots = (sizeof(RingHeader) + PageSize - 1) / PageSize * PageSize;
+    SlotStride = (SlotHeaderSize + (uint64_t)SlotSize + PageSize - 1) / PageSize * PageSize;
+    return OffsetSlots + SlotStride * NumSlots;
+  }
+
+  inline SlotHeader *GetSlot(RingHeader *Ring, const uint64_t Sequence)
+  {
+    return reinterpret_cast<SlotHeader *>(reinterpret_cast<uint8_t *>(Ring) + Ring->OffsetSlots + Ring->SlotStride * (Sequence % Ring->NumSlots));
+  }
+
+  inline uint8_t *GetData(SlotHeader *Slot)
+  {
+    return reinterpret_cast<uint8_t *>(Slot) + SlotHeaderSize;
+  }
+
+#if defined(__linux__)
+  // The ring is shared between processes, so the futex must not be process private
+  inline void WakeReaders(RingHeader *Ring)
+  {
+    Ring->Signal.fetch_add(1);
+    if(Ring->Waiters.load() > 0)
+    {
+      syscall(SYS_futex, reinterpret_cast<uint32_t *>(&Ring->Signal), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+    }
+  }
+
+  /**
+   * Reader for the shared memory ring. Packets are not copied: Wait returns a pointer into the shared memory,
+   * which stays valid until the writer wrapped around the ring. Call IsValid after processing a packet to make
+   * sure that it was not overwritten while reading it.
+   */
+  class Reader
+  {
+  public:
+    struct Frame
+    {
+      const uint8_t *Data;
+      uint32_t Size;
+      uint64_t Sequence;
+    };
+
+    Reader() : Ring(nullptr), MappedSize(0), Last(0), Missed(0)
+    {
+    }
+
+    ~Reader()
+    {
+      Close();
+    }
+
+    // Maps the ring created by the writer, e.g. Open("/AutonomousRGBDCamera")
+    bool Open(const char *Name)
+    {
+      Close();
+      const int Fd = shm_open(Name, O_RDWR, 0);
+      if(Fd < 0)
+      {
+        return false;
+      }
+
+      struct stat Info;
+      void *Memory = MAP_FAILED;
+      if(fstat(Fd, &Info) == 0 && (size_t)Info.st_size >= sizeof(RingHeader))
+      {
+        Memory = mmap(nullptr, Info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, Fd, 0);
+      }
+      close(Fd);
+      if(Memory == MAP_FAILED)
+      {
+        return false;
+      }
+
+      Ring = static_cast<RingHeader *>(Memory);
+      MappedSize = Info.st_size;
+      uint64_t SlotStride, OffsetSlots;
+      if(Ring->Magic != Magic || Ring->Version != Version || MemorySize(Ring->NumSlots, Ring->SlotSize, SlotStride, OffsetSlots) > MappedSize)
+      {
+        munmap(Memory, MappedSize);
+        Ring = nullptr;
+        return false;
+      }
+
+      // Only packets published after opening the ring are returned. A ring that replaced a smaller one also returns
+      // its first packet, which did not fit into the old ring.
+      Last = Ring->Generation > 0 ? 0 : Ring->Published.load(std::memory_order_acquire);
+      Missed = 0;
+      Ring->Readers.fetch_add(1);
+      return true;
+    }
+
+    void Close()
+    {
+      if(Ring)
+      {
+        Ring->Readers.fetch_sub(1);
+        munmap(Ring, MappedSize);
+        Ring = nullptr;
+      }
+    }
+
+    bool IsOpen() const
+    {
+      return Ring != nullptr;
+    }
+
+    // Whether the writer stopped or replaced the ring, it has to be opened again once it restarted
+    bool IsClosed() const
+    {
+      return !Ring || Ring->Closed.load() != 0;
+    }
+
+    // Waits up to TimeoutMs milliseconds (negative waits forever) for a packet newer than the last one.
+    // Packets that were overwritten before the reader got to them are skipped and counted.
+    bool Wait(Frame &Target, const int32_t TimeoutMs)
+    {
+      if(!Ring)
+      {
+        return false;
+      }
+
+      timespec Timeout;
+      Timeout.tv_sec = TimeoutMs / 1000;
+      Timeout.tv_nsec = (TimeoutMs % 1000) * 1000000L;
+
+      while(true)
+      {
+        // Load the futex word before checking for packets, so that no wake up is lost
+        const uint32_t Signal = Ring->Signal.load();
+        const uint64_t Published = Ring->Published.load(std::memory_order_acquire);
+        if(Published > Last)
+        {
+          // Always continue with the newest packet, older ones are outdated anyway
+          SlotHeader *Slot = GetSlot(Ring, Published);
+          if(Slot->Sequence.load(std::memory_order_acquire) == Published)
+          {
+            Missed += Published - Last - 1;
+            Last = Published;
+            Target.Data = GetData(Slot);
+            Target.Size = Slot->Size;
+            Target.Sequence = Published;
+            return true;
+          }
+          // Overwritten right away, try again with the next one
+          continue;
+        }
+        if(Ring->Closed.load() != 0)
+        {
+          return false;
+        }
+
+        Ring->Waiters.fetch_add(1);
+        const long Result = syscall(SYS_futex, reinterpret_cast<uint32_t *>(&Ring->Signal), FUTEX_WAIT, Signal, TimeoutMs < 0 ? nullptr : &Timeout, nullptr, 0);
+        Ring->Waiters.fetch_sub(1);
+        if(Result < 0 && errno == ETIMEDOUT)
+        {
+          return false;
+        }
+      }
+    }
+
+    // Whether the packet is still intact. Data read from the frame before this call is valid if it returns true.
+    bool IsValid(const Frame &Target) const
+    {
+      std::atomic_thread_fence(std::memory_order_acquire);
+      return Ring && GetSlot(Ring, Target.Sequence)->Sequence.load(std::memory_order_relaxed) == Target.Sequence;
+    }
+
+    // Number of packets that were skipped because the reader was too slow
+    uint64_t GetMissed() const
+    {
+      return Missed;
+    }
+
+  private:
+    RingHeader *Ring;
+    size_t MappedSize;
+    uint64_t Last;
+    uint64_t Missed;
+  };
+#endif
+}
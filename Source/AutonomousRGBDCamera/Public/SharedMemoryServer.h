@@ -0,0 +1,60 @@
+// Copyright 2017, Institute for Artificial Intelligence - University of Bremen
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "PacketBuffer.h"
+#include "SharedMemoryRing.h"
+#include <thread>
+#include <mutex>
+#include <vector>
+#include <utility>
+
+/**
+ * Publishes the packets of a PacketBuffer into a POSIX shared memory ring for consumers on the same host.
+ * Every packet is copied once into the ring, readers map it without further copies (see SharedMemoryRing::Reader).
+ * Slots are sized for the images plus 1 MB of annotations and grow whenever a larger packet arrives.
+ * Only available on Linux, Start fails on other platforms.
+ */
+class AUTONOMOUSRGBDCAMERA_API SharedMemoryServer
+{
+private:
+#if PLATFORM_LINUX
+  // Name of the shared memory object, e.g. "/AutonomousRGBDCamera"
+  FString Name;
+  SharedMemoryRing::RingHeader *Ring;
+  uint64 MappedSize;
+  // Rings replaced by larger ones and their sizes. They stay mapped until Stop, so that their readers count as clients
+  // until they opened the new ring.
+  std::vector<std::pair<SharedMemoryRing::RingHeader *, uint64>> Retired;
+  // Guards Ring and Retired against HasClient, only the server thread changes them while running
+  mutable std::mutex LockRings;
+
+  bool Create(const uint32 SlotSize, const uint32 Generation);
+  void Publish(const PacketBuffer::Packet &Packet);
+#endif
+
+  std::thread Thread;
+  volatile bool Running;
+  uint64 NextSequence;
+
+  void ServerLoop();
+
+public:
+  // This pointer has to be set before starting the server
+  TSharedPtr<PacketBuffer> Buffer;
+
+  // Number of slots in the ring. Readers can fall behind by NumSlots - 1 packets before they miss one.
+  uint32 NumSlots;
+
+  // Statistics about the published packets and packets that were skipped because the ring could not grow
+  uint64 PacketsPublished, PacketsTooLarge;
+
+  SharedMemoryServer();
+  ~SharedMemoryServer();
+
+  void Start(const FString &_Name);
+  void Stop();
+
+  bool HasClient() const;
+};
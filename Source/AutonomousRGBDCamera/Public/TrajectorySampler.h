@@ -0,0 +1,137 @@
+// Copyright 2017, Institute for Artificial Intelligence - University of Bremen
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "PCGStream.h"
+#include <vector>
+
+/**
+ * Generates the camera poses within the bounds of CameraTrajectory.json, in one of two ways:
+ * - RandomWalk: every step moves each axis by -1, 0 or +1 times its step length, chosen uniformly among the directions
+ *   that keep it within its bounds. The directions are counted instead of drawing until one fits, so a step takes exactly
+ *   one random value per axis and the inner loop has no branches.
+ * - Halton or Sobol: the bounds are sampled with a low-discrepancy sequence, so every pose lies in a region that was
+ *   visited least so far and nearly identical viewpoints are avoided. Step lengths are not used. Optionally, candidates
+ *   closer than a minimum distance to recent poses are skipped.
+ *
+ * Poses are generated in blocks ahead of time and stored as one array per axis, Next serves them in O(1). The poses
+ * ahead of the current one can be inspected, e.g. to schedule visibility checks or render batches in advance.
+ * The sampler counts which cells of a grid over the bounds were visited, so the coverage of different modes can be compared.
+ */
+class AUTONOMOUSRGBDCAMERA_API TrajectorySampler
+{
+public:
+  enum Axis
+  {
+    AxisX,
+    AxisY,
+    AxisZ,
+    AxisRoll,
+    AxisPitch,
+    AxisYaw,
+    NumAxes
+  };
+
+  enum class Mode
+  {
+    RandomWalk,
+    Halton,
+    Sobol
+  };
+
+  struct Bounds
+  {
+    float Min, Max, Step;
+  };
+
+private:
+  // Grid resolution of the coverage statistics per axis, for the whole pose and for the location only
+  static const uint32 CellsPerAxisPose = 4;
+  static const uint32 CellsPerAxisLocation = 8;
+  // Candidates of a low-discrepancy sequence tried before a pose closer than MinDistance is accepted anyway
+  static const uint32 MaxAttempts = 64;
+
+  Bounds Limits[NumAxes];
+  // Poses of the current block and the direction that led to them, one array per axis
+  std::vector<float> Values[NumAxes];
+  std::vector<int32> Directions[NumAxes];
+  // Random values of a block, BlockSize per axis
+  std::vector<uint32> Draws;
+  // Pose the next block continues from
+  float Last[NumAxes];
+  uint32 BlockSize;
+  // Index of the current pose in the block
+  uint32 Cursor;
+  PCGStream *Random;
+
+  // Low-discrepancy sampling: index of the next candidate, distance between the indices of two candidates
+  // and the offset of every axis (Cranley-Patterson rotation)
+  Mode Sampling;
+  uint64 Index, Stride;
+  float Offsets[NumAxes];
+  uint32 SobolDirections[NumAxes][32];
+
+  // Minimum distance between poses, measured with every axis scaled to the range 0 to 1, and the recently
+  // accepted poses it is checked against (ring, one array per axis)
+  float MinDistance;
+  std::vector<float> Recent[NumAxes];
+  uint32 NumRecent, NextRecent;
+
+  // Coverage statistics
+  std::vector<bool> VisitedPose, VisitedLocation;
+  uint64 NumServed, NumCellsPose, NumCellsLocation, NumRejected, NumForced;
+  double SumStepDistance;
+  float Previous[NumAxes];
+
+  void GenerateBlock();
+  void GenerateWalk();
+  void GenerateLowDiscrepancy();
+
+  // Value from 0 to 1 of the sequence for an axis
+  float Sequence(const uint32 Target, const uint64 Position) const;
+
+  // Scales a pose to the range 0 to 1 on every axis
+  void Normalize(const float (&Pose)[NumAxes], float (&Normalized)[NumAxes]) const;
+
+  // Checks the distance of a normalized pose to the recent ones and remembers it if it is accepted
+  bool IsFarEnough(const float (&Normalized)[NumAxes]) const;
+  void Remember(const float (&Normalized)[NumAxes]);
+
+  // Updates the coverage statistics with the current pose
+  void CountCoverage();
+
+public:
+  TrajectorySampler();
+
+  // Starts the walk at Start, the values are drawn from Random, which has to outlive the sampler
+  void Init(const Bounds (&_Limits)[NumAxes], const float (&Start)[NumAxes], PCGStream &_Random, const uint32 _BlockSize = 1024);
+
+  // Samples the bounds with a low-discrepancy sequence instead of walking, has to be called after Init.
+  // The n-th pose uses the element IndexStart + n * IndexStride of the sequence, so shards with the same Offsets
+  // (values from 0 to 1 per axis) share the work of covering the bounds.
+  void SetLowDiscrepancy(const Mode _Sampling, const uint64 IndexStart, const uint64 IndexStride, const float (&_Offsets)[NumAxes],
+    const float _MinDistance, const uint32 DistanceWindow = 1024);
+
+  // Moves on to the next pose
+  void Next();
+
+  // Moves on by Count poses without counting them in the coverage, e.g. to continue a run at a later frame.
+  // The skipped poses are still generated, because the walk and the distance check depend on the poses before.
+  void Skip(uint64 Count);
+
+  // Value of an axis of the current pose
+  float Get(const Axis Target) const;
+
+  // Direction of the last step of an axis: -1, 0 or 1
+  int32 GetDirection(const Axis Target) const;
+
+  // Number of poses generated after the current one
+  uint32 GetNumAhead() const;
+
+  // Values of an axis of the poses after the current one, GetNumAhead() entries
+  const float *GetAhead(const Axis Target) const;
+
+  // Logs the coverage of the bounds by the poses served so far
+  void LogCoverage() const;
+};
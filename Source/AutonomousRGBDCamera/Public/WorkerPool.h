@@ -0,0 +1,95 @@
+// Copyright 2017, Institute for Artificial Intelligence - University of Bremen
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include <mutex>
+#include <deque>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <condition_variable>
+
+/**
+ * Thread pool for data parallel jobs. A job is split into tiles (e.g. rows of an image), which are distributed
+ * evenly over the workers when it is submitted. A worker processes the tiles of its own queue one at a time and steals
+ * half of the remaining tiles of another worker once its queue is empty, so all workers stay busy until every job is done.
+ */
+class AUTONOMOUSRGBDCAMERA_API WorkerPool
+{
+public:
+  // A job that can be submitted repeatedly, but only once at a time
+  struct Job
+  {
+    // Processes a single tile
+    std::function<void(const uint32 Tile)> Work;
+    // Called by the worker that finished the last tile
+    std::function<void()> Done;
+
+    // Tiles not processed yet
+    std::atomic<uint32> Remaining;
+
+    Job() : Remaining(0)
+    {
+    }
+  };
+
+private:
+  // Consecutive tiles of a job
+  struct Range
+  {
+    Job *Target;
+    uint32 Begin, End;
+  };
+
+  struct Worker
+  {
+    std::thread Thread;
+    std::mutex Lock;
+    std::deque<Range> Queue;
+    // Time spent processing tiles in nanoseconds
+    std::atomic<uint64> BusyTime;
+  };
+
+  std::vector<std::unique_ptr<Worker>> Workers;
+  // Number of tiles waiting in all queues, increased before they are queued
+  std::atomic<uint32> Pending;
+  // Locked while tiles are submitted and by workers going to sleep, before the lock of any queue
+  std::mutex LockWait;
+  std::condition_variable CVWork;
+  bool Stopping;
+  std::atomic<uint32> NextWorker;
+
+  // Start of the current utilization period and busy time of all workers at that point
+  std::chrono::steady_clock::time_point PeriodStart;
+  uint64 PeriodBusyTime;
+
+  void WorkerLoop(const uint32 Index);
+  bool TakeTile(Worker &Owner, Range &Tile);
+  bool StealTiles(const uint32 Thief);
+  // Whether any queue holds a tile, the workers sleep while there is none
+  bool HasQueuedTiles();
+  void RunTile(Worker &Owner, const Range &Tile);
+
+public:
+  WorkerPool();
+  ~WorkerPool();
+
+  // Starts NumThreads workers, 0 uses one per logical core
+  void Start(uint32 NumThreads);
+
+  // Processes the remaining tiles and stops the workers
+  void Stop();
+
+  uint32 GetNumThreads() const;
+
+  // Splits Target into NumTiles tiles and queues them. Returns immediately, Target.Done is called once all are processed.
+  // Can be called from any thread.
+  void Submit(Job &Target, const uint32 NumTiles);
+
+  // Fraction of the time the workers were busy since the last call, from 0 to 1
+  float GetUtilization();
+};